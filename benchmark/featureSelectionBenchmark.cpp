@@ -0,0 +1,242 @@
+// Feature selection of the ring sectors, the partial selection (FeatureExtractor::selectSectorFeatures(), corner heap and per-point surface
+// resolution) against the original LOAM selection by sorting every sector (sortSectorFeatures()).
+//
+// The scans are ray cast from random poses in a synthetic scene (ground, walls and pillars) with a 128 ring, 45 deg vertical field of view sensor;
+// the ranges get noise, are rounded to 1 mm as the sensor reports them (so equal curvatures occur) and some returns are dropped. The smoothness
+// and occlusion marking run once per scan and selection, only the sector selection is timed. Checks that both select the same corner clouds (the
+// same points in the same order) and the same labels (corners and surfaces) of all points. Exits with a failure status if a check fails.
+//
+// usage: feature_selection_benchmark [scans, default 50] [columns, default 1024]
+
+#include "featureExtractor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+const int   scanHeight = 128;
+const float verticalFov = 45.0f * float(M_PI) / 180.0f;
+
+struct Pillar
+{
+  float x, y, radius;
+};
+
+/*//{ castRay() */
+// range of the first hit of the ray from (ox, oy, oz) in the unit direction (dx, dy, dz), 0 if nothing is hit
+float castRay(const float ox, const float oy, const float oz, const float dx, const float dy, const float dz, const std::vector<Pillar> &pillars) {
+  float range = std::numeric_limits<float>::max();
+
+  // ground
+  if (dz < 0) {
+    range = std::min(range, (-1.8f - oz) / dz);
+  }
+
+  // walls of the 60 x 60 m yard, 6 m high
+  const float bounds[4] = {-30, 30, -30, 30};
+  for (int axis = 0; axis < 2; axis++) {
+    const float o = axis == 0 ? ox : oy;
+    const float d = axis == 0 ? dx : dy;
+    if (std::abs(d) < 1e-6f) {
+      continue;
+    }
+    const float t = ((d > 0 ? bounds[2 * axis + 1] : bounds[2 * axis]) - o) / d;
+    if (oz + t * dz < 6.0f) {
+      range = std::min(range, t);
+    }
+  }
+
+  // pillars, 4 m above the ground
+  const float a = dx * dx + dy * dy;
+  if (a > 1e-12f) {
+    for (const Pillar &pillar : pillars) {
+      const float px = ox - pillar.x;
+      const float py = oy - pillar.y;
+      const float b  = px * dx + py * dy;
+      const float c  = px * px + py * py - pillar.radius * pillar.radius;
+      const float d  = b * b - a * c;
+      if (d < 0) {
+        continue;
+      }
+      const float t = (-b - std::sqrt(d)) / a;
+      if (t > 0 && t < range && oz + t * dz < 2.2f) {
+        range = t;
+      }
+    }
+  }
+
+  return range < 100.0f ? range : 0.0f;
+}
+/*//}*/
+
+/*//{ castScan() */
+// the CloudFrame fields filled as ImageProjection does (points of every ring in column order, the ring indices leave out 5 points at both ends)
+void castScan(const int scanWidth, const std::vector<Pillar> &pillars, std::mt19937 &generator, liosam::CloudFrame &frame) {
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  std::normal_distribution<float>       normal(0.0f, 0.01f);
+
+  const float ox = 20 * uniform(generator), oy = 20 * uniform(generator), oz = 0.3f * uniform(generator), yaw = float(M_PI) * uniform(generator);
+
+  pcl::PointCloud<PointType>::Ptr cloud(new pcl::PointCloud<PointType>());
+  frame.startRingIndex.assign(scanHeight, 0);
+  frame.endRingIndex.assign(scanHeight, 0);
+  frame.pointColInd.clear();
+  frame.pointRange.clear();
+
+  int count = 0;
+  for (int i = 0; i < scanHeight; i++) {
+    frame.startRingIndex[i] = count - 1 + 5;
+
+    const float pitch = -verticalFov / 2 + verticalFov * i / (scanHeight - 1);
+    for (int j = 0; j < scanWidth; j++) {
+      const float azimuth = yaw + 2 * float(M_PI) * j / scanWidth;
+      const float dx = std::cos(pitch) * std::cos(azimuth), dy = std::cos(pitch) * std::sin(azimuth), dz = std::sin(pitch);
+
+      float range = castRay(ox, oy, oz, dx, dy, dz, pillars);
+      if (range < 1.0f || uniform(generator) > 0.95f) {
+        continue;
+      }
+      range = std::round((range + normal(generator)) * 1000) / 1000;
+
+      PointType point;
+      point.x         = range * dx;
+      point.y         = range * dy;
+      point.z         = range * dz;
+      point.intensity = i + j / 10000.0f;
+      cloud->push_back(point);
+
+      frame.pointColInd.push_back(j);
+      frame.pointRange.push_back(range);
+      count++;
+    }
+
+    frame.endRingIndex[i] = count - 1 - 5;
+  }
+
+  frame.cloudDeskewed = cloud;
+}
+/*//}*/
+
+}  // namespace
+
+namespace liosam
+{
+
+/*//{ struct FeatureSelectionBenchmark */
+struct FeatureSelectionBenchmark
+{
+  /*//{ select() */
+  // corners and labels of the scan, returns the time of the sector selection in seconds
+  static double select(FeatureExtractor &extractor, const CloudFrame &frame, const bool sort, pcl::PointCloud<PointType> &cornerCloud,
+                       std::vector<int8_t> &labels) {
+    const size_t cloudSize = frame.cloudDeskewed->points.size();
+    if (extractor.cloudCurvature.size() < cloudSize) {
+      extractor.cloudCurvature.resize(cloudSize);
+      extractor.cloudFlags.resize(cloudSize);
+      extractor.cloudNeighborPicked.resize(cloudSize);
+      extractor.cloudLabel.resize(cloudSize);
+      extractor.cloudSortInd.resize(cloudSize);
+      extractor.surfaceState.resize(cloudSize);
+    }
+    extractor.workers.resize(1);
+
+    extractor.calculateSmoothness(frame);
+    extractor.markOccludedPoints(frame);
+    cornerCloud.clear();
+
+    // the sectors of FeatureExtractor::extractRing()
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < int(frame.startRingIndex.size()); i++) {
+      for (int j = 0; j < 6; j++) {
+        const int sp = (frame.startRingIndex[i] * (6 - j) + frame.endRingIndex[i] * j) / 6;
+        const int ep = (frame.startRingIndex[i] * (5 - j) + frame.endRingIndex[i] * (j + 1)) / 6 - 1;
+        if (sp >= ep) {
+          continue;
+        }
+        if (sort) {
+          extractor.sortSectorFeatures(frame, sp, ep, cornerCloud);
+        } else {
+          extractor.selectSectorFeatures(frame, sp, ep, extractor.workers[0], cornerCloud);
+        }
+      }
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    labels.assign(extractor.cloudLabel.begin(), extractor.cloudLabel.begin() + cloudSize);
+    return std::chrono::duration<double>(end - start).count();
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace liosam
+
+int main(int argc, char **argv) {
+  const int scans     = argc > 1 ? std::atoi(argv[1]) : 50;
+  const int scanWidth = argc > 2 ? std::atoi(argv[2]) : 1024;
+
+  std::mt19937 generator(42);
+
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  std::vector<Pillar>                   pillars(40);
+  for (Pillar &pillar : pillars) {
+    pillar = Pillar{28 * uniform(generator), 28 * uniform(generator), 0.4f + 0.3f * uniform(generator)};
+  }
+
+  liosam::FeatureExtractor extractor;
+  extractor.edgeThreshold             = 0.1f;
+  extractor.surfThreshold             = 0.1f;
+  extractor.parallelFeatureExtraction = false;
+  extractor.numberOfCores             = 1;
+
+  pcl::PointCloud<PointType> sortedCorners, selectedCorners;
+  std::vector<int8_t>        sortedLabels, selectedLabels;
+
+  double sortTime = 0, selectTime = 0;
+  long   points = 0, corners = 0, surfaces = 0;
+  int    failures = 0;
+  for (int scan = 0; scan < scans; scan++) {
+    liosam::CloudFrame frame;
+    castScan(scanWidth, pillars, generator, frame);
+
+    sortTime += liosam::FeatureSelectionBenchmark::select(extractor, frame, true, sortedCorners, sortedLabels);
+    selectTime += liosam::FeatureSelectionBenchmark::select(extractor, frame, false, selectedCorners, selectedLabels);
+
+    bool sameCorners = sortedCorners.size() == selectedCorners.size();
+    for (size_t k = 0; sameCorners && k < sortedCorners.size(); k++) {
+      const PointType &a = sortedCorners.points[k], &b = selectedCorners.points[k];
+      sameCorners        = a.x == b.x && a.y == b.y && a.z == b.z && a.intensity == b.intensity;
+    }
+    int differentLabels = 0;
+    for (size_t k = 0; k < sortedLabels.size(); k++) {
+      differentLabels += sortedLabels[k] != selectedLabels[k];
+    }
+
+    if (!sameCorners || differentLabels > 0) {
+      std::printf("scan %d: corners: %lu (sorted %lu)%s, different labels: %d\n", scan, selectedCorners.size(), sortedCorners.size(),
+                  sameCorners ? "" : " differ", differentLabels);
+      failures++;
+    }
+
+    points += sortedLabels.size();
+    corners += sortedCorners.size();
+    for (const int8_t label : sortedLabels) {
+      surfaces += label < 0;
+    }
+  }
+
+  std::printf("%d scans of %d x %d: %.0f points, %.0f corners, %.0f surfaces per scan, different scans: %d, %.3f ms (sorted) vs %.3f ms (selected) per "
+              "scan\n",
+              scans, scanHeight, scanWidth, double(points) / scans, double(corners) / scans, double(surfaces) / scans, failures,
+              1e3 * sortTime / scans, 1e3 * selectTime / scans);
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
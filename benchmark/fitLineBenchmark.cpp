@@ -0,0 +1,183 @@
+// Line fit of the corner points of the scan-to-map matching (lineDirection(), closed-form 3x3 in double) against the cv::eigen decomposition of
+// the same float covariance that it replaced.
+//
+// Checks that both accept the same neighbourhoods as lines (largest eigenvalue more than 3 times the second one) and find the same direction (within
+// 1e-3 rad), and times both. Besides random and noisy-line neighbourhoods it builds ones whose eigenvalue ratio lies within 1e-3 of the threshold.
+// A different decision is a failure unless the ratio is within float rounding (1e-5 relative) of 3, where the float decomposition itself is not
+// reliable. Exits with a failure status if a check fails.
+//
+// usage: fit_line_benchmark [neighbourhoods per kind, default 200000]
+
+#include "lineFit.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+struct Point
+{
+  float x, y, z;
+};
+
+typedef std::array<Point, 5> Neighbourhood;
+
+/*//{ place() */
+// rotates the points (in a local frame around the origin) randomly and moves them somewhere within 100 m, as the map points are
+Neighbourhood place(const Eigen::Vector3d local[5], std::mt19937 &generator) {
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  const Eigen::Matrix3d rotation = Eigen::Quaterniond(Eigen::Vector4d::NullaryExpr([&]() { return uniform(generator); }).normalized()).toRotationMatrix();
+  const Eigen::Vector3d offset   = 100 * Eigen::Vector3d::NullaryExpr([&]() { return uniform(generator); });
+
+  Neighbourhood points;
+  for (int j = 0; j < 5; j++) {
+    const Eigen::Vector3d p = rotation * local[j] + offset;
+    points[j]               = Point{float(p.x()), float(p.y()), float(p.z())};
+  }
+  return points;
+}
+/*//}*/
+
+/*//{ generate() */
+// kind 0 - uniform in a box, 1 - noisy line, 2 - eigenvalue ratio near 3
+Neighbourhood generate(const int kind, std::mt19937 &generator) {
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  std::normal_distribution<double>       normal(0.0, 1.0);
+  Eigen::Vector3d                        local[5];
+
+  if (kind == 0) {
+    for (int j = 0; j < 5; j++) {
+      local[j] = 0.5 * Eigen::Vector3d::NullaryExpr([&]() { return uniform(generator); });
+    }
+  } else if (kind == 1) {
+    const double sigma = std::pow(10.0, -3 + 2.5 * (uniform(generator) + 1) / 2);  // 1 mm to 0.3 m
+    for (int j = 0; j < 5; j++) {
+      local[j] = Eigen::Vector3d(0.5 * uniform(generator), 0, 0) + sigma * Eigen::Vector3d::NullaryExpr([&]() { return normal(generator); });
+    }
+  } else {
+    // x = s1 * (-2 -1 0 1 2) and y = s2 * (1 -1 0 -1 1) have zero means and covariance, variances 2 s1^2 and 0.8 s2^2
+    const double epsilon = 1e-3 * uniform(generator);
+    const double s2      = 0.05 + 0.1 * (uniform(generator) + 1);
+    const double s1      = s2 * std::sqrt(1.2 * (1 + epsilon));
+    const double x[5]    = {-2, -1, 0, 1, 2};
+    const double y[5]    = {1, -1, 0, -1, 1};
+    for (int j = 0; j < 5; j++) {
+      local[j] = Eigen::Vector3d(s1 * x[j], s2 * y[j], 0.001 * normal(generator));
+    }
+  }
+  return place(local, generator);
+}
+/*//}*/
+
+/*//{ referenceDirection() */
+// the replaced code: cv::eigen of the float covariance, eigenvalues in decreasing order
+bool referenceDirection(const float covariance[6], float direction[3]) {
+  cv::Mat matA1(3, 3, CV_32F, cv::Scalar::all(0));
+  cv::Mat matD1(1, 3, CV_32F, cv::Scalar::all(0));
+  cv::Mat matV1(3, 3, CV_32F, cv::Scalar::all(0));
+
+  matA1.at<float>(0, 0) = covariance[0];
+  matA1.at<float>(0, 1) = covariance[1];
+  matA1.at<float>(0, 2) = covariance[2];
+  matA1.at<float>(1, 0) = covariance[1];
+  matA1.at<float>(1, 1) = covariance[3];
+  matA1.at<float>(1, 2) = covariance[4];
+  matA1.at<float>(2, 0) = covariance[2];
+  matA1.at<float>(2, 1) = covariance[4];
+  matA1.at<float>(2, 2) = covariance[5];
+
+  cv::eigen(matA1, matD1, matV1);
+
+  if (!(matD1.at<float>(0, 0) > 3 * matD1.at<float>(0, 1))) {
+    return false;
+  }
+  direction[0] = matV1.at<float>(0, 0);
+  direction[1] = matV1.at<float>(0, 1);
+  direction[2] = matV1.at<float>(0, 2);
+  return true;
+}
+/*//}*/
+
+/*//{ ratioMargin() */
+// relative distance of the eigenvalue ratio of the covariance from the threshold, in double
+double ratioMargin(const float covariance[6]) {
+  Eigen::Matrix3d matA1;
+  matA1 << covariance[0], covariance[1], covariance[2], covariance[1], covariance[3], covariance[4], covariance[2], covariance[4], covariance[5];
+  const Eigen::Vector3d values = Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d>(matA1, Eigen::EigenvaluesOnly).eigenvalues();
+  return std::abs(values(2) - 3 * values(1)) / std::max(values(2), 1e-30);
+}
+/*//}*/
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const int   count    = argc > 1 ? std::atoi(argv[1]) : 200000;
+  const char *names[3] = {"uniform", "line", "near threshold"};
+
+  std::mt19937 generator(42);
+  int          failures = 0;
+
+  for (int kind = 0; kind < 3; kind++) {
+    std::vector<Neighbourhood> neighbourhoods(count);
+    for (Neighbourhood &points : neighbourhoods) {
+      points = generate(kind, generator);
+    }
+
+    // the decisions and directions
+    int    accepted = 0, referenceAccepted = 0, differentTies = 0, different = 0;
+    double maxAngle = 0;
+    for (const Neighbourhood &points : neighbourhoods) {
+      float      centroid[3], covariance[6], direction[3], referenceDir[3];
+      liosam::lineCovariance(points.data(), 5, centroid, covariance);
+      const bool line          = liosam::lineDirection(covariance, direction);
+      const bool referenceLine = referenceDirection(covariance, referenceDir);
+
+      accepted += line;
+      referenceAccepted += referenceLine;
+      if (line != referenceLine) {
+        (ratioMargin(covariance) < 1e-5 ? differentTies : different)++;
+      } else if (line) {
+        // from the cross product, acos of the dot product of float vectors is not accurate for small angles
+        const Eigen::Vector3d a(direction[0], direction[1], direction[2]);
+        const Eigen::Vector3d b(referenceDir[0], referenceDir[1], referenceDir[2]);
+        maxAngle = std::max(maxAngle, std::atan2(a.cross(b).norm(), std::abs(a.dot(b))));
+      }
+    }
+
+    // the time of the decomposition only, the covariances are computed beforehand
+    std::vector<std::array<float, 6>> covariances(count);
+    for (int i = 0; i < count; i++) {
+      float centroid[3];
+      liosam::lineCovariance(neighbourhoods[i].data(), 5, centroid, covariances[i].data());
+    }
+    float      direction[3];
+    int        sink  = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto &covariance : covariances) {
+      sink += liosam::lineDirection(covariance.data(), direction);
+    }
+    const auto middle = std::chrono::steady_clock::now();
+    for (const auto &covariance : covariances) {
+      sink += referenceDirection(covariance.data(), direction);
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    std::printf("%-15s lines: %d (cv::eigen %d), different decisions: %d (+%d within float rounding of the threshold), max angle: %.2e rad, "
+                "%.0f ns vs %.0f ns per fit (%d)\n",
+                names[kind], accepted, referenceAccepted, different, differentTies, maxAngle,
+                std::chrono::duration<double, std::nano>(middle - start).count() / count,
+                std::chrono::duration<double, std::nano>(end - middle).count() / count, sink);
+
+    failures += different + (maxAngle > 1e-3);
+  }
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
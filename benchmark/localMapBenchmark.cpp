@@ -0,0 +1,198 @@
+// Nearest neighbour search of the scan-to-map matching in the local map indices: pcl::KdTreeFLANN (localMapType "kdtree"), IkdTree ("ikdtree")
+// and VoxelMap ("ivox") with 7 and 27 neighbouring voxels.
+//
+// The map and the scan are PCD files in the same (map) frame, e.g. cloudSurf.pcd of a savePCD export and a scan registered to it. Both are
+// downsampled by the leaf size as MapOptimization does (mappingSurfLeafSize, mappingCornerLeafSize for the corners), the incremental indices are
+// filled by addPoints() with the leaf size and the kd-tree gets the downsampled map. Every point of the downsampled scan queries its 5 nearest
+// neighbours, in parallel as the scan-to-map passes do; the scan is repeated and the median time of one scan is its latency, the time per query
+// is of one thread. The points an index keeps depend on its addPoints(), so its results are compared to an exact search in its own points, for
+// the queries whose 5th neighbour is within 1 m (the others are not used by the matching).
+//
+// The scan points query the map in the order of the downsampling (unordered) or along the Z-order curve of their 1 m cells as with
+// mortonOrderedQueries (ordered, computed in the map frame here, which is a rigid transformation of the lidar frame).
+//
+// usage: local_map_benchmark map.pcd scan.pcd [leaf size, default 0.4] [threads, default 4] [repetitions, default 20] [unordered|ordered]
+
+#include "ikdTree.h"
+#include "mortonOrder.h"
+#include "voxelMap.h"
+
+#include <pcl/point_types.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+typedef pcl::PointXYZI PointType;
+typedef pcl::PointCloud<PointType> Cloud;
+
+const int k = 5;
+
+// search of one index, returns the squared distances of the neighbours
+typedef std::function<void(const PointType &point, std::vector<float> &sqDistances)> Search;
+
+struct Index
+{
+  const char *name;
+  double      build;
+  int         points;
+  Search      search;
+  Search      exact;
+};
+
+/*//{ kdtreeSearch() */
+Search kdtreeSearch(const pcl::KdTreeFLANN<PointType>::Ptr &kdtree) {
+  return [kdtree](const PointType &point, std::vector<float> &sqDistances) {
+    std::vector<int> indices;
+    kdtree->nearestKSearch(point, k, indices, sqDistances);
+  };
+}
+/*//}*/
+
+/*//{ localMapSearch() */
+Search localMapSearch(const std::shared_ptr<liosam::LocalMapIndex<PointType>> &localMap) {
+  return [localMap](const PointType &point, std::vector<float> &sqDistances) {
+    std::vector<PointType> points;
+    localMap->nearestKSearch(point, k, points, sqDistances);
+  };
+}
+/*//}*/
+
+/*//{ downsample() */
+Cloud::Ptr downsample(const Cloud::Ptr &cloud, const float leafSize) {
+  pcl::VoxelGrid<PointType> downSizeFilter;
+  downSizeFilter.setLeafSize(leafSize, leafSize, leafSize);
+  downSizeFilter.setInputCloud(cloud);
+
+  Cloud::Ptr cloudDS(new Cloud());
+  downSizeFilter.filter(*cloudDS);
+  return cloudDS;
+}
+/*//}*/
+
+/*//{ seconds() */
+double seconds(const std::chrono::steady_clock::time_point &start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+/*//}*/
+
+/*//{ runScan() */
+// the 5-NN search of every scan point, the squared distances go to sqDistances[k * i, k * i + k), returns the time
+double runScan(const Search &search, const Cloud &scan, const int threads, std::vector<float> &sqDistances) {
+  const int n = scan.size();
+  sqDistances.assign(k * n, -1.0f);
+
+  const auto start = std::chrono::steady_clock::now();
+#pragma omp parallel num_threads(threads)
+  {
+    std::vector<float> pointSqDistances;
+#pragma omp for
+    for (int i = 0; i < n; i++) {
+      search(scan.points[i], pointSqDistances);
+      std::copy_n(pointSqDistances.begin(), std::min(int(pointSqDistances.size()), k), sqDistances.begin() + k * i);
+    }
+  }
+  return seconds(start);
+}
+/*//}*/
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::fprintf(stderr, "usage: %s map.pcd scan.pcd [leaf size, default 0.4] [threads, default 4] [repetitions, default 20] [unordered|ordered]\n",
+                 argv[0]);
+    return EXIT_FAILURE;
+  }
+  const float leafSize    = argc > 3 ? std::atof(argv[3]) : 0.4f;
+  const int   threads     = argc > 4 ? std::atoi(argv[4]) : 4;
+  const int   repetitions = argc > 5 ? std::atoi(argv[5]) : 20;
+  const bool  ordered     = argc > 6 && std::string(argv[6]) == "ordered";
+
+  Cloud::Ptr map(new Cloud()), scan(new Cloud());
+  if (pcl::io::loadPCDFile(argv[1], *map) != 0 || pcl::io::loadPCDFile(argv[2], *scan) != 0) {
+    std::fprintf(stderr, "failed to load %s or %s\n", argv[1], argv[2]);
+    return EXIT_FAILURE;
+  }
+  const Cloud::Ptr mapDS  = downsample(map, leafSize);
+  const Cloud::Ptr scanDS = downsample(scan, leafSize);
+  if (ordered) {
+    std::vector<int> order;
+    liosam::mortonOrder(*scanDS, 1.0f, order);
+    const Cloud unordered = *scanDS;
+    for (size_t i = 0; i < order.size(); i++) {
+      scanDS->points[i] = unordered.points[order[i]];
+    }
+  }
+  std::printf("map: %lu points (%lu downsampled), scan: %lu points (%lu downsampled), leaf size %.2f m, %d threads, %s\n", map->size(),
+              mapDS->size(), scan->size(), scanDS->size(), leafSize, threads, ordered ? "ordered" : "unordered");
+
+  // the indices, each with the exact search in its own points
+  std::vector<Index> indices;
+
+  pcl::KdTreeFLANN<PointType>::Ptr kdtree(new pcl::KdTreeFLANN<PointType>());
+  const auto start = std::chrono::steady_clock::now();
+  kdtree->setInputCloud(mapDS);
+  indices.push_back(Index{"kdtree", seconds(start), int(mapDS->size()), kdtreeSearch(kdtree), kdtreeSearch(kdtree)});
+
+  const std::vector<std::pair<const char *, std::shared_ptr<liosam::LocalMapIndex<PointType>>>> incremental = {
+      {"ikdtree", std::make_shared<liosam::IkdTree<PointType>>()},
+      {"ivox 7", std::make_shared<liosam::VoxelMap<PointType>>(1.0f, 30, liosam::VoxelMap<PointType>::Neighborhood::NEARBY7)},
+      {"ivox 27", std::make_shared<liosam::VoxelMap<PointType>>(1.0f, 30, liosam::VoxelMap<PointType>::Neighborhood::NEARBY27)},
+  };
+  for (const auto &index : incremental) {
+    const auto start = std::chrono::steady_clock::now();
+    index.second->addPoints(*mapDS, leafSize);
+    const double build = seconds(start);
+
+    Cloud::Ptr points(new Cloud());
+    index.second->flatten(*points);
+    pcl::KdTreeFLANN<PointType>::Ptr exact(new pcl::KdTreeFLANN<PointType>());
+    exact->setInputCloud(points);
+
+    indices.push_back(Index{index.first, build, index.second->size(), localMapSearch(index.second), kdtreeSearch(exact)});
+  }
+
+  std::printf("%-8s %10s %10s %10s %14s %12s %10s\n", "index", "points", "build [ms]", "scan [ms]", "queries [M/s]", "us / query", "exact [%]");
+  std::vector<float> exact, result;
+  for (const Index &index : indices) {
+    std::vector<double> times;
+    for (int r = 0; r < repetitions; r++) {
+      times.push_back(runScan(index.search, *scanDS, threads, result));
+    }
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    const double latency = times[times.size() / 2];
+
+    // the same neighbour distances as the exact search, for the queries used by the matching
+    runScan(index.exact, *scanDS, threads, exact);
+    int used = 0, same = 0;
+    for (size_t i = 0; i < scanDS->size(); i++) {
+      if (!(exact[k * i + k - 1] >= 0 && exact[k * i + k - 1] < 1.0f)) {
+        continue;
+      }
+      bool equal = true;
+      for (int j = 0; j < k; j++) {
+        equal = equal && std::abs(result[k * i + j] - exact[k * i + j]) <= 1e-5f * std::max(exact[k * i + j], 1.0f);
+      }
+      used++;
+      same += equal;
+    }
+
+    std::printf("%-8s %10d %10.1f %10.3f %14.3f %12.3f %10.2f\n", index.name, index.points, 1e3 * index.build, 1e3 * latency,
+                scanDS->size() / latency / 1e6, 1e6 * latency * threads / scanDS->size(), used > 0 ? 100.0 * same / used : 100.0);
+  }
+
+  return EXIT_SUCCESS;
+}
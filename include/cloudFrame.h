@@ -0,0 +1,247 @@
+#ifndef CLOUD_FRAME_H
+#define CLOUD_FRAME_H
+
+#include <ros/message_traits.h>
+#include <ros/serialization.h>
+
+#include <std_msgs/Header.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include "liosam/cloud_info.h"
+
+namespace liosam
+{
+
+/*//{ struct CloudFrame */
+// In-process counterpart of liosam::cloud_info, the clouds are shared instead of being serialized into sensor_msgs::PointCloud2.
+//
+// A published frame must not be modified anymore, the subscribers in the same nodelet manager receive the very same object. The ROS traits below
+// give it the type and md5sum of liosam/cloud_info (the pcl_ros approach), so subscribers in other processes and tools like rosbag still get a
+// regular cloud_info message; the conversion happens only when such a subscriber exists.
+struct CloudFrame
+{
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  std_msgs::Header header;
+
+  std::vector<int32_t> startRingIndex;
+  std::vector<int32_t> endRingIndex;
+
+  std::vector<int32_t> pointColInd;  // point column index in range image
+  std::vector<float>   pointRange;   // point range
+
+  int64_t imuAvailable  = 0;
+  int64_t odomAvailable = 0;
+
+  // Attitude for LOAM initialization
+  float imuRollInit  = 0;
+  float imuPitchInit = 0;
+  float imuYawInit   = 0;
+
+  // Initial guess from imu pre-integration
+  float initialGuessX     = 0;
+  float initialGuessY     = 0;
+  float initialGuessZ     = 0;
+  float initialGuessRoll  = 0;
+  float initialGuessPitch = 0;
+  float initialGuessYaw   = 0;
+
+  Cloud::ConstPtr cloudDeskewed;  // original cloud deskewed
+  Cloud::ConstPtr cloudCorner;    // extracted corner feature
+  Cloud::ConstPtr cloudSurface;   // extracted surface feature
+
+  typedef boost::shared_ptr<CloudFrame>       Ptr;
+  typedef boost::shared_ptr<const CloudFrame> ConstPtr;
+
+  /*//{ toMsg() */
+  // the message is cached, roscpp asks for the serialized length and then for the data
+  const liosam::cloud_info &toMsg() const {
+    if (msgCache_.msg) {
+      return *msgCache_.msg;
+    }
+
+    msgCache_.msg = boost::make_shared<liosam::cloud_info>();
+
+    liosam::cloud_info &msg = *msgCache_.msg;
+    msg.header              = header;
+    msg.startRingIndex      = startRingIndex;
+    msg.endRingIndex        = endRingIndex;
+    msg.pointColInd         = pointColInd;
+    msg.pointRange          = pointRange;
+    msg.imuAvailable        = imuAvailable;
+    msg.odomAvailable       = odomAvailable;
+    msg.imuRollInit         = imuRollInit;
+    msg.imuPitchInit        = imuPitchInit;
+    msg.imuYawInit          = imuYawInit;
+    msg.initialGuessX       = initialGuessX;
+    msg.initialGuessY       = initialGuessY;
+    msg.initialGuessZ       = initialGuessZ;
+    msg.initialGuessRoll    = initialGuessRoll;
+    msg.initialGuessPitch   = initialGuessPitch;
+    msg.initialGuessYaw     = initialGuessYaw;
+
+    cloudToMsg(cloudDeskewed, msg.cloud_deskewed);
+    cloudToMsg(cloudCorner, msg.cloud_corner);
+    cloudToMsg(cloudSurface, msg.cloud_surface);
+
+    return msg;
+  }
+  /*//}*/
+
+  /*//{ fromMsg() */
+  void fromMsg(const liosam::cloud_info &msg) {
+    header            = msg.header;
+    startRingIndex    = msg.startRingIndex;
+    endRingIndex      = msg.endRingIndex;
+    pointColInd       = msg.pointColInd;
+    pointRange        = msg.pointRange;
+    imuAvailable      = msg.imuAvailable;
+    odomAvailable     = msg.odomAvailable;
+    imuRollInit       = msg.imuRollInit;
+    imuPitchInit      = msg.imuPitchInit;
+    imuYawInit        = msg.imuYawInit;
+    initialGuessX     = msg.initialGuessX;
+    initialGuessY     = msg.initialGuessY;
+    initialGuessZ     = msg.initialGuessZ;
+    initialGuessRoll  = msg.initialGuessRoll;
+    initialGuessPitch = msg.initialGuessPitch;
+    initialGuessYaw   = msg.initialGuessYaw;
+
+    cloudDeskewed = cloudFromMsg(msg.cloud_deskewed);
+    cloudCorner   = cloudFromMsg(msg.cloud_corner);
+    cloudSurface  = cloudFromMsg(msg.cloud_surface);
+
+    invalidateMsg();
+  }
+  /*//}*/
+
+  /*//{ invalidateMsg() */
+  // has to be called when an unpublished frame is reused for new data
+  void invalidateMsg() {
+    msgCache_.msg.reset();
+  }
+  /*//}*/
+
+private:
+  // not copied with the frame, the copy is going to be a different message
+  struct MsgCache
+  {
+    boost::shared_ptr<liosam::cloud_info> msg;
+
+    MsgCache() {
+    }
+    MsgCache(const MsgCache &) {
+    }
+    MsgCache &operator=(const MsgCache &) {
+      msg.reset();
+      return *this;
+    }
+  };
+
+  mutable MsgCache msgCache_;
+
+  /*//{ cloudToMsg() */
+  void cloudToMsg(const Cloud::ConstPtr &cloud, sensor_msgs::PointCloud2 &msg) const {
+    if (!cloud) {
+      return;
+    }
+    pcl::toROSMsg(*cloud, msg);
+    msg.header = header;
+  }
+  /*//}*/
+
+  /*//{ cloudFromMsg() */
+  static Cloud::ConstPtr cloudFromMsg(const sensor_msgs::PointCloud2 &msg) {
+    Cloud::Ptr cloud(new Cloud());
+    if (!msg.data.empty()) {
+      pcl::fromROSMsg(msg, *cloud);
+    }
+    return cloud;
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace liosam
+
+namespace ros
+{
+
+namespace message_traits
+{
+
+/*//{ message traits */
+template <>
+struct MD5Sum<liosam::CloudFrame>
+{
+  static const char *value() {
+    return MD5Sum<liosam::cloud_info>::value();
+  }
+  static const char *value(const liosam::CloudFrame &) {
+    return value();
+  }
+};
+
+template <>
+struct DataType<liosam::CloudFrame>
+{
+  static const char *value() {
+    return DataType<liosam::cloud_info>::value();
+  }
+  static const char *value(const liosam::CloudFrame &) {
+    return value();
+  }
+};
+
+template <>
+struct Definition<liosam::CloudFrame>
+{
+  static const char *value() {
+    return Definition<liosam::cloud_info>::value();
+  }
+  static const char *value(const liosam::CloudFrame &) {
+    return value();
+  }
+};
+
+template <>
+struct HasHeader<liosam::CloudFrame> : TrueType
+{
+};
+/*//}*/
+
+}  // namespace message_traits
+
+namespace serialization
+{
+
+/*//{ Serializer */
+template <>
+struct Serializer<liosam::CloudFrame>
+{
+  template <typename Stream>
+  inline static void write(Stream &stream, const liosam::CloudFrame &frame) {
+    stream.next(frame.toMsg());
+  }
+
+  template <typename Stream>
+  inline static void read(Stream &stream, liosam::CloudFrame &frame) {
+    liosam::cloud_info msg;
+    stream.next(msg);
+    frame.fromMsg(msg);
+  }
+
+  inline static uint32_t serializedLength(const liosam::CloudFrame &frame) {
+    return serializationLength(frame.toMsg());
+  }
+};
+/*//}*/
+
+}  // namespace serialization
+
+}  // namespace ros
+
+#endif  // CLOUD_FRAME_H
@@ -0,0 +1,443 @@
+#ifndef FEATURE_EXTRACTOR_H
+#define FEATURE_EXTRACTOR_H
+
+#include "utility.h"
+#include "smoothnessKernel.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace liosam
+{
+
+/*//{ class FeatureExtractor */
+// LOAM feature extraction on the range image data of a CloudFrame (pointRange, pointColInd, ring indices), shared by the FeatureExtraction nodelet
+// and the fused Frontend nodelet. The buffers are sized by the incoming frame, no knowledge of the scan dimensions is needed.
+class FeatureExtractor {
+
+public:
+  // LOAM
+  float edgeThreshold;
+  float surfThreshold;
+
+  // select the features by sorting every ring sector (original LOAM) instead of the partial selection, both give the same features
+  bool sortFeatureSectors;
+
+  // Voxel filter params
+  float odometrySurfLeafSize;
+
+  // CPU params, the rings are extracted in parallel by numberOfCores threads
+  bool parallelFeatureExtraction;
+  int  numberOfCores;
+
+  /*//{ loadParams() */
+  void loadParams(mrs_lib::ParamLoader &pl) {
+    pl.loadParam("odometrySurfLeafSize", odometrySurfLeafSize, 0.2f);
+
+    pl.loadParam("edgeThreshold", edgeThreshold, 0.1f);
+    pl.loadParam("surfThreshold", surfThreshold, 0.1f);
+    pl.loadParam("sortFeatureSectors", sortFeatureSectors, false);
+
+    pl.loadParam("parallelFeatureExtraction", parallelFeatureExtraction, false);
+    pl.loadParam("numberOfCores", numberOfCores, 4);
+
+    workers.resize(parallelFeatureExtraction ? std::max(numberOfCores, 1) : 1);
+    for (auto &worker : workers) {
+      worker.downSizeFilter.setLeafSize(odometrySurfLeafSize, odometrySurfLeafSize, odometrySurfLeafSize);
+      worker.surfaceCloudScan.reset(new pcl::PointCloud<PointType>());
+      worker.surfaceCloudScanDS.reset(new pcl::PointCloud<PointType>());
+    }
+
+    ROS_INFO("[FeatureExtraction]: smoothness kernel: %s", smoothnessKernelName());
+  }
+  /*//}*/
+
+  /*//{ extract() */
+  void extract(const CloudFrame &cloud_info, pcl::PointCloud<PointType> &cornerCloud, pcl::PointCloud<PointType> &surfaceCloud) {
+    const size_t cloudSize = cloud_info.cloudDeskewed->points.size();
+    if (cloudCurvature.size() < cloudSize) {
+      cloudCurvature.resize(cloudSize);
+      cloudFlags.resize(cloudSize);
+      cloudNeighborPicked.resize(cloudSize);
+      cloudLabel.resize(cloudSize);
+      cloudSortInd.resize(cloudSize);
+      surfaceState.resize(cloudSize);
+    }
+
+    calculateSmoothness(cloud_info);
+
+    markOccludedPoints(cloud_info);
+
+    extractFeatures(cloud_info, cornerCloud, surfaceCloud);
+  }
+  /*//}*/
+
+  /*//{ featureFrame() */
+  // the frame passed to MapOptimization, copy everything except: laser data indices and ranges (no further need for this information)
+  static CloudFrame::Ptr featureFrame(const CloudFrame &msg, const pcl::PointCloud<PointType>::ConstPtr &cornerCloud,
+                                      const pcl::PointCloud<PointType>::ConstPtr &surfaceCloud) {
+    CloudFrame::Ptr cloudInfo    = boost::make_shared<CloudFrame>();
+    cloudInfo->header            = msg.header;
+    cloudInfo->imuAvailable      = msg.imuAvailable;
+    cloudInfo->odomAvailable     = msg.odomAvailable;
+    cloudInfo->imuRollInit       = msg.imuRollInit;
+    cloudInfo->imuPitchInit      = msg.imuPitchInit;
+    cloudInfo->imuYawInit        = msg.imuYawInit;
+    cloudInfo->initialGuessX     = msg.initialGuessX;
+    cloudInfo->initialGuessY     = msg.initialGuessY;
+    cloudInfo->initialGuessZ     = msg.initialGuessZ;
+    cloudInfo->initialGuessRoll  = msg.initialGuessRoll;
+    cloudInfo->initialGuessPitch = msg.initialGuessPitch;
+    cloudInfo->initialGuessYaw   = msg.initialGuessYaw;
+    cloudInfo->cloudDeskewed     = msg.cloudDeskewed;
+
+    // save newly extracted features
+    cloudInfo->cloudCorner  = cornerCloud;
+    cloudInfo->cloudSurface = surfaceCloud;
+
+    return cloudInfo;
+  }
+  /*//}*/
+
+private:
+  // benchmark/featureSelectionBenchmark.cpp times and compares the two sector selections
+  friend struct FeatureSelectionBenchmark;
+
+  /*//{ struct RingWorker */
+  // scratch data of one extraction thread
+  struct RingWorker
+  {
+    pcl::VoxelGrid<PointType>       downSizeFilter;
+    pcl::PointCloud<PointType>::Ptr surfaceCloudScan;
+    pcl::PointCloud<PointType>::Ptr surfaceCloudScanDS;
+
+    // partial selection
+    std::vector<int> cornerHeap;
+    std::vector<int> surfaceStack;
+  };
+  /*//}*/
+
+  std::vector<RingWorker> workers;
+
+  // per ring output of the parallel extraction, merged in ring order
+  std::vector<pcl::PointCloud<PointType>::Ptr> ringCorners;
+  std::vector<pcl::PointCloud<PointType>::Ptr> ringSurfaces;
+
+  // structure of arrays, indexed by the point index
+  std::vector<float>   cloudCurvature;
+  std::vector<uint8_t> cloudFlags;  // SmoothnessFlag
+  std::vector<uint8_t> cloudNeighborPicked;
+  std::vector<int8_t>  cloudLabel;
+  std::vector<int>     cloudSortInd;  // point indices sorted by curvature within a ring sector
+
+  // partial selection
+  enum SurfaceState : uint8_t
+  {
+    SURFACE_UNKNOWN,
+    SURFACE_ACCEPTED,
+    SURFACE_REJECTED,
+  };
+  std::vector<SurfaceState> surfaceState;
+
+  /*//{ calculateSmoothness() */
+  // curvature and the occlusion/parallel beam flags in one vectorized pass
+  void calculateSmoothness(const CloudFrame &cloud_info) {
+    const int cloudSize = cloud_info.cloudDeskewed->points.size();
+    computeSmoothness(cloud_info.pointRange.data(), cloud_info.pointColInd.data(), cloudSize, cloudCurvature.data(), cloudFlags.data());
+  }
+  /*//}*/
+
+  /*//{ markOccludedPoints() */
+  void markOccludedPoints(const CloudFrame &cloud_info) {
+    const int cloudSize = cloud_info.cloudDeskewed->points.size();
+
+    // the first and last 5 points have no full curvature window, they are never selected
+    const int margin = std::min(5, cloudSize);
+    std::fill(cloudCurvature.begin(), cloudCurvature.begin() + margin, 0.0f);
+    std::fill(cloudCurvature.begin() + std::max(cloudSize - 5, margin), cloudCurvature.begin() + cloudSize, 0.0f);
+    std::fill(cloudNeighborPicked.begin(), cloudNeighborPicked.begin() + cloudSize, 1);
+    std::fill(cloudNeighborPicked.begin() + margin, cloudNeighborPicked.begin() + std::max(cloudSize - 5, margin), 0);
+    std::fill(cloudLabel.begin(), cloudLabel.begin() + cloudSize, 0);
+    for (int i = 0; i < cloudSize; i++) {
+      cloudSortInd[i] = i;
+    }
+
+    // mark occluded points and parallel beam points, the flags are sparse so they are skipped 8 at a time
+    const int end = cloudSize - 6;
+    for (int i = 5; i < end;) {
+      if (i + 8 <= end) {
+        uint64_t block;
+        std::memcpy(&block, &cloudFlags[i], sizeof(block));
+        if (block == 0) {
+          i += 8;
+          continue;
+        }
+      }
+
+      const uint8_t flags = cloudFlags[i];
+      if (flags & OCCLUDED_BEFORE) {
+        std::fill(cloudNeighborPicked.begin() + i - 5, cloudNeighborPicked.begin() + i + 1, 1);
+      } else if (flags & OCCLUDED_AFTER) {
+        std::fill(cloudNeighborPicked.begin() + i + 1, cloudNeighborPicked.begin() + i + 7, 1);
+      }
+      if (flags & PARALLEL_BEAM) {
+        cloudNeighborPicked[i] = 1;
+      }
+      i++;
+    }
+  }
+  /*//}*/
+
+  /*//{ curvatureLess() */
+  // the order of the sector sort, ties are broken by the index to make it deterministic
+  bool curvatureLess(const int a, const int b) const {
+    return cloudCurvature[a] < cloudCurvature[b] || (cloudCurvature[a] == cloudCurvature[b] && a < b);
+  }
+  /*//}*/
+
+  /*//{ neighborSpan() */
+  // [lo, hi] are the points marked as picked together with ind, up to 5 on each side unless the range image has a gap
+  void neighborSpan(const CloudFrame &cloud_info, const int ind, int &lo, int &hi) const {
+    hi = ind;
+    for (int l = 1; l <= 5; l++) {
+      const int columnDiff = std::abs(int(cloud_info.pointColInd[ind + l] - cloud_info.pointColInd[ind + l - 1]));
+      if (columnDiff > 10) {
+        break;
+      }
+      hi = ind + l;
+    }
+    lo = ind;
+    for (int l = -1; l >= -5; l--) {
+      const int columnDiff = std::abs(int(cloud_info.pointColInd[ind + l] - cloud_info.pointColInd[ind + l + 1]));
+      if (columnDiff > 10) {
+        break;
+      }
+      lo = ind + l;
+    }
+  }
+  /*//}*/
+
+  /*//{ markNeighbors() */
+  void markNeighbors(const CloudFrame &cloud_info, const int ind) {
+    int lo, hi;
+    neighborSpan(cloud_info, ind, lo, hi);
+    std::fill(cloudNeighborPicked.begin() + lo, cloudNeighborPicked.begin() + hi + 1, 1);
+  }
+  /*//}*/
+
+  /*//{ pickCorner() */
+  // returns false once the sector has all its corners
+  bool pickCorner(const CloudFrame &cloud_info, const int ind, int &largestPickedNum, pcl::PointCloud<PointType> &cornerCloud) {
+    if (cloudNeighborPicked[ind] != 0 || !(cloudCurvature[ind] > edgeThreshold)) {
+      return true;
+    }
+
+    largestPickedNum++;
+    if (largestPickedNum > 20) {
+      return false;
+    }
+
+    cloudLabel[ind] = 1;
+    cornerCloud.push_back(cloud_info.cloudDeskewed->points[ind]);
+    markNeighbors(cloud_info, ind);
+    return true;
+  }
+  /*//}*/
+
+  /*//{ sortSectorFeatures() */
+  // original LOAM selection, the sector [sp, ep) is sorted by curvature (ep itself is left out of the sort, it is the first corner candidate and
+  // the last surface candidate)
+  void sortSectorFeatures(const CloudFrame &cloud_info, const int sp, const int ep, pcl::PointCloud<PointType> &cornerCloud) {
+    std::sort(cloudSortInd.begin() + sp, cloudSortInd.begin() + ep, [this](const int a, const int b) { return curvatureLess(a, b); });
+
+    int largestPickedNum = 0;
+    for (int k = ep; k >= sp; k--) {
+      if (!pickCorner(cloud_info, cloudSortInd[k], largestPickedNum, cornerCloud)) {
+        break;
+      }
+    }
+
+    for (int k = sp; k <= ep; k++) {
+      const int ind = cloudSortInd[k];
+      if (cloudNeighborPicked[ind] == 0 && cloudCurvature[ind] < surfThreshold) {
+        cloudLabel[ind] = -1;
+        markNeighbors(cloud_info, ind);
+      }
+    }
+  }
+  /*//}*/
+
+  /*//{ selectSectorFeatures() */
+  // The same features as sortSectorFeatures() without sorting the sector.
+  //
+  // Only the corner candidates go to a heap, it is popped until the sector has its 20 corners. A surface point is accepted when none of its
+  // neighbours that precede it in the ascending order was accepted, which is resolved per point from the neighbourhood only.
+  void selectSectorFeatures(const CloudFrame &cloud_info, const int sp, const int ep, RingWorker &worker, pcl::PointCloud<PointType> &cornerCloud) {
+    std::vector<int> &cornerHeap = worker.cornerHeap;
+
+    const auto cornerLess = [this](const int a, const int b) { return curvatureLess(a, b); };
+
+    cornerHeap.clear();
+    for (int k = sp; k < ep; k++) {
+      if (cloudNeighborPicked[k] == 0 && cloudCurvature[k] > edgeThreshold) {
+        cornerHeap.push_back(k);
+      }
+    }
+    std::make_heap(cornerHeap.begin(), cornerHeap.end(), cornerLess);
+
+    int  largestPickedNum = 0;
+    bool sectorFull       = !pickCorner(cloud_info, ep, largestPickedNum, cornerCloud);
+    while (!sectorFull && !cornerHeap.empty()) {
+      std::pop_heap(cornerHeap.begin(), cornerHeap.end(), cornerLess);
+      sectorFull = !pickCorner(cloud_info, cornerHeap.back(), largestPickedNum, cornerCloud);
+      cornerHeap.pop_back();
+    }
+
+    // surfaces
+    for (int k = sp; k <= ep; k++) {
+      surfaceState[k] = (cloudNeighborPicked[k] == 0 && cloudCurvature[k] < surfThreshold) ? SURFACE_UNKNOWN : SURFACE_REJECTED;
+    }
+    for (int k = sp; k <= ep; k++) {
+      resolveSurface(cloud_info, sp, ep, k, worker.surfaceStack);
+    }
+    for (int k = sp; k <= ep; k++) {
+      if (surfaceState[k] == SURFACE_ACCEPTED) {
+        cloudLabel[k] = -1;
+        markNeighbors(cloud_info, k);
+      }
+    }
+  }
+  /*//}*/
+
+  /*//{ resolveSurface() */
+  // depth-first over the neighbours that precede the point in the surface order, the order is strict so there are no cycles
+  void resolveSurface(const CloudFrame &cloud_info, const int sp, const int ep, const int ind, std::vector<int> &surfaceStack) {
+    if (surfaceState[ind] != SURFACE_UNKNOWN) {
+      return;
+    }
+
+    // ep is not part of the sorted range, it comes last
+    const auto precedes = [this, ep](const int a, const int b) { return b == ep || (a != ep && curvatureLess(a, b)); };
+
+    surfaceStack.clear();
+    surfaceStack.push_back(ind);
+    while (!surfaceStack.empty()) {
+      const int p = surfaceStack.back();
+
+      int lo, hi;
+      neighborSpan(cloud_info, p, lo, hi);
+
+      bool blocked = false;
+      int  pending = -1;
+      for (int q = std::max(lo, sp); q <= std::min(hi, ep); q++) {
+        if (q == p || surfaceState[q] == SURFACE_REJECTED || !precedes(q, p)) {
+          continue;
+        }
+        if (surfaceState[q] == SURFACE_ACCEPTED) {
+          blocked = true;
+          break;
+        }
+        if (pending < 0) {
+          pending = q;
+        }
+      }
+
+      if (!blocked && pending >= 0) {
+        surfaceStack.push_back(pending);
+        continue;
+      }
+
+      surfaceState[p] = blocked ? SURFACE_REJECTED : SURFACE_ACCEPTED;
+      surfaceStack.pop_back();
+    }
+  }
+  /*//}*/
+
+  /*//{ extractFeatures() */
+  void extractFeatures(const CloudFrame &cloud_info, pcl::PointCloud<PointType> &cornerCloud, pcl::PointCloud<PointType> &surfaceCloud) {
+    cornerCloud.clear();
+    surfaceCloud.clear();
+
+    const int scanHeight = cloud_info.startRingIndex.size();
+
+    if (workers.size() == 1) {
+      for (int i = 0; i < scanHeight; i++) {
+        extractRing(cloud_info, i, workers[0], cornerCloud, surfaceCloud);
+      }
+    } else {
+      // the rings only share the per-point buffers, and the neighbour marking never leaves the ring (10 points between rings are not used)
+      while (int(ringCorners.size()) < scanHeight) {
+        ringCorners.push_back(boost::make_shared<pcl::PointCloud<PointType>>());
+        ringSurfaces.push_back(boost::make_shared<pcl::PointCloud<PointType>>());
+      }
+
+#pragma omp parallel num_threads(workers.size())
+      {
+#ifdef _OPENMP
+        RingWorker &worker = workers[omp_get_thread_num()];
+#else
+        RingWorker &worker = workers[0];
+#endif
+
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < scanHeight; i++) {
+          ringCorners[i]->clear();
+          ringSurfaces[i]->clear();
+          extractRing(cloud_info, i, worker, *ringCorners[i], *ringSurfaces[i]);
+        }
+      }
+
+      // merged in ring order, the result does not depend on the scheduling
+      for (int i = 0; i < scanHeight; i++) {
+        cornerCloud += *ringCorners[i];
+        surfaceCloud += *ringSurfaces[i];
+      }
+    }
+
+    ROS_INFO_THROTTLE(1.0, "[FeatureExtraction]: rings: %d points: %lu corners: %lu surf: %lu", scanHeight, cloud_info.cloudDeskewed->points.size(),
+                      cornerCloud.size(), surfaceCloud.size());
+  }
+  /*//}*/
+
+  /*//{ extractRing() */
+  // the features of the ring are appended to the output clouds
+  void extractRing(const CloudFrame &cloud_info, const int i, RingWorker &worker, pcl::PointCloud<PointType> &cornerCloud,
+                   pcl::PointCloud<PointType> &surfaceCloud) {
+    worker.surfaceCloudScan->clear();
+
+    for (int j = 0; j < 6; j++) {
+
+      const int sp = (cloud_info.startRingIndex[i] * (6 - j) + cloud_info.endRingIndex[i] * j) / 6;
+      const int ep = (cloud_info.startRingIndex[i] * (5 - j) + cloud_info.endRingIndex[i] * (j + 1)) / 6 - 1;
+
+      if (sp >= ep) {
+        continue;
+      }
+
+      if (sortFeatureSectors) {
+        sortSectorFeatures(cloud_info, sp, ep, cornerCloud);
+      } else {
+        selectSectorFeatures(cloud_info, sp, ep, worker, cornerCloud);
+      }
+
+      for (int k = sp; k <= ep; k++) {
+        if (cloudLabel[k] <= 0) {
+          worker.surfaceCloudScan->push_back(cloud_info.cloudDeskewed->points[k]);
+        }
+      }
+    }
+
+    worker.downSizeFilter.setInputCloud(worker.surfaceCloudScan);
+    worker.downSizeFilter.filter(*worker.surfaceCloudScanDS);
+
+    surfaceCloud += *worker.surfaceCloudScanDS;
+  }
+  /*//}*/
+
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // FEATURE_EXTRACTOR_H
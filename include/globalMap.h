@@ -0,0 +1,258 @@
+#ifndef GLOBAL_MAP_H
+#define GLOBAL_MAP_H
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+namespace liosam
+{
+
+/*//{ class GlobalMapAccumulator */
+// Voxelized global map built from the keyframes one at a time.
+//
+// Every voxel keeps the sum of the points that fell into it, the published point is their centroid (as a VoxelGrid over all keyframes would
+// give). The contribution of each keyframe is remembered, so a keyframe moved by a loop closure is taken out and inserted again at its new pose
+// without touching the rest of the map. With change tracking the voxels that changed since the last takeChanges() are remembered, so that only they
+// need to be sent to a remote copy of the map. Not thread safe.
+template <typename PointT>
+class GlobalMapAccumulator {
+
+public:
+  typedef pcl::PointCloud<PointT> Cloud;
+
+  /*//{ GlobalMapAccumulator() */
+  explicit GlobalMapAccumulator(const float leafSize = 1.0f, const bool trackChanges = false) : leafSize_(leafSize), trackChanges_(trackChanges) {
+  }
+  /*//}*/
+
+  /*//{ insert() */
+  // the cloud (in the map frame) replaces the previous contribution of the keyframe
+  void insert(const int keyFrame, const Cloud &cloud) {
+    erase(keyFrame);
+
+    std::unordered_map<Key, Sum, KeyHash> sums;
+    for (const PointT &point : cloud.points) {
+      if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z)) {
+        continue;
+      }
+      Sum &sum = sums[toKey(point)];
+      sum.x += point.x;
+      sum.y += point.y;
+      sum.z += point.z;
+      sum.intensity += point.intensity;
+      sum.count++;
+    }
+
+    std::vector<std::pair<Key, Sum>> &contribution = contributions_[keyFrame];
+    contribution.assign(sums.begin(), sums.end());
+    for (const auto &voxel : contribution) {
+      voxels_[voxel.first].add(voxel.second, 1);
+      if (trackChanges_) {
+        changed_.insert(voxel.first);
+      }
+    }
+  }
+  /*//}*/
+
+  /*//{ erase() */
+  void erase(const int keyFrame) {
+    const auto it = contributions_.find(keyFrame);
+    if (it == contributions_.end()) {
+      return;
+    }
+
+    for (const auto &voxel : it->second) {
+      const auto sum = voxels_.find(voxel.first);
+      sum->second.add(voxel.second, -1);
+      if (sum->second.count == 0) {
+        voxels_.erase(sum);
+      }
+      if (trackChanges_) {
+        changed_.insert(voxel.first);
+      }
+    }
+    contributions_.erase(it);
+  }
+  /*//}*/
+
+  /*//{ snapshot() */
+  // centroids of the voxels within the radius around the point
+  void snapshot(Cloud &cloud, const float x, const float y, const float z, const float radius) const {
+    const double sqRadius = double(radius) * radius;
+
+    cloud.clear();
+    cloud.points.reserve(voxels_.size());
+    for (const auto &voxel : voxels_) {
+      const PointT point = centroid(voxel.second);
+      if ((point.x - x) * (point.x - x) + (point.y - y) * (point.y - y) + (point.z - z) * (point.z - z) <= sqRadius) {
+        cloud.points.push_back(point);
+      }
+    }
+    cloud.width  = cloud.points.size();
+    cloud.height = 1;
+  }
+  /*//}*/
+
+  /*//{ takeChanges() */
+  // centroids of the voxels changed (or created) since the last call with their keys (x, y, z per voxel), keys of the voxels that became empty
+  void takeChanges(Cloud &changed, std::vector<int> &changedKeys, std::vector<int> &removedKeys) {
+    changed.clear();
+    changedKeys.clear();
+    removedKeys.clear();
+    for (const Key &key : changed_) {
+      const auto it = voxels_.find(key);
+      if (it == voxels_.end()) {
+        removedKeys.insert(removedKeys.end(), key.v, key.v + 3);
+      } else {
+        changed.points.push_back(centroid(it->second));
+        changedKeys.insert(changedKeys.end(), key.v, key.v + 3);
+      }
+    }
+    changed.width  = changed.points.size();
+    changed.height = 1;
+    changed_.clear();
+  }
+  /*//}*/
+
+  /*//{ takeAll() */
+  // the whole map with the keys, the changes are taken as well
+  void takeAll(Cloud &cloud, std::vector<int> &keys) {
+    cloud.clear();
+    keys.clear();
+    cloud.points.reserve(voxels_.size());
+    keys.reserve(3 * voxels_.size());
+    for (const auto &voxel : voxels_) {
+      cloud.points.push_back(centroid(voxel.second));
+      keys.insert(keys.end(), voxel.first.v, voxel.first.v + 3);
+    }
+    cloud.width  = cloud.points.size();
+    cloud.height = 1;
+    changed_.clear();
+  }
+  /*//}*/
+
+  void clear() {
+    voxels_.clear();
+    contributions_.clear();
+    changed_.clear();
+  }
+
+  float leafSize() const {
+    return leafSize_;
+  }
+
+  int numKeyFrames() const {
+    return contributions_.size();
+  }
+
+  int numVoxels() const {
+    return voxels_.size();
+  }
+
+private:
+  struct Key
+  {
+    int v[3];
+
+    bool operator==(const Key &other) const {
+      return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2];
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key &key) const {
+      return size_t((int64_t(key.v[0]) * 73856093) ^ (int64_t(key.v[1]) * 19349663) ^ (int64_t(key.v[2]) * 83492791));
+    }
+  };
+
+  // double, the sums of a voxel are added and subtracted many times over a long mission
+  struct Sum
+  {
+    double  x = 0, y = 0, z = 0, intensity = 0;
+    int64_t count = 0;
+
+    void add(const Sum &other, const int sign) {
+      x += sign * other.x;
+      y += sign * other.y;
+      z += sign * other.z;
+      intensity += sign * other.intensity;
+      count += sign * other.count;
+    }
+  };
+
+  float leafSize_;
+  bool  trackChanges_;
+
+  std::unordered_map<Key, Sum, KeyHash>                    voxels_;
+  std::unordered_map<int, std::vector<std::pair<Key, Sum>>> contributions_;
+  std::unordered_set<Key, KeyHash>                         changed_;
+
+  /*//{ toKey() */
+  Key toKey(const PointT &point) const {
+    return Key{{int(std::floor(point.x / leafSize_)), int(std::floor(point.y / leafSize_)), int(std::floor(point.z / leafSize_))}};
+  }
+  /*//}*/
+
+  /*//{ centroid() */
+  static PointT centroid(const Sum &sum) {
+    PointT point;
+    point.x         = sum.x / sum.count;
+    point.y         = sum.y / sum.count;
+    point.z         = sum.z / sum.count;
+    point.intensity = sum.intensity / sum.count;
+    return point;
+  }
+  /*//}*/
+};
+/*//}*/
+
+/*//{ class KeyFrameQueue */
+// Keyframes waiting to be processed by another thread, a keyframe queued again before it was taken is kept only once. Not thread safe.
+class KeyFrameQueue {
+
+public:
+  /*//{ push() */
+  void push(const int keyFrame) {
+    if (keyFrame >= int(queued_.size())) {
+      queued_.resize(keyFrame + 1, false);
+    }
+    if (queued_[keyFrame]) {
+      return;
+    }
+    queued_[keyFrame] = true;
+    pending_.push_back(keyFrame);
+  }
+  /*//}*/
+
+  /*//{ take() */
+  // the queued keyframes in the order they were first queued
+  std::vector<int> take() {
+    for (const int keyFrame : pending_) {
+      queued_[keyFrame] = false;
+    }
+    std::vector<int> taken;
+    taken.swap(pending_);
+    return taken;
+  }
+  /*//}*/
+
+  bool empty() const {
+    return pending_.empty();
+  }
+
+private:
+  std::vector<int>  pending_;
+  std::vector<bool> queued_;
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // GLOBAL_MAP_H
@@ -0,0 +1,551 @@
+#ifndef IKD_TREE_H
+#define IKD_TREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "localMapIndex.h"
+
+namespace liosam
+{
+
+/*//{ class IkdTree */
+// Incremental kd-tree in the spirit of ikd-tree (Cai et al., 2021), used as the local map of the scan-to-map matching.
+//
+// Points are inserted one by one (optionally keeping a single point per voxel) and removed by boxes. Removal is lazy, a deleted point stays in
+// the tree and whole subtrees are deleted through a tag that is pushed down on the next modification. Every node keeps the bounding box of the
+// valid points below it, which is used for pruning the searches. A subtree is rebuilt (balanced, without the deleted points) when it becomes
+// unbalanced or when too many of its points are deleted; the highest such subtree on each modified path is rebuilt after each operation.
+//
+// The searches are const and may run concurrently, the modifications must not overlap with anything else.
+template <typename PointT>
+class IkdTree : public LocalMapIndex<PointT> {
+
+public:
+  typedef typename LocalMapIndex<PointT>::Cloud Cloud;
+
+  /*//{ IkdTree() */
+  // balanceRatio: max share of a subtree in one child, deleteRatio: max share of deleted points, smaller subtrees are never rebuilt
+  explicit IkdTree(const float balanceRatio = 0.7f, const float deleteRatio = 0.5f, const int minRebuildSize = 16)
+      : balanceRatio_(balanceRatio), deleteRatio_(deleteRatio), minRebuildSize_(minRebuildSize) {
+  }
+  /*//}*/
+
+  IkdTree(const IkdTree &) = delete;
+  IkdTree &operator=(const IkdTree &) = delete;
+
+  /*//{ ~IkdTree() */
+  ~IkdTree() {
+    clear();
+    for (Node *node : freeNodes_) {
+      delete node;
+    }
+  }
+  /*//}*/
+
+  /*//{ build() */
+  // replaces the content of the tree by a balanced tree of the cloud
+  void build(const Cloud &cloud) override {
+    clear();
+    std::vector<PointT> points(cloud.points.begin(), cloud.points.end());
+    root_ = buildSubtree(points, 0, points.size());
+  }
+  /*//}*/
+
+  /*//{ clear() */
+  void clear() override {
+    releaseSubtree(root_);
+    root_ = nullptr;
+  }
+  /*//}*/
+
+  /*//{ size() */
+  // number of valid (not deleted) points
+  int size() const override {
+    return root_ ? root_->treeSize - root_->invalidNum : 0;
+  }
+  /*//}*/
+
+  /*//{ addPoints() */
+  // With leafSize > 0, a voxel of that size keeps only the point closest to its center (new or old), returns the number of inserted points.
+  int addPoints(const Cloud &cloud, const float leafSize) override {
+    int                 added = 0;
+    std::vector<PointT> inVoxel;
+
+    for (const PointT &point : cloud.points) {
+      if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z)) {
+        continue;
+      }
+
+      if (leafSize > 0) {
+        MapBox voxel;
+        float  center[3];
+        for (int axis = 0; axis < 3; axis++) {
+          voxel.min[axis] = std::floor(coord(point, axis) / leafSize) * leafSize;
+          voxel.max[axis] = voxel.min[axis] + leafSize;
+          center[axis]    = voxel.min[axis] + 0.5f * leafSize;
+        }
+
+        inVoxel.clear();
+        boxSearch(voxel, inVoxel);
+
+        const float dist   = sqDistance(point, center);
+        bool        closer = false;
+        for (const PointT &other : inVoxel) {
+          if (sqDistance(other, center) <= dist) {
+            closer = true;
+            break;
+          }
+        }
+        if (closer) {
+          continue;
+        }
+        if (!inVoxel.empty()) {
+          deleteBox(voxel);
+        }
+      }
+
+      Node **rebuildSlot = nullptr;
+      insert(root_, point, rebuildSlot);
+      if (rebuildSlot) {
+        rebuild(*rebuildSlot);
+      }
+      added++;
+    }
+
+    return added;
+  }
+  /*//}*/
+
+  /*//{ deleteBox() */
+  // deletes the points inside of the box, returns their number
+  int deleteBox(const MapBox &box) {
+    std::vector<Node **> rebuildSlots;
+    const int            deleted = deleteRange(root_, box, true, rebuildSlots);
+    for (Node **slot : rebuildSlots) {
+      rebuild(*slot);
+    }
+    return deleted;
+  }
+  /*//}*/
+
+  /*//{ keepBox() */
+  // deletes the points outside of the box, returns their number
+  int keepBox(const MapBox &box) override {
+    std::vector<Node **> rebuildSlots;
+    const int            deleted = deleteRange(root_, box, false, rebuildSlots);
+    for (Node **slot : rebuildSlots) {
+      rebuild(*slot);
+    }
+    return deleted;
+  }
+  /*//}*/
+
+  /*//{ nearestKSearch() */
+  // k nearest valid points sorted by distance (as pcl::KdTreeFLANN), returns their number which is smaller than k for small trees
+  int nearestKSearch(const PointT &point, const int k, std::vector<PointT> &points, std::vector<float> &sqDistances) const override {
+    std::vector<std::pair<float, const Node *>> heap;  // max-heap of the best candidates
+    heap.reserve(k + 1);
+    if (k > 0) {
+      searchNearest(root_, point, k, heap);
+    }
+
+    std::sort_heap(heap.begin(), heap.end());
+    points.resize(heap.size());
+    sqDistances.resize(heap.size());
+    for (size_t i = 0; i < heap.size(); i++) {
+      sqDistances[i] = heap[i].first;
+      points[i]      = heap[i].second->point;
+    }
+    return heap.size();
+  }
+  /*//}*/
+
+  /*//{ boxSearch() */
+  // appends the valid points inside of the box
+  void boxSearch(const MapBox &box, std::vector<PointT> &points) const {
+    searchBox(root_, box, points);
+  }
+  /*//}*/
+
+  /*//{ flatten() */
+  // all valid points
+  void flatten(Cloud &cloud) const override {
+    cloud.clear();
+    collect(root_, cloud.points);
+    cloud.width  = cloud.points.size();
+    cloud.height = 1;
+  }
+  /*//}*/
+
+private:
+  /*//{ struct Node */
+  struct Node
+  {
+    PointT point;
+    Node  *left;
+    Node  *right;
+    int    axis;
+    int    treeSize;     // nodes of the subtree, deleted ones included
+    int    invalidNum;   // deleted nodes of the subtree
+    bool   deleted;      // the point of this node
+    bool   treeDeleted;  // lazy tag, the whole subtree is deleted but the children do not know yet
+    float  rangeMin[3];  // bounding box of the valid points of the subtree, empty (min > max) if there are none
+    float  rangeMax[3];
+  };
+  /*//}*/
+
+  Node *root_ = nullptr;
+
+  std::vector<Node *> freeNodes_;
+
+  float balanceRatio_;
+  float deleteRatio_;
+  int   minRebuildSize_;
+
+  /*//{ coord() */
+  static float coord(const PointT &point, const int axis) {
+    return axis == 0 ? point.x : (axis == 1 ? point.y : point.z);
+  }
+  /*//}*/
+
+  /*//{ sqDistance() */
+  static float sqDistance(const PointT &a, const PointT &b) {
+    const float dx = a.x - b.x;
+    const float dy = a.y - b.y;
+    const float dz = a.z - b.z;
+    return dx * dx + dy * dy + dz * dz;
+  }
+
+  static float sqDistance(const PointT &a, const float *b) {
+    const float dx = a.x - b[0];
+    const float dy = a.y - b[1];
+    const float dz = a.z - b[2];
+    return dx * dx + dy * dy + dz * dz;
+  }
+  /*//}*/
+
+  /*//{ boxSqDistance() */
+  // squared distance of the point to the bounding box of the subtree, infinite for an empty box
+  static float boxSqDistance(const Node *node, const PointT &point) {
+    float dist = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      const float value = coord(point, axis);
+      if (node->rangeMin[axis] > node->rangeMax[axis]) {
+        return std::numeric_limits<float>::infinity();
+      }
+      const float d = std::max(std::max(node->rangeMin[axis] - value, value - node->rangeMax[axis]), 0.0f);
+      dist += d * d;
+    }
+    return dist;
+  }
+  /*//}*/
+
+  /*//{ inBox() */
+  static bool inBox(const PointT &point, const MapBox &box) {
+    return box.contains(point.x, point.y, point.z);
+  }
+  /*//}*/
+
+  /*//{ rangeOutside() */
+  static bool rangeOutside(const Node *node, const MapBox &box) {
+    for (int axis = 0; axis < 3; axis++) {
+      if (node->rangeMax[axis] < box.min[axis] || node->rangeMin[axis] >= box.max[axis]) {
+        return true;
+      }
+    }
+    return false;
+  }
+  /*//}*/
+
+  /*//{ rangeInside() */
+  static bool rangeInside(const Node *node, const MapBox &box) {
+    for (int axis = 0; axis < 3; axis++) {
+      if (node->rangeMin[axis] < box.min[axis] || node->rangeMax[axis] >= box.max[axis]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  /*//}*/
+
+  /*//{ newNode() */
+  Node *newNode(const PointT &point) {
+    Node *node;
+    if (freeNodes_.empty()) {
+      node = new Node;
+    } else {
+      node = freeNodes_.back();
+      freeNodes_.pop_back();
+    }
+
+    node->point       = point;
+    node->left        = nullptr;
+    node->right       = nullptr;
+    node->axis        = 0;
+    node->treeSize    = 1;
+    node->invalidNum  = 0;
+    node->deleted     = false;
+    node->treeDeleted = false;
+    for (int axis = 0; axis < 3; axis++) {
+      node->rangeMin[axis] = coord(point, axis);
+      node->rangeMax[axis] = coord(point, axis);
+    }
+    return node;
+  }
+  /*//}*/
+
+  /*//{ releaseSubtree() */
+  // the nodes are kept for reuse
+  void releaseSubtree(Node *node) {
+    if (!node) {
+      return;
+    }
+    releaseSubtree(node->left);
+    releaseSubtree(node->right);
+    freeNodes_.push_back(node);
+  }
+  /*//}*/
+
+  /*//{ markDeleted() */
+  static void markDeleted(Node *node) {
+    if (!node) {
+      return;
+    }
+    node->deleted     = true;
+    node->treeDeleted = true;
+    node->invalidNum  = node->treeSize;
+    for (int axis = 0; axis < 3; axis++) {
+      node->rangeMin[axis] = std::numeric_limits<float>::infinity();
+      node->rangeMax[axis] = -std::numeric_limits<float>::infinity();
+    }
+  }
+  /*//}*/
+
+  /*//{ pushDown() */
+  static void pushDown(Node *node) {
+    if (node->treeDeleted) {
+      markDeleted(node->left);
+      markDeleted(node->right);
+      node->treeDeleted = false;
+    }
+  }
+  /*//}*/
+
+  /*//{ pullUp() */
+  static void pullUp(Node *node) {
+    node->treeSize   = 1;
+    node->invalidNum = node->deleted ? 1 : 0;
+    for (int axis = 0; axis < 3; axis++) {
+      node->rangeMin[axis] = node->deleted ? std::numeric_limits<float>::infinity() : coord(node->point, axis);
+      node->rangeMax[axis] = node->deleted ? -std::numeric_limits<float>::infinity() : coord(node->point, axis);
+    }
+
+    for (const Node *child : {node->left, node->right}) {
+      if (!child) {
+        continue;
+      }
+      node->treeSize += child->treeSize;
+      node->invalidNum += child->invalidNum;
+      for (int axis = 0; axis < 3; axis++) {
+        node->rangeMin[axis] = std::min(node->rangeMin[axis], child->rangeMin[axis]);
+        node->rangeMax[axis] = std::max(node->rangeMax[axis], child->rangeMax[axis]);
+      }
+    }
+  }
+  /*//}*/
+
+  /*//{ needsRebuild() */
+  bool needsRebuild(const Node *node) const {
+    if (node->treeSize < minRebuildSize_) {
+      return false;
+    }
+    if (node->invalidNum > deleteRatio_ * node->treeSize) {
+      return true;
+    }
+    const int leftSize  = node->left ? node->left->treeSize : 0;
+    const int rightSize = node->right ? node->right->treeSize : 0;
+    return std::max(leftSize, rightSize) > balanceRatio_ * (node->treeSize - 1);
+  }
+  /*//}*/
+
+  /*//{ buildSubtree() */
+  // balanced subtree of points[begin, end), split by the median along the axis of the largest extent
+  Node *buildSubtree(std::vector<PointT> &points, const size_t begin, const size_t end) {
+    if (begin >= end) {
+      return nullptr;
+    }
+
+    float minCoord[3], maxCoord[3];
+    for (int axis = 0; axis < 3; axis++) {
+      minCoord[axis] = std::numeric_limits<float>::infinity();
+      maxCoord[axis] = -std::numeric_limits<float>::infinity();
+    }
+    for (size_t i = begin; i < end; i++) {
+      for (int axis = 0; axis < 3; axis++) {
+        minCoord[axis] = std::min(minCoord[axis], coord(points[i], axis));
+        maxCoord[axis] = std::max(maxCoord[axis], coord(points[i], axis));
+      }
+    }
+
+    int splitAxis = 0;
+    for (int axis = 1; axis < 3; axis++) {
+      if (maxCoord[axis] - minCoord[axis] > maxCoord[splitAxis] - minCoord[splitAxis]) {
+        splitAxis = axis;
+      }
+    }
+
+    const size_t mid = begin + (end - begin) / 2;
+    std::nth_element(points.begin() + begin, points.begin() + mid, points.begin() + end,
+                     [splitAxis](const PointT &a, const PointT &b) { return coord(a, splitAxis) < coord(b, splitAxis); });
+
+    Node *node  = newNode(points[mid]);
+    node->axis  = splitAxis;
+    node->left  = buildSubtree(points, begin, mid);
+    node->right = buildSubtree(points, mid + 1, end);
+    pullUp(node);
+    return node;
+  }
+  /*//}*/
+
+  /*//{ rebuild() */
+  void rebuild(Node *&node) {
+    std::vector<PointT> points;
+    points.reserve(node->treeSize - node->invalidNum);
+    collect(node, points);
+    releaseSubtree(node);
+    node = buildSubtree(points, 0, points.size());
+  }
+  /*//}*/
+
+  /*//{ insert() */
+  // rebuildSlot ends up pointing to the highest subtree on the path that should be rebuilt
+  void insert(Node *&node, const PointT &point, Node **&rebuildSlot) {
+    if (!node) {
+      node = newNode(point);
+      return;
+    }
+
+    pushDown(node);
+    if (coord(point, node->axis) < coord(node->point, node->axis)) {
+      insert(node->left, point, rebuildSlot);
+    } else {
+      insert(node->right, point, rebuildSlot);
+    }
+    pullUp(node);
+
+    if (needsRebuild(node)) {
+      rebuildSlot = &node;
+    }
+  }
+  /*//}*/
+
+  /*//{ deleteRange() */
+  // deletes the points inside (or outside) of the box; unlike an insertion it can modify both subtrees of a node, so rebuildSlots collects the
+  // highest subtree to rebuild on every modified path (disjoint subtrees, a rebuilt node replaces the ones found below it)
+  int deleteRange(Node *&node, const MapBox &box, const bool inside, std::vector<Node **> &rebuildSlots) {
+    if (!node || node->invalidNum == node->treeSize) {
+      return 0;
+    }
+
+    // the whole subtree is kept or deleted
+    const bool outside = rangeOutside(node, box);
+    const bool within  = rangeInside(node, box);
+    if ((inside && outside) || (!inside && within)) {
+      return 0;
+    }
+    if ((inside && within) || (!inside && outside)) {
+      const int deleted = node->treeSize - node->invalidNum;
+      markDeleted(node);
+      return deleted;
+    }
+
+    pushDown(node);
+
+    int deleted = 0;
+    if (!node->deleted && inBox(node->point, box) == inside) {
+      node->deleted = true;
+      deleted++;
+    }
+    const size_t below = rebuildSlots.size();
+    deleted += deleteRange(node->left, box, inside, rebuildSlots);
+    deleted += deleteRange(node->right, box, inside, rebuildSlots);
+    pullUp(node);
+
+    if (needsRebuild(node)) {
+      rebuildSlots.resize(below);
+      rebuildSlots.push_back(&node);
+    }
+    return deleted;
+  }
+  /*//}*/
+
+  /*//{ searchNearest() */
+  void searchNearest(const Node *node, const PointT &point, const int k, std::vector<std::pair<float, const Node *>> &heap) const {
+    if (!node || node->treeDeleted) {
+      return;
+    }
+    if (int(heap.size()) == k && boxSqDistance(node, point) >= heap.front().first) {
+      return;
+    }
+
+    if (!node->deleted) {
+      const float dist = sqDistance(node->point, point);
+      if (int(heap.size()) < k) {
+        heap.emplace_back(dist, node);
+        std::push_heap(heap.begin(), heap.end());
+      } else if (dist < heap.front().first) {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = std::make_pair(dist, node);
+        std::push_heap(heap.begin(), heap.end());
+      }
+    }
+
+    // the closer child first
+    const float distLeft  = node->left ? boxSqDistance(node->left, point) : std::numeric_limits<float>::infinity();
+    const float distRight = node->right ? boxSqDistance(node->right, point) : std::numeric_limits<float>::infinity();
+    if (distLeft <= distRight) {
+      searchNearest(node->left, point, k, heap);
+      searchNearest(node->right, point, k, heap);
+    } else {
+      searchNearest(node->right, point, k, heap);
+      searchNearest(node->left, point, k, heap);
+    }
+  }
+  /*//}*/
+
+  /*//{ searchBox() */
+  void searchBox(const Node *node, const MapBox &box, std::vector<PointT> &points) const {
+    if (!node || node->treeDeleted || rangeOutside(node, box)) {
+      return;
+    }
+    if (!node->deleted && inBox(node->point, box)) {
+      points.push_back(node->point);
+    }
+    searchBox(node->left, box, points);
+    searchBox(node->right, box, points);
+  }
+  /*//}*/
+
+  /*//{ collect() */
+  template <typename Container>
+  static void collect(const Node *node, Container &points) {
+    if (!node || node->treeDeleted || node->invalidNum == node->treeSize) {
+      return;
+    }
+    if (!node->deleted) {
+      points.push_back(node->point);
+    }
+    collect(node->left, points);
+    collect(node->right, points);
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // IKD_TREE_H
@@ -0,0 +1,133 @@
+#ifndef IMU_RING_BUFFER_H
+#define IMU_RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace liosam
+{
+
+/*//{ struct ImuSample */
+// IMU measurement already rotated to the lidar frame, see imuSampleConverter()
+struct ImuSample
+{
+  double t;
+  double acc[3];
+  double gyr[3];
+  double q[4];  // x, y, z, w
+};
+/*//}*/
+
+/*//{ class ImuRingBuffer */
+// Fixed-capacity single-producer ring of IMU samples ordered by time.
+//
+// The IMU callback is the only writer. Readers keep their own cursors (absolute sample indices) instead of popping from a queue, so several
+// consumers can read the same data without copying it. Samples are never locked: a reader copies the slot and then checks that the writer has
+// not lapped it in the meantime (seqlock style). A reader that falls behind by more than the capacity loses the overwritten samples, clampCursor()
+// moves it to the oldest sample that is still available.
+class ImuRingBuffer
+{
+public:
+  /*//{ ImuRingBuffer() */
+  explicit ImuRingBuffer(const size_t capacity = 8192) {
+    // power of two, so that the slot is obtained by masking
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    buffer_.resize(size);
+    mask_ = size - 1;
+  }
+  /*//}*/
+
+  /*//{ push() */
+  // producer only, returns false if the sample is not newer than the last one
+  bool push(const ImuSample &sample) {
+    if (sample.t <= lastPushedTime_) {
+      return false;
+    }
+    const uint64_t index   = writeIndex_.load(std::memory_order_relaxed);
+    buffer_[index & mask_] = sample;
+    lastPushedTime_        = sample.t;
+    writeIndex_.store(index + 1, std::memory_order_release);
+    return true;
+  }
+  /*//}*/
+
+  /*//{ begin() */
+  // index of the oldest sample that can be read safely, a quarter of the capacity is kept as a margin from the writer
+  uint64_t begin() const {
+    const uint64_t end    = this->end();
+    const uint64_t usable = buffer_.size() - buffer_.size() / 4;
+    return end > usable ? end - usable : 0;
+  }
+  /*//}*/
+
+  /*//{ end() */
+  // one past the newest sample
+  uint64_t end() const {
+    return writeIndex_.load(std::memory_order_acquire);
+  }
+  /*//}*/
+
+  /*//{ read() */
+  // returns false if the sample does not exist (yet or anymore)
+  bool read(const uint64_t index, ImuSample &sample) const {
+    if (index >= end()) {
+      return false;
+    }
+    sample = buffer_[index & mask_];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // the slot was overwritten while copying it
+    return writeIndex_.load(std::memory_order_relaxed) - index <= mask_;
+  }
+  /*//}*/
+
+  /*//{ clampCursor() */
+  // moves a cursor that fell behind to the oldest available sample, returns false if samples were lost
+  bool clampCursor(uint64_t &cursor) const {
+    const uint64_t oldest = begin();
+    if (cursor < oldest) {
+      cursor = oldest;
+      return false;
+    }
+    return true;
+  }
+  /*//}*/
+
+  /*//{ lowerBound() */
+  // index of the first sample in [from, to) with time >= t (or to if there is none), binary search
+  uint64_t lowerBound(const double t, uint64_t from, uint64_t to) const {
+    ImuSample sample;
+    while (from < to) {
+      const uint64_t mid = from + (to - from) / 2;
+      // a lapped sample is older than anything that is still in the buffer
+      if (!read(mid, sample) || sample.t < t) {
+        from = mid + 1;
+      } else {
+        to = mid;
+      }
+    }
+    return from;
+  }
+  /*//}*/
+
+  /*//{ capacity() */
+  size_t capacity() const {
+    return buffer_.size();
+  }
+  /*//}*/
+
+private:
+  std::vector<ImuSample> buffer_;
+  uint64_t               mask_;
+  std::atomic<uint64_t>  writeIndex_{0};
+  double                 lastPushedTime_ = -1.0;
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // IMU_RING_BUFFER_H
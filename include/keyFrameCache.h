@@ -0,0 +1,137 @@
+#ifndef KEY_FRAME_CACHE_H
+#define KEY_FRAME_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+#include <pcl/point_cloud.h>
+
+namespace liosam
+{
+
+/*//{ class KeyFrameCache */
+// LRU cache of keyframe feature clouds transformed to the map frame.
+//
+// The clouds are shared and never modified after insertion, a lookup hands out the pointers without copying. Every entry remembers the pose version
+// of its keyframe it was transformed with, a lookup with a different version is a miss and the entry gets replaced, so after a loop closure only
+// the keyframes whose poses have actually moved are transformed again. The least recently used entries are dropped once the clouds exceed the
+// byte budget. Not thread safe.
+template <typename PointT>
+class KeyFrameCache {
+
+public:
+  typedef typename pcl::PointCloud<PointT>::ConstPtr CloudConstPtr;
+
+  struct Stats
+  {
+    uint64_t hits          = 0;
+    uint64_t misses        = 0;
+    uint64_t invalidations = 0;  // misses caused by an outdated pose version
+    uint64_t evictions     = 0;
+  };
+
+  /*//{ KeyFrameCache() */
+  explicit KeyFrameCache(const size_t byteBudget = 512 * 1024 * 1024) : byteBudget_(byteBudget) {
+  }
+  /*//}*/
+
+  /*//{ get() */
+  // returns false if the keyframe is not cached with this pose version
+  bool get(const int keyFrame, const uint32_t poseVersion, CloudConstPtr &corner, CloudConstPtr &surf) {
+    const auto it = entries_.find(keyFrame);
+    if (it == entries_.end()) {
+      stats_.misses++;
+      return false;
+    }
+
+    if (it->second.poseVersion != poseVersion) {
+      stats_.misses++;
+      stats_.invalidations++;
+      erase(it);
+      return false;
+    }
+
+    lru_.splice(lru_.begin(), lru_, it->second.lruPosition);
+    corner = it->second.corner;
+    surf   = it->second.surf;
+    stats_.hits++;
+    return true;
+  }
+  /*//}*/
+
+  /*//{ put() */
+  void put(const int keyFrame, const uint32_t poseVersion, const CloudConstPtr &corner, const CloudConstPtr &surf) {
+    const auto old = entries_.find(keyFrame);
+    if (old != entries_.end()) {
+      erase(old);
+    }
+
+    lru_.push_front(keyFrame);
+    Entry &entry      = entries_[keyFrame];
+    entry.corner      = corner;
+    entry.surf        = surf;
+    entry.poseVersion = poseVersion;
+    entry.bytes       = (corner->size() + surf->size()) * sizeof(PointT);
+    entry.lruPosition = lru_.begin();
+    bytes_ += entry.bytes;
+
+    // the newest entry stays even if it alone is over the budget
+    while (bytes_ > byteBudget_ && entries_.size() > 1) {
+      erase(entries_.find(lru_.back()));
+      stats_.evictions++;
+    }
+  }
+  /*//}*/
+
+  /*//{ clear() */
+  void clear() {
+    entries_.clear();
+    lru_.clear();
+    bytes_ = 0;
+  }
+  /*//}*/
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  size_t bytes() const {
+    return bytes_;
+  }
+
+  const Stats &stats() const {
+    return stats_;
+  }
+
+private:
+  struct Entry
+  {
+    CloudConstPtr                     corner;
+    CloudConstPtr                     surf;
+    uint32_t                          poseVersion;
+    size_t                            bytes;
+    typename std::list<int>::iterator lruPosition;
+  };
+
+  /*//{ erase() */
+  void erase(const typename std::unordered_map<int, Entry>::iterator it) {
+    bytes_ -= it->second.bytes;
+    lru_.erase(it->second.lruPosition);
+    entries_.erase(it);
+  }
+  /*//}*/
+
+  size_t byteBudget_;
+  size_t bytes_ = 0;
+  Stats  stats_;
+
+  std::unordered_map<int, Entry> entries_;
+  std::list<int>                 lru_;  // most recently used first
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // KEY_FRAME_CACHE_H
@@ -0,0 +1,221 @@
+#ifndef KEY_POSE_GRID_H
+#define KEY_POSE_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace liosam
+{
+
+/*//{ class KeyPoseGrid */
+// Spatial hash of the keyframe positions, indexed by the keyframe index.
+//
+// Keyframes are appended as they are created and their positions updated in place after a loop closure, the grid is never rebuilt. A radius search
+// visits only the cells overlapping the sphere (or the occupied cells if there are fewer of them), so its cost depends on the size of the
+// neighbourhood and not on the length of the trajectory. Not thread safe.
+class KeyPoseGrid {
+
+public:
+  /*//{ KeyPoseGrid() */
+  explicit KeyPoseGrid(const float cellSize = 10.0f) : cellSize_(cellSize) {
+  }
+  /*//}*/
+
+  /*//{ clear() */
+  void clear() {
+    cells_.clear();
+    positions_.clear();
+    cellOf_.clear();
+  }
+  /*//}*/
+
+  int size() const {
+    return positions_.size();
+  }
+
+  /*//{ add() */
+  // appends the keyframe with index size()
+  void add(const float x, const float y, const float z) {
+    const Key key = toKey(x, y, z);
+    positions_.push_back(Position{x, y, z});
+    cellOf_.push_back(key);
+    cells_[key].push_back(positions_.size() - 1);
+  }
+  /*//}*/
+
+  /*//{ update() */
+  void update(const int index, const float x, const float y, const float z) {
+    positions_[index] = Position{x, y, z};
+
+    const Key key = toKey(x, y, z);
+    if (key == cellOf_[index]) {
+      return;
+    }
+
+    const auto        old     = cells_.find(cellOf_[index]);
+    std::vector<int> &members = old->second;
+    members.erase(std::find(members.begin(), members.end(), index));
+    if (members.empty()) {
+      cells_.erase(old);
+    }
+
+    cellOf_[index] = key;
+    cells_[key].push_back(index);
+  }
+  /*//}*/
+
+  /*//{ radiusSearch() */
+  // keyframes within the radius sorted by distance, returns their number
+  int radiusSearch(const float x, const float y, const float z, const float radius, std::vector<int> &indices, std::vector<float> &sqDistances) const {
+    std::vector<std::pair<float, int>> found;
+
+    const float sqRadius = radius * radius;
+    const auto  collect  = [&](const std::vector<int> &members) {
+      for (const int index : members) {
+        const float sqDistance = sqDistanceTo(index, x, y, z);
+        if (sqDistance <= sqRadius) {
+          found.emplace_back(sqDistance, index);
+        }
+      }
+    };
+
+    const Key    lo       = toKey(x - radius, y - radius, z - radius);
+    const Key    hi       = toKey(x + radius, y + radius, z + radius);
+    const double numCells = double(hi.v[0] - lo.v[0] + 1) * double(hi.v[1] - lo.v[1] + 1) * double(hi.v[2] - lo.v[2] + 1);
+
+    if (numCells > double(cells_.size())) {
+      for (const auto &cell : cells_) {
+        if (cell.first.v[0] >= lo.v[0] && cell.first.v[0] <= hi.v[0] && cell.first.v[1] >= lo.v[1] && cell.first.v[1] <= hi.v[1] &&
+            cell.first.v[2] >= lo.v[2] && cell.first.v[2] <= hi.v[2]) {
+          collect(cell.second);
+        }
+      }
+    } else {
+      for (int cx = lo.v[0]; cx <= hi.v[0]; cx++) {
+        for (int cy = lo.v[1]; cy <= hi.v[1]; cy++) {
+          for (int cz = lo.v[2]; cz <= hi.v[2]; cz++) {
+            const auto it = cells_.find(Key{{cx, cy, cz}});
+            if (it != cells_.end()) {
+              collect(it->second);
+            }
+          }
+        }
+      }
+    }
+
+    std::sort(found.begin(), found.end());
+    indices.resize(found.size());
+    sqDistances.resize(found.size());
+    for (size_t i = 0; i < found.size(); i++) {
+      sqDistances[i] = found[i].first;
+      indices[i]     = found[i].second;
+    }
+    return found.size();
+  }
+  /*//}*/
+
+  /*//{ nearestSearch() */
+  // the closest keyframe, -1 if the grid is empty
+  int nearestSearch(const float x, const float y, const float z, float &sqDistance) const {
+    int nearest = -1;
+    sqDistance  = std::numeric_limits<float>::max();
+    if (cells_.empty()) {
+      return nearest;
+    }
+
+    const auto visit = [&](const int cx, const int cy, const int cz) {
+      const auto it = cells_.find(Key{{cx, cy, cz}});
+      if (it == cells_.end()) {
+        return;
+      }
+      for (const int index : it->second) {
+        const float dist = sqDistanceTo(index, x, y, z);
+        if (dist < sqDistance || (dist == sqDistance && index < nearest)) {
+          sqDistance = dist;
+          nearest    = index;
+        }
+      }
+    };
+
+    // shells of cells around the cell of the query, the cells of the next shell are at least (shell * cellSize) away
+    const Key center = toKey(x, y, z);
+    for (int shell = 0;; shell++) {
+      for (int dx = -shell; dx <= shell; dx++) {
+        for (int dy = -shell; dy <= shell; dy++) {
+          const bool side = std::abs(dx) == shell || std::abs(dy) == shell;
+          for (int dz = -shell; dz <= shell; dz += side ? 1 : std::max(2 * shell, 1)) {
+            visit(center.v[0] + dx, center.v[1] + dy, center.v[2] + dz);
+          }
+        }
+      }
+
+      const float reach = shell * cellSize_;
+      if (nearest >= 0 && sqDistance <= reach * reach) {
+        return nearest;
+      }
+
+      // nothing closer than the whole shell, it is cheaper to go through the occupied cells
+      if (nearest < 0 && std::pow(2.0 * shell + 3.0, 3) > double(cells_.size())) {
+        for (const auto &cell : cells_) {
+          visit(cell.first.v[0], cell.first.v[1], cell.first.v[2]);
+        }
+        return nearest;
+      }
+    }
+  }
+  /*//}*/
+
+private:
+  struct Key
+  {
+    int v[3];
+
+    bool operator==(const Key &other) const {
+      return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2];
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key &key) const {
+      return size_t((int64_t(key.v[0]) * 73856093) ^ (int64_t(key.v[1]) * 19349663) ^ (int64_t(key.v[2]) * 83492791));
+    }
+  };
+
+  struct Position
+  {
+    float x, y, z;
+  };
+
+  float cellSize_;
+
+  std::unordered_map<Key, std::vector<int>, KeyHash> cells_;
+  std::vector<Position>                               positions_;
+  std::vector<Key>                                    cellOf_;
+
+  /*//{ toKey() */
+  Key toKey(const float x, const float y, const float z) const {
+    return Key{{int(std::floor(x / cellSize_)), int(std::floor(y / cellSize_)), int(std::floor(z / cellSize_))}};
+  }
+  /*//}*/
+
+  /*//{ sqDistanceTo() */
+  float sqDistanceTo(const int index, const float x, const float y, const float z) const {
+    const float dx = positions_[index].x - x;
+    const float dy = positions_[index].y - y;
+    const float dz = positions_[index].z - z;
+    return dx * dx + dy * dy + dz * dz;
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // KEY_POSE_GRID_H
@@ -0,0 +1,72 @@
+#ifndef LINE_FIT_H
+#define LINE_FIT_H
+
+#include <Eigen/Dense>
+
+namespace liosam
+{
+
+/*//{ lineCovariance() */
+// centroid and covariance (a11, a12, a13, a22, a23, a33) of the points, accumulated in float
+template <typename PointT>
+void lineCovariance(const PointT *points, const int count, float centroid[3], float covariance[6]) {
+  float cx = 0, cy = 0, cz = 0;
+  for (int j = 0; j < count; j++) {
+    cx += points[j].x;
+    cy += points[j].y;
+    cz += points[j].z;
+  }
+  cx /= count;
+  cy /= count;
+  cz /= count;
+
+  float a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+  for (int j = 0; j < count; j++) {
+    const float ax = points[j].x - cx;
+    const float ay = points[j].y - cy;
+    const float az = points[j].z - cz;
+
+    a11 += ax * ax;
+    a12 += ax * ay;
+    a13 += ax * az;
+    a22 += ay * ay;
+    a23 += ay * az;
+    a33 += az * az;
+  }
+
+  centroid[0]   = cx;
+  centroid[1]   = cy;
+  centroid[2]   = cz;
+  covariance[0] = a11 / count;
+  covariance[1] = a12 / count;
+  covariance[2] = a13 / count;
+  covariance[3] = a22 / count;
+  covariance[4] = a23 / count;
+  covariance[5] = a33 / count;
+}
+/*//}*/
+
+/*//{ lineDirection() */
+// main direction of the covariance, false if the largest eigenvalue is not more than 3 times the second one (the points do not form a line);
+// closed-form 3x3 decomposition on the stack, in double to keep it accurate for nearly equal eigenvalues
+inline bool lineDirection(const float covariance[6], float direction[3]) {
+  Eigen::Matrix3d matA1;
+  matA1 << covariance[0], covariance[1], covariance[2], covariance[1], covariance[3], covariance[4], covariance[2], covariance[4], covariance[5];
+
+  // eigenvalues in increasing order
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen;
+  eigen.computeDirect(matA1);
+
+  if (!(eigen.eigenvalues()(2) > 3 * eigen.eigenvalues()(1))) {
+    return false;
+  }
+  direction[0] = eigen.eigenvectors()(0, 2);
+  direction[1] = eigen.eigenvectors()(1, 2);
+  direction[2] = eigen.eigenvectors()(2, 2);
+  return true;
+}
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // LINE_FIT_H
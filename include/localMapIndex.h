@@ -0,0 +1,64 @@
+#ifndef LOCAL_MAP_INDEX_H
+#define LOCAL_MAP_INDEX_H
+
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+namespace liosam
+{
+
+/*//{ struct MapBox */
+// axis aligned box, min inclusive, max exclusive
+struct MapBox
+{
+  float min[3];
+  float max[3];
+
+  static MapBox around(const float x, const float y, const float z, const float halfSize) {
+    return MapBox{{x - halfSize, y - halfSize, z - halfSize}, {x + halfSize, y + halfSize, z + halfSize}};
+  }
+
+  bool contains(const float x, const float y, const float z) const {
+    return x >= min[0] && x < max[0] && y >= min[1] && y < max[1] && z >= min[2] && z < max[2];
+  }
+};
+/*//}*/
+
+/*//{ class LocalMapIndex */
+// Incrementally maintained point index of the scan-to-map local map (IkdTree, VoxelMap). The searches are const and may run concurrently, the
+// modifications must not overlap with anything else.
+template <typename PointT>
+class LocalMapIndex {
+
+public:
+  typedef pcl::PointCloud<PointT> Cloud;
+
+  virtual ~LocalMapIndex() {
+  }
+
+  // replaces the content of the index
+  virtual void build(const Cloud &cloud) = 0;
+
+  virtual void clear() = 0;
+
+  // number of points in the index
+  virtual int size() const = 0;
+
+  // inserts the points keeping roughly leafSize spacing of the map points, returns the number of inserted points
+  virtual int addPoints(const Cloud &cloud, const float leafSize) = 0;
+
+  // deletes the points outside of the box, returns their number
+  virtual int keepBox(const MapBox &box) = 0;
+
+  // k nearest points sorted by distance, returns their number (less than k if there are not enough points)
+  virtual int nearestKSearch(const PointT &point, const int k, std::vector<PointT> &points, std::vector<float> &sqDistances) const = 0;
+
+  // all points of the index
+  virtual void flatten(Cloud &cloud) const = 0;
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // LOCAL_MAP_INDEX_H
@@ -0,0 +1,328 @@
+#ifndef MAP_EXPORTER_H
+#define MAP_EXPORTER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <ros/console.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/common/transforms.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/io/pcd_io.h>
+
+namespace liosam
+{
+
+/*//{ class MapExporter */
+// Exports the map while it is being built, all file access happens in a background thread.
+//
+// Every keyframe is appended once, when it is created, as a chunk of keyframes.bin (the raw feature clouds in the sensor frame), its poses are
+// appended to poses.bin when it is created and whenever a loop closure moves it (the last record of a keyframe wins). Both files are valid after
+// every chunk, a truncated last chunk is ignored. The merged map (cloudCorner.pcd, cloudSurf.pcd, cloudGlobal.pcd, trajectory.pcd and
+// transformations.pcd, binary compressed) is produced from the two files on request and when the exporter is destroyed.
+//
+// PoseT has the fields x, y, z, intensity, roll, pitch, yaw and time and is registered with pcl.
+template <typename PointT, typename PoseT>
+class MapExporter {
+
+public:
+  typedef typename pcl::PointCloud<PointT>::ConstPtr CloudConstPtr;
+
+  /*//{ MapExporter() */
+  // the files of a previous export in the directory are overwritten
+  MapExporter(const std::string &directory, const float cornerLeafSize, const float surfLeafSize)
+      : directory_(directory), cornerLeafSize_(cornerLeafSize), surfLeafSize_(surfLeafSize) {
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    keyFramesFile_.open(path("keyframes.bin"), std::ios::binary | std::ios::trunc);
+    posesFile_.open(path("poses.bin"), std::ios::binary | std::ios::trunc);
+    if (!keyFramesFile_ || !posesFile_) {
+      ROS_ERROR("[MapExporter]: could not open the export files in %s, the map will not be exported", directory_.c_str());
+      return;
+    }
+    thread_ = std::thread(&MapExporter::run, this);
+  }
+  /*//}*/
+
+  /*//{ ~MapExporter() */
+  // writes what is queued and merges the map a last time
+  ~MapExporter() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_           = true;
+      mergeRequested_ = true;
+    }
+    cv_.notify_one();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+  /*//}*/
+
+  /*//{ addKeyFrame() */
+  void addKeyFrame(const int index, const PoseT &pose, const CloudConstPtr &corner, const CloudConstPtr &surf) {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      keyFrames_.push_back(KeyFrame{index, corner, surf});
+      poses_.emplace_back(index, pose);
+    }
+    cv_.notify_one();
+  }
+  /*//}*/
+
+  /*//{ updatePoses() */
+  void updatePoses(const std::vector<std::pair<int, PoseT>> &poses) {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      poses_.insert(poses_.end(), poses.begin(), poses.end());
+    }
+    cv_.notify_one();
+  }
+  /*//}*/
+
+  /*//{ requestMerge() */
+  // requests made while a merge is pending are merged together, returns false if one was already pending
+  bool requestMerge() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (mergeRequested_) {
+        return false;
+      }
+      mergeRequested_ = true;
+    }
+    cv_.notify_one();
+    return true;
+  }
+  /*//}*/
+
+  const std::string &directory() const {
+    return directory_;
+  }
+
+private:
+  struct KeyFrame
+  {
+    int           index;
+    CloudConstPtr corner;
+    CloudConstPtr surf;
+  };
+
+  // chunk of keyframes.bin: magic, index, number of corner and surf points, their x, y, z and intensity
+  static constexpr uint32_t chunkMagic = 0x43464b4c;  // "LKFC"
+
+  // record of poses.bin
+  struct PoseRecord
+  {
+    int32_t index;
+    float   x, y, z, roll, pitch, yaw;
+    double  time;
+  };
+
+  std::string directory_;
+  float       cornerLeafSize_;
+  float       surfLeafSize_;
+
+  std::ofstream keyFramesFile_;
+  std::ofstream posesFile_;
+
+  std::mutex                         mtx_;
+  std::condition_variable            cv_;
+  std::deque<KeyFrame>               keyFrames_;
+  std::vector<std::pair<int, PoseT>> poses_;
+  bool                               mergeRequested_ = false;
+  bool                               stop_           = false;
+  std::thread                        thread_;
+
+  std::string path(const std::string &file) const {
+    return (std::filesystem::path(directory_) / file).string();
+  }
+
+  /*//{ run() */
+  void run() {
+    while (true) {
+      std::deque<KeyFrame>               keyFrames;
+      std::vector<std::pair<int, PoseT>> poses;
+      bool                               merge, stop;
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this] { return stop_ || mergeRequested_ || !keyFrames_.empty() || !poses_.empty(); });
+        keyFrames.swap(keyFrames_);
+        poses.swap(poses_);
+        merge = mergeRequested_;
+        stop  = stop_;
+      }
+
+      for (const KeyFrame &keyFrame : keyFrames) {
+        writeKeyFrame(keyFrame);
+      }
+      for (const auto &pose : poses) {
+        writePose(pose.first, pose.second);
+      }
+      keyFramesFile_.flush();
+      posesFile_.flush();
+
+      if (merge) {
+        mergeFiles();
+        std::lock_guard<std::mutex> lock(mtx_);
+        mergeRequested_ = false;
+      }
+
+      if (stop) {
+        return;
+      }
+    }
+  }
+  /*//}*/
+
+  /*//{ writeKeyFrame() */
+  void writeKeyFrame(const KeyFrame &keyFrame) {
+    const uint32_t header[4] = {chunkMagic, uint32_t(keyFrame.index), uint32_t(keyFrame.corner->size()), uint32_t(keyFrame.surf->size())};
+    keyFramesFile_.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    std::vector<float> data;
+    data.reserve(4 * (keyFrame.corner->size() + keyFrame.surf->size()));
+    for (const CloudConstPtr &cloud : {keyFrame.corner, keyFrame.surf}) {
+      for (const PointT &point : cloud->points) {
+        data.insert(data.end(), {point.x, point.y, point.z, point.intensity});
+      }
+    }
+    keyFramesFile_.write(reinterpret_cast<const char *>(data.data()), data.size() * sizeof(float));
+  }
+  /*//}*/
+
+  /*//{ writePose() */
+  void writePose(const int index, const PoseT &pose) {
+    const PoseRecord record{index, pose.x, pose.y, pose.z, pose.roll, pose.pitch, pose.yaw, pose.time};
+    posesFile_.write(reinterpret_cast<const char *>(&record), sizeof(record));
+  }
+  /*//}*/
+
+  /*//{ mergeFiles() */
+  void mergeFiles() {
+    std::map<int, PoseRecord> poses;
+    {
+      std::ifstream file(path("poses.bin"), std::ios::binary);
+      PoseRecord    record;
+      while (file.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        poses[record.index] = record;
+      }
+    }
+
+    pcl::PointCloud<PointT> corners, surfs;
+    {
+      std::ifstream      file(path("keyframes.bin"), std::ios::binary);
+      uint32_t           header[4];
+      std::vector<float> data;
+      while (file.read(reinterpret_cast<char *>(header), sizeof(header)) && header[0] == chunkMagic) {
+        data.resize(4 * (size_t(header[2]) + header[3]));
+        if (!file.read(reinterpret_cast<char *>(data.data()), data.size() * sizeof(float))) {
+          break;
+        }
+        const auto pose = poses.find(int(header[1]));
+        if (pose == poses.end()) {
+          continue;
+        }
+
+        pcl::PointCloud<PointT> corner, surf;
+        readCloud(data, 0, header[2], corner);
+        readCloud(data, header[2], header[3], surf);
+        const Eigen::Affine3f transform =
+            pcl::getTransformation(pose->second.x, pose->second.y, pose->second.z, pose->second.roll, pose->second.pitch, pose->second.yaw);
+        pcl::transformPointCloud(corner, corner, transform);
+        pcl::transformPointCloud(surf, surf, transform);
+        corners += corner;
+        surfs += surf;
+      }
+    }
+
+    pcl::PointCloud<pcl::PointXYZI> trajectory;
+    pcl::PointCloud<PoseT>          transformations;
+    for (const auto &record : poses) {
+      PoseT pose;
+      pose.x         = record.second.x;
+      pose.y         = record.second.y;
+      pose.z         = record.second.z;
+      pose.intensity = record.first;
+      pose.roll      = record.second.roll;
+      pose.pitch     = record.second.pitch;
+      pose.yaw       = record.second.yaw;
+      pose.time      = record.second.time;
+      transformations.push_back(pose);
+
+      pcl::PointXYZI position;
+      position.x         = pose.x;
+      position.y         = pose.y;
+      position.z         = pose.z;
+      position.intensity = pose.intensity;
+      trajectory.push_back(position);
+    }
+
+    pcl::PointCloud<PointT> global = corners;
+    global += surfs;
+
+    pcl::PointCloud<PointT> cornersDS, surfsDS;
+    pcl::VoxelGrid<PointT>  downSizeFilter;
+    downSizeFilter.setLeafSize(cornerLeafSize_, cornerLeafSize_, cornerLeafSize_);
+    downSizeFilter.setInputCloud(corners.makeShared());
+    downSizeFilter.filter(cornersDS);
+    downSizeFilter.setLeafSize(surfLeafSize_, surfLeafSize_, surfLeafSize_);
+    downSizeFilter.setInputCloud(surfs.makeShared());
+    downSizeFilter.filter(surfsDS);
+
+    const bool saved = save("trajectory.pcd", trajectory) && save("transformations.pcd", transformations) && save("cloudCorner.pcd", cornersDS) &&
+                       save("cloudSurf.pcd", surfsDS) && save("cloudGlobal.pcd", global);
+    if (saved) {
+      ROS_INFO("[MapExporter]: map of %d keyframes merged to %s", int(poses.size()), directory_.c_str());
+    } else {
+      ROS_ERROR("[MapExporter]: could not save the merged map to %s", directory_.c_str());
+    }
+  }
+  /*//}*/
+
+  /*//{ readCloud() */
+  static void readCloud(const std::vector<float> &data, const size_t first, const size_t count, pcl::PointCloud<PointT> &cloud) {
+    cloud.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      const float *values       = &data[4 * (first + i)];
+      cloud.points[i].x         = values[0];
+      cloud.points[i].y         = values[1];
+      cloud.points[i].z         = values[2];
+      cloud.points[i].intensity = values[3];
+    }
+  }
+  /*//}*/
+
+  /*//{ save() */
+  // written next to the target and renamed, readers never see a partial file
+  template <typename T>
+  bool save(const std::string &file, const pcl::PointCloud<T> &cloud) {
+    if (cloud.empty()) {
+      return true;
+    }
+    const std::string target    = path(file);
+    const std::string temporary = target + ".tmp";
+    if (pcl::io::savePCDFileBinaryCompressed(temporary, cloud) != 0) {
+      return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, target, error);
+    return !error;
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // MAP_EXPORTER_H
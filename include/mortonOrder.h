@@ -0,0 +1,68 @@
+#ifndef MORTON_ORDER_H
+#define MORTON_ORDER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+namespace liosam
+{
+
+namespace morton_order
+{
+
+/*//{ spreadBits() */
+// inserts two zero bits between each of the lowest 21 bits
+inline uint64_t spreadBits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | (v << 32)) & 0x1f00000000ffffull;
+  v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+  v = (v | (v << 8)) & 0x100f00f00f00f00full;
+  v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+  v = (v | (v << 2)) & 0x1249249249249249ull;
+  return v;
+}
+/*//}*/
+
+}  // namespace morton_order
+
+/*//{ mortonOrder() */
+// Indices of the points ordered along the Z-order curve of their cells of cellSize, so that consecutive (and contiguous blocks of) points are
+// close to each other in space. The order survives a rigid transformation well enough to be computed once per scan in the sensor frame.
+template <typename PointT>
+void mortonOrder(const pcl::PointCloud<PointT> &cloud, const float cellSize, std::vector<int> &order) {
+  const int n = cloud.size();
+  order.resize(n);
+  if (n == 0) {
+    return;
+  }
+
+  float minX = cloud.points[0].x, minY = cloud.points[0].y, minZ = cloud.points[0].z;
+  for (const PointT &point : cloud.points) {
+    minX = std::min(minX, point.x);
+    minY = std::min(minY, point.y);
+    minZ = std::min(minZ, point.z);
+  }
+
+  std::vector<std::pair<uint64_t, int>> codes(n);
+  for (int i = 0; i < n; i++) {
+    const PointT &point = cloud.points[i];
+    const uint64_t x     = uint64_t((point.x - minX) / cellSize);
+    const uint64_t y     = uint64_t((point.y - minY) / cellSize);
+    const uint64_t z     = uint64_t((point.z - minZ) / cellSize);
+    codes[i]             = {morton_order::spreadBits(x) | (morton_order::spreadBits(y) << 1) | (morton_order::spreadBits(z) << 2), i};
+  }
+  std::sort(codes.begin(), codes.end());
+
+  for (int i = 0; i < n; i++) {
+    order[i] = codes[i].second;
+  }
+}
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // MORTON_ORDER_H
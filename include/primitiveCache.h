@@ -0,0 +1,112 @@
+#ifndef PRIMITIVE_CACHE_H
+#define PRIMITIVE_CACHE_H
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace liosam
+{
+
+/*//{ struct MapPrimitive */
+// line (point and unit direction) or plane (unit normal and offset) fitted to a neighbourhood of the local map, invalid if the neighbourhood is
+// not linear / planar enough
+struct MapPrimitive
+{
+  bool  valid = false;
+  float p[6];
+};
+/*//}*/
+
+/*//{ class PrimitiveCache */
+// Primitives of the local map cached by the voxel of the query position.
+//
+// The primitive of a voxel is fitted to the map neighbourhood of the voxel centre (see centre()), not of the query that happened to miss first,
+// so the cached value does not depend on the order of the queries and a neighbourhood of the map is fitted once instead of once per scan point and
+// iteration. The cache is valid for one state of the local map and must be cleared whenever the map changes. Lookups and insertions may run
+// concurrently, the table is split into shards with their own locks; two threads missing the same voxel fit and insert the same primitive.
+class PrimitiveCache {
+
+public:
+  /*//{ PrimitiveCache() */
+  explicit PrimitiveCache(const float resolution = 0.2f, const size_t maxEntries = 1000000) : resolution_(resolution), maxEntries_(maxEntries) {
+  }
+  /*//}*/
+
+  /*//{ clear() */
+  // not concurrent with lookups and insertions
+  void clear() {
+    for (Shard &shard : shards_) {
+      shard.entries.clear();
+    }
+  }
+  /*//}*/
+
+  /*//{ find() */
+  bool find(const float x, const float y, const float z, MapPrimitive &primitive) {
+    const uint64_t key   = toKey(x, y, z);
+    Shard &        shard = shards_[key >> 58];
+
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    const auto                  it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+      return false;
+    }
+    primitive = it->second;
+    return true;
+  }
+  /*//}*/
+
+  /*//{ centre() */
+  // centre of the voxel of the position, the point the primitive of the voxel is fitted around
+  void centre(const float x, const float y, const float z, float &cx, float &cy, float &cz) const {
+    cx = (std::floor(x / resolution_) + 0.5f) * resolution_;
+    cy = (std::floor(y / resolution_) + 0.5f) * resolution_;
+    cz = (std::floor(z / resolution_) + 0.5f) * resolution_;
+  }
+  /*//}*/
+
+  /*//{ insert() */
+  void insert(const float x, const float y, const float z, const MapPrimitive &primitive) {
+    const uint64_t key   = toKey(x, y, z);
+    Shard &        shard = shards_[key >> 58];
+
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    // a full shard starts over, the map changes often enough for this to be rare
+    if (shard.entries.size() >= maxEntries_ / shards_.size()) {
+      shard.entries.clear();
+    }
+    shard.entries.emplace(key, primitive);
+  }
+  /*//}*/
+
+private:
+  struct Shard
+  {
+    std::mutex                                 mtx;
+    std::unordered_map<uint64_t, MapPrimitive> entries;
+  };
+
+  float                 resolution_;
+  size_t                maxEntries_;
+  std::array<Shard, 64> shards_;
+
+  /*//{ toKey() */
+  // 21 bits per axis, the local map spans far less than 2^21 voxels
+  uint64_t toKey(const float x, const float y, const float z) const {
+    const uint64_t kx = uint64_t(int64_t(std::floor(x / resolution_))) & 0x1fffff;
+    const uint64_t ky = uint64_t(int64_t(std::floor(y / resolution_))) & 0x1fffff;
+    const uint64_t kz = uint64_t(int64_t(std::floor(z / resolution_))) & 0x1fffff;
+    // mixed so that the neighbouring voxels fall into different shards (the top 6 bits select the shard)
+    return ((kx << 42) | (ky << 21) | kz) * 0x9e3779b97f4a7c15ull;
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // PRIMITIVE_CACHE_H
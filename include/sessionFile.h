@@ -0,0 +1,248 @@
+#ifndef SESSION_FILE_H
+#define SESSION_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pcl/point_cloud.h>
+
+namespace liosam
+{
+
+// Session file: everything MapOptimization needs to continue a mapping session, laid out so that it can be used straight from a memory mapping.
+//
+//   SessionHeader
+//   SessionKeyFrame[numKeyFrames]  at keyFramesOffset
+//   SessionFactor[numFactors]      at factorsOffset
+//   float[4][numPoints]            at pointsOffset, x, y, z and intensity, the corner and then the surf points of every keyframe in the sensor frame
+//
+// All sections start at multiples of 64 bytes, the numbers are in the byte order of the machine that wrote the file.
+
+/*//{ struct SessionHeader */
+struct SessionHeader
+{
+  char     magic[8];  // "LIOSAMS1"
+  uint32_t numKeyFrames;
+  uint32_t numFactors;
+  uint64_t numPoints;
+  uint64_t keyFramesOffset;
+  uint64_t factorsOffset;
+  uint64_t pointsOffset;
+  uint64_t fileSize;
+};
+/*//}*/
+
+/*//{ struct SessionKeyFrame */
+struct SessionKeyFrame
+{
+  float    pose[6];  // x, y, z, roll, pitch, yaw
+  uint32_t cornerCount;
+  uint32_t surfCount;
+  double   time;
+  uint64_t firstPoint;  // the corner points, followed by the surf points
+};
+/*//}*/
+
+/*//{ struct SessionFactor */
+// a factor of the pose graph with its noise model (diagonal, sigmas)
+struct SessionFactor
+{
+  enum Type : int32_t
+  {
+    PRIOR    = 0,  // pose of keyframe from
+    ODOMETRY = 1,  // pose of keyframe to relative to keyframe from
+    LOOP     = 2,  // pose of keyframe to relative to keyframe from (the newer one)
+    GPS      = 3,  // position of keyframe from, value[0..2], sigmas[0..2]
+  };
+
+  int32_t type;
+  int32_t from;
+  int32_t to;
+  int32_t reserved;
+  float   value[6];  // x, y, z, roll, pitch, yaw
+  float   sigmas[6];
+};
+/*//}*/
+
+namespace session_file
+{
+
+const char magic[8] = {'L', 'I', 'O', 'S', 'A', 'M', 'S', '1'};
+
+inline uint64_t align(const uint64_t offset) {
+  return (offset + 63) & ~uint64_t(63);
+}
+
+}  // namespace session_file
+
+/*//{ writeSession() */
+// keyFrames[i] describes the clouds corners[i] and surfs[i], its counts and firstPoint are filled in here. Written next to the path and renamed, a
+// reader never sees a partial file. Returns false on an I/O error.
+template <typename PointT>
+bool writeSession(const std::string &path, std::vector<SessionKeyFrame> keyFrames, const std::vector<typename pcl::PointCloud<PointT>::ConstPtr> &corners,
+                  const std::vector<typename pcl::PointCloud<PointT>::ConstPtr> &surfs, const std::vector<SessionFactor> &factors) {
+  SessionHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, session_file::magic, sizeof(header.magic));
+  header.numKeyFrames = keyFrames.size();
+  header.numFactors   = factors.size();
+
+  for (size_t i = 0; i < keyFrames.size(); i++) {
+    keyFrames[i].cornerCount = corners[i]->size();
+    keyFrames[i].surfCount   = surfs[i]->size();
+    keyFrames[i].firstPoint  = header.numPoints;
+    header.numPoints += corners[i]->size() + surfs[i]->size();
+  }
+  header.keyFramesOffset = session_file::align(sizeof(SessionHeader));
+  header.factorsOffset   = session_file::align(header.keyFramesOffset + keyFrames.size() * sizeof(SessionKeyFrame));
+  header.pointsOffset    = session_file::align(header.factorsOffset + factors.size() * sizeof(SessionFactor));
+  header.fileSize        = header.pointsOffset + header.numPoints * 4 * sizeof(float);
+
+  const std::string temporary = path + ".tmp";
+  FILE *            file      = std::fopen(temporary.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  const auto writeAt = [&](const uint64_t offset, const void *data, const size_t bytes) {
+    return std::fseek(file, long(offset), SEEK_SET) == 0 && (bytes == 0 || std::fwrite(data, bytes, 1, file) == 1);
+  };
+
+  bool ok = writeAt(0, &header, sizeof(header)) && writeAt(header.keyFramesOffset, keyFrames.data(), keyFrames.size() * sizeof(SessionKeyFrame)) &&
+            writeAt(header.factorsOffset, factors.data(), factors.size() * sizeof(SessionFactor)) && std::fseek(file, long(header.pointsOffset), SEEK_SET) == 0;
+
+  std::vector<float> data;
+  for (size_t i = 0; ok && i < keyFrames.size(); i++) {
+    data.clear();
+    for (const auto &cloud : {corners[i], surfs[i]}) {
+      for (const PointT &point : cloud->points) {
+        data.insert(data.end(), {point.x, point.y, point.z, point.intensity});
+      }
+    }
+    ok = data.empty() || std::fwrite(data.data(), data.size() * sizeof(float), 1, file) == 1;
+  }
+
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+/*//}*/
+
+/*//{ class SessionFile */
+// Read-only memory mapping of a session file, the records are used in place.
+class SessionFile {
+
+public:
+  SessionFile() = default;
+
+  SessionFile(const SessionFile &) = delete;
+  SessionFile &operator=(const SessionFile &) = delete;
+
+  ~SessionFile() {
+    close();
+  }
+
+  /*//{ open() */
+  // false if the file does not exist or is not a valid session file
+  bool open(const std::string &path) {
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || size_t(status.st_size) < sizeof(SessionHeader)) {
+      ::close(fd);
+      return false;
+    }
+    size_       = status.st_size;
+    void *data  = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    data_ = static_cast<const char *>(data);
+
+    const SessionHeader &h = header();
+    if (std::memcmp(h.magic, session_file::magic, sizeof(h.magic)) != 0 || h.fileSize != size_ ||
+        h.keyFramesOffset + uint64_t(h.numKeyFrames) * sizeof(SessionKeyFrame) > h.factorsOffset ||
+        h.factorsOffset + uint64_t(h.numFactors) * sizeof(SessionFactor) > h.pointsOffset || h.pointsOffset + h.numPoints * 4 * sizeof(float) > size_) {
+      close();
+      return false;
+    }
+    for (uint32_t i = 0; i < h.numKeyFrames; i++) {
+      if (keyFrame(i).firstPoint + keyFrame(i).cornerCount + keyFrame(i).surfCount > h.numPoints) {
+        close();
+        return false;
+      }
+    }
+    return true;
+  }
+  /*//}*/
+
+  /*//{ close() */
+  void close() {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char *>(data_), size_);
+      data_ = nullptr;
+      size_ = 0;
+    }
+  }
+  /*//}*/
+
+  const SessionHeader &header() const {
+    return *reinterpret_cast<const SessionHeader *>(data_);
+  }
+
+  const SessionKeyFrame &keyFrame(const int index) const {
+    return reinterpret_cast<const SessionKeyFrame *>(data_ + header().keyFramesOffset)[index];
+  }
+
+  const SessionFactor &factor(const int index) const {
+    return reinterpret_cast<const SessionFactor *>(data_ + header().factorsOffset)[index];
+  }
+
+  /*//{ clouds() */
+  template <typename PointT>
+  void clouds(const int index, pcl::PointCloud<PointT> &corner, pcl::PointCloud<PointT> &surf) const {
+    const SessionKeyFrame &thisKeyFrame = keyFrame(index);
+    const float *          points       = reinterpret_cast<const float *>(data_ + header().pointsOffset) + 4 * thisKeyFrame.firstPoint;
+    readCloud(points, thisKeyFrame.cornerCount, corner);
+    readCloud(points + 4 * size_t(thisKeyFrame.cornerCount), thisKeyFrame.surfCount, surf);
+  }
+  /*//}*/
+
+private:
+  const char *data_ = nullptr;
+  size_t      size_ = 0;
+
+  /*//{ readCloud() */
+  template <typename PointT>
+  static void readCloud(const float *points, const size_t count, pcl::PointCloud<PointT> &cloud) {
+    cloud.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      cloud.points[i].x         = points[4 * i];
+      cloud.points[i].y         = points[4 * i + 1];
+      cloud.points[i].z         = points[4 * i + 2];
+      cloud.points[i].intensity = points[4 * i + 3];
+    }
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // SESSION_FILE_H
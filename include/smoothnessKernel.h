@@ -0,0 +1,252 @@
+#ifndef SMOOTHNESS_KERNEL_H
+#define SMOOTHNESS_KERNEL_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LIOSAM_SMOOTHNESS_AVX2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define LIOSAM_SMOOTHNESS_NEON
+#endif
+
+namespace liosam
+{
+
+// Per-point flags produced by the smoothness kernel, the neighbour marking itself is done afterwards (it scatters, which does not vectorize)
+enum SmoothnessFlag : uint8_t
+{
+  OCCLUDED_BEFORE = 1,  // the points [i - 5, i] are occluded by the next point
+  OCCLUDED_AFTER  = 2,  // the points [i + 1, i + 6] are occluded by this point
+  PARALLEL_BEAM   = 4,  // the beam is almost parallel to the surface
+};
+
+namespace smoothness_kernel
+{
+
+// The thresholds of the original LOAM implementation. The occlusion test compares a float difference with the double 0.3, which is the same
+// as >= 0.3f. The parallel beam test is done in double precision, as in the scalar code, so that all variants give identical results.
+const float  occlusionThreshold = 0.3f;
+const int    occlusionColumns   = 10;
+const double parallelBeamRatio  = 0.02;
+
+/*//{ curvatureScalar() */
+// the sum is evaluated in the order of the original expression, the vector variants use the same order and produce bit-identical values
+inline float curvatureScalar(const float *range, const int i) {
+  const float diffRange = range[i - 5] + range[i - 4] + range[i - 3] + range[i - 2] + range[i - 1] - range[i] * 10 + range[i + 1] + range[i + 2] +
+                          range[i + 3] + range[i + 4] + range[i + 5];
+  return diffRange * diffRange;
+}
+/*//}*/
+
+/*//{ flagsScalar() */
+inline uint8_t flagsScalar(const float *range, const int32_t *colInd, const int i) {
+  uint8_t flags = 0;
+
+  // occluded points
+  const float depth1     = range[i];
+  const float depth2     = range[i + 1];
+  const int   columnDiff = std::abs(int(colInd[i + 1] - colInd[i]));
+
+  if (columnDiff < occlusionColumns) {
+    if (depth1 - depth2 >= occlusionThreshold) {
+      flags |= OCCLUDED_BEFORE;
+    } else if (depth2 - depth1 >= occlusionThreshold) {
+      flags |= OCCLUDED_AFTER;
+    }
+  }
+
+  // parallel beam
+  const float diff1 = std::abs(float(range[i - 1] - range[i]));
+  const float diff2 = std::abs(float(range[i + 1] - range[i]));
+
+  if (diff1 > parallelBeamRatio * range[i] && diff2 > parallelBeamRatio * range[i]) {
+    flags |= PARALLEL_BEAM;
+  }
+
+  return flags;
+}
+/*//}*/
+
+#ifdef LIOSAM_SMOOTHNESS_AVX2
+
+/*//{ stencilAvx2() */
+// 8 points per iteration, returns the index of the first point that was not processed
+__attribute__((target("avx2"))) inline int stencilAvx2(const float *range, const int32_t *colInd, int i, const int end, float *curvature,
+                                                        uint8_t *flags) {
+  const __m256  ten      = _mm256_set1_ps(10.0f);
+  const __m256  occlude  = _mm256_set1_ps(occlusionThreshold);
+  const __m256  absMask  = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256i columns  = _mm256_set1_epi32(occlusionColumns);
+  const __m256d parallel = _mm256_set1_pd(parallelBeamRatio);
+
+  for (; i + 8 <= end; i += 8) {
+    const __m256 prev = _mm256_loadu_ps(range + i - 1);
+    const __m256 cur  = _mm256_loadu_ps(range + i);
+    const __m256 next = _mm256_loadu_ps(range + i + 1);
+
+    // curvature, shifted loads instead of a running sum to keep the rounding of the scalar code
+    __m256 sum = _mm256_add_ps(_mm256_loadu_ps(range + i - 5), _mm256_loadu_ps(range + i - 4));
+    sum        = _mm256_add_ps(sum, _mm256_loadu_ps(range + i - 3));
+    sum        = _mm256_add_ps(sum, _mm256_loadu_ps(range + i - 2));
+    sum        = _mm256_add_ps(sum, prev);
+    sum        = _mm256_sub_ps(sum, _mm256_mul_ps(cur, ten));
+    sum        = _mm256_add_ps(sum, next);
+    sum        = _mm256_add_ps(sum, _mm256_loadu_ps(range + i + 2));
+    sum        = _mm256_add_ps(sum, _mm256_loadu_ps(range + i + 3));
+    sum        = _mm256_add_ps(sum, _mm256_loadu_ps(range + i + 4));
+    sum        = _mm256_add_ps(sum, _mm256_loadu_ps(range + i + 5));
+    _mm256_storeu_ps(curvature + i, _mm256_mul_ps(sum, sum));
+
+    // occluded points
+    const __m256i colCur  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(colInd + i));
+    const __m256i colNext = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(colInd + i + 1));
+    const int     near    = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(columns, _mm256_abs_epi32(_mm256_sub_epi32(colNext, colCur)))));
+    const int     before  = near & _mm256_movemask_ps(_mm256_cmp_ps(_mm256_sub_ps(cur, next), occlude, _CMP_GE_OQ));
+    const int     after   = near & ~before & _mm256_movemask_ps(_mm256_cmp_ps(_mm256_sub_ps(next, cur), occlude, _CMP_GE_OQ));
+
+    // parallel beam
+    const __m256  diff1   = _mm256_and_ps(_mm256_sub_ps(prev, cur), absMask);
+    const __m256  diff2   = _mm256_and_ps(_mm256_sub_ps(next, cur), absMask);
+    const __m256d limitLo = _mm256_mul_pd(parallel, _mm256_cvtps_pd(_mm256_castps256_ps128(cur)));
+    const __m256d limitHi = _mm256_mul_pd(parallel, _mm256_cvtps_pd(_mm256_extractf128_ps(cur, 1)));
+    const __m256d beamLo  = _mm256_and_pd(_mm256_cmp_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(diff1)), limitLo, _CMP_GT_OQ),
+                                         _mm256_cmp_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(diff2)), limitLo, _CMP_GT_OQ));
+    const __m256d beamHi  = _mm256_and_pd(_mm256_cmp_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(diff1, 1)), limitHi, _CMP_GT_OQ),
+                                         _mm256_cmp_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(diff2, 1)), limitHi, _CMP_GT_OQ));
+    const int     beam    = _mm256_movemask_pd(beamLo) | (_mm256_movemask_pd(beamHi) << 4);
+
+    // most of the points have no flag at all
+    if ((before | after | beam) == 0) {
+      std::memset(flags + i, 0, 8);
+      continue;
+    }
+    for (int k = 0; k < 8; k++) {
+      flags[i + k] = ((before >> k) & 1) * OCCLUDED_BEFORE | ((after >> k) & 1) * OCCLUDED_AFTER | ((beam >> k) & 1) * PARALLEL_BEAM;
+    }
+  }
+
+  return i;
+}
+/*//}*/
+
+#endif
+
+#ifdef LIOSAM_SMOOTHNESS_NEON
+
+/*//{ stencilNeon() */
+// 4 points per iteration, returns the index of the first point that was not processed
+inline int stencilNeon(const float *range, const int32_t *colInd, int i, const int end, float *curvature, uint8_t *flags) {
+  const float32x4_t ten      = vdupq_n_f32(10.0f);
+  const float32x4_t occlude  = vdupq_n_f32(occlusionThreshold);
+  const int32x4_t   columns  = vdupq_n_s32(occlusionColumns);
+  const float64x2_t parallel = vdupq_n_f64(parallelBeamRatio);
+
+  for (; i + 4 <= end; i += 4) {
+    const float32x4_t prev = vld1q_f32(range + i - 1);
+    const float32x4_t cur  = vld1q_f32(range + i);
+    const float32x4_t next = vld1q_f32(range + i + 1);
+
+    // curvature, shifted loads instead of a running sum to keep the rounding of the scalar code
+    float32x4_t sum = vaddq_f32(vld1q_f32(range + i - 5), vld1q_f32(range + i - 4));
+    sum             = vaddq_f32(sum, vld1q_f32(range + i - 3));
+    sum             = vaddq_f32(sum, vld1q_f32(range + i - 2));
+    sum             = vaddq_f32(sum, prev);
+    sum             = vsubq_f32(sum, vmulq_f32(cur, ten));
+    sum             = vaddq_f32(sum, next);
+    sum             = vaddq_f32(sum, vld1q_f32(range + i + 2));
+    sum             = vaddq_f32(sum, vld1q_f32(range + i + 3));
+    sum             = vaddq_f32(sum, vld1q_f32(range + i + 4));
+    sum             = vaddq_f32(sum, vld1q_f32(range + i + 5));
+    vst1q_f32(curvature + i, vmulq_f32(sum, sum));
+
+    // occluded points
+    const uint32x4_t near   = vcltq_s32(vabsq_s32(vsubq_s32(vld1q_s32(colInd + i + 1), vld1q_s32(colInd + i))), columns);
+    const uint32x4_t before = vandq_u32(near, vcgeq_f32(vsubq_f32(cur, next), occlude));
+    const uint32x4_t after  = vbicq_u32(vandq_u32(near, vcgeq_f32(vsubq_f32(next, cur), occlude)), before);
+
+    // parallel beam
+    const float32x4_t diff1   = vabsq_f32(vsubq_f32(prev, cur));
+    const float32x4_t diff2   = vabsq_f32(vsubq_f32(next, cur));
+    const float64x2_t limitLo = vmulq_f64(parallel, vcvt_f64_f32(vget_low_f32(cur)));
+    const float64x2_t limitHi = vmulq_f64(parallel, vcvt_high_f64_f32(cur));
+    const uint64x2_t  beamLo  = vandq_u64(vcgtq_f64(vcvt_f64_f32(vget_low_f32(diff1)), limitLo), vcgtq_f64(vcvt_f64_f32(vget_low_f32(diff2)), limitLo));
+    const uint64x2_t  beamHi  = vandq_u64(vcgtq_f64(vcvt_high_f64_f32(diff1), limitHi), vcgtq_f64(vcvt_high_f64_f32(diff2), limitHi));
+    const uint32x4_t  beam    = vcombine_u32(vmovn_u64(beamLo), vmovn_u64(beamHi));
+
+    uint32x4_t bits = vandq_u32(before, vdupq_n_u32(OCCLUDED_BEFORE));
+    bits            = vorrq_u32(bits, vandq_u32(after, vdupq_n_u32(OCCLUDED_AFTER)));
+    bits            = vorrq_u32(bits, vandq_u32(beam, vdupq_n_u32(PARALLEL_BEAM)));
+
+    const uint16x4_t narrow = vmovn_u32(bits);
+    uint8_t          packed[8];
+    vst1_u8(packed, vmovn_u16(vcombine_u16(narrow, narrow)));
+    std::memcpy(flags + i, packed, 4);
+  }
+
+  return i;
+}
+/*//}*/
+
+#endif
+
+/*//{ hasAvx2() */
+inline bool hasAvx2() {
+#ifdef LIOSAM_SMOOTHNESS_AVX2
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+#else
+  return false;
+#endif
+}
+/*//}*/
+
+}  // namespace smoothness_kernel
+
+/*//{ smoothnessKernelName() */
+// the variant selected by computeSmoothness() on this machine
+inline const char *smoothnessKernelName() {
+#if defined(LIOSAM_SMOOTHNESS_NEON)
+  return "neon";
+#else
+  return smoothness_kernel::hasAvx2() ? "avx2" : "scalar";
+#endif
+}
+/*//}*/
+
+/*//{ computeSmoothness() */
+// Single pass of the 11-point LOAM stencil over the range image data of a scan.
+//
+// Fills curvature[i] for i in [5, size - 5) and flags[i] (see SmoothnessFlag) for i in [5, size - 6), flags[size - 6] is set to zero.
+// The entries outside of these ranges are not touched. The vector variant is chosen at runtime, the remaining points go through the scalar code.
+inline void computeSmoothness(const float *range, const int32_t *colInd, const int size, float *curvature, uint8_t *flags) {
+  const int end = size - 6;
+  int       i   = 5;
+
+#if defined(LIOSAM_SMOOTHNESS_AVX2)
+  if (smoothness_kernel::hasAvx2()) {
+    i = smoothness_kernel::stencilAvx2(range, colInd, i, end, curvature, flags);
+  }
+#elif defined(LIOSAM_SMOOTHNESS_NEON)
+  i = smoothness_kernel::stencilNeon(range, colInd, i, end, curvature, flags);
+#endif
+
+  for (; i < end; i++) {
+    curvature[i] = smoothness_kernel::curvatureScalar(range, i);
+    flags[i]     = smoothness_kernel::flagsScalar(range, colInd, i);
+  }
+
+  // the last point with a full window has no successor for the occlusion test
+  for (; i < size - 5; i++) {
+    curvature[i] = smoothness_kernel::curvatureScalar(range, i);
+    flags[i]     = 0;
+  }
+}
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // SMOOTHNESS_KERNEL_H
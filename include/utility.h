@@ -43,6 +43,7 @@
 #include <fstream>
 #include <ctime>
 #include <cfloat>
+#include <cstring>
 #include <iterator>
 #include <sstream>
 #include <string>
@@ -60,6 +61,10 @@
 
 #include "liosam/cloud_info.h"
 
+#include "cloudFrame.h"
+
+#include "imuRingBuffer.h"
+
 using namespace std;
 
 typedef pcl::PointXYZI PointType;
@@ -104,6 +109,13 @@ void imuAngular2rosAngular(sensor_msgs::Imu *thisImuMsg, T *angular_x, T *angula
   *angular_y = thisImuMsg->angular_velocity.y;
   *angular_z = thisImuMsg->angular_velocity.z;
 }
+
+template <typename T>
+void imuAngular2rosAngular(const liosam::ImuSample &sample, T *angular_x, T *angular_y, T *angular_z) {
+  *angular_x = sample.gyr[0];
+  *angular_y = sample.gyr[1];
+  *angular_z = sample.gyr[2];
+}
 /*//}*/
 
 /*//{ imuAccel2rosAccel() */
@@ -127,6 +139,16 @@ void imuRPY2rosRPY(sensor_msgs::Imu *thisImuMsg, T *rosRoll, T *rosPitch, T *ros
   *rosPitch = imuPitch;
   *rosYaw   = imuYaw;
 }
+
+template <typename T>
+void imuRPY2rosRPY(const liosam::ImuSample &sample, T *rosRoll, T *rosPitch, T *rosYaw) {
+  double         imuRoll, imuPitch, imuYaw;
+  tf2::Matrix3x3(tf2::Quaternion(sample.q[0], sample.q[1], sample.q[2], sample.q[3])).getRPY(imuRoll, imuPitch, imuYaw);
+
+  *rosRoll  = imuRoll;
+  *rosPitch = imuPitch;
+  *rosYaw   = imuYaw;
+}
 /*//}*/
 
 /*//{ pointDistance() */
@@ -175,6 +197,42 @@ float pointDistance(PointType p1, PointType p2) {
   }
 /*//}*/
 
+/*//{ imuSampleConverter() */
+  // same as imuConverter(), but produces only the compact sample stored in the ImuRingBuffer
+  liosam::ImuSample imuSampleConverter(const sensor_msgs::Imu &imu_in, const Eigen::Matrix3d &extRot, const Eigen::Quaterniond &extQRPY, const bool imuProvidesOrientation) {
+
+    liosam::ImuSample sample;
+    sample.t = imu_in.header.stamp.toSec();
+
+    // rotate acceleration
+    const Eigen::Vector3d acc = extRot * Eigen::Vector3d(imu_in.linear_acceleration.x, imu_in.linear_acceleration.y, imu_in.linear_acceleration.z);
+    sample.acc[0]             = acc.x();
+    sample.acc[1]             = acc.y();
+    sample.acc[2]             = acc.z();
+
+    // rotate gyroscope
+    const Eigen::Vector3d gyr = extRot * Eigen::Vector3d(imu_in.angular_velocity.x, imu_in.angular_velocity.y, imu_in.angular_velocity.z);
+    sample.gyr[0]             = gyr.x();
+    sample.gyr[1]             = gyr.y();
+    sample.gyr[2]             = gyr.z();
+
+    // rotate roll pitch yaw
+    const Eigen::Quaterniond q_from(imu_in.orientation.w, imu_in.orientation.x, imu_in.orientation.y, imu_in.orientation.z);
+    const Eigen::Quaterniond q_final = q_from * extQRPY;
+    sample.q[0]                      = q_final.x();
+    sample.q[1]                      = q_final.y();
+    sample.q[2]                      = q_final.z();
+    sample.q[3]                      = q_final.w();
+
+    if (imuProvidesOrientation && q_final.norm() < 0.1) {
+      ROS_ERROR("Invalid quaternion, please use a 9-axis IMU!");
+      ros::shutdown();
+    }
+
+    return sample;
+  }
+/*//}*/
+
 /*//{ findLidar2ImuTf() */
 void findLidar2ImuTf(std::shared_ptr<mrs_lib::Transformer> transformer, const string &lidarFrame, const string &imuFrame, const string &baselinkFrame, Eigen::Matrix3d &extRot, Eigen::Quaterniond &extQRPY, geometry_msgs::TransformStamped &tfLidar2Baselink, geometry_msgs::TransformStamped &tfLidar2Imu) {
 
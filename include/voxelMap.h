@@ -0,0 +1,260 @@
+#ifndef VOXEL_MAP_H
+#define VOXEL_MAP_H
+
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "localMapIndex.h"
+
+namespace liosam
+{
+
+/*//{ class VoxelMap */
+// Spatial hash of voxels in the spirit of iVox (Bai et al., 2022), used as the local map of the scan-to-map matching.
+//
+// Every voxel holds at most maxPointsPerVoxel points stored contiguously, the nearest neighbours are searched only in the voxel of the query and
+// its neighbours (7: the faces, 27: the whole 3x3x3 block). The search is therefore approximate, points further than one voxel from the query
+// are not found; with 27 neighbours all points within one resolution of the query are considered. The number of voxels is bounded, the least
+// recently updated ones are dropped first.
+template <typename PointT>
+class VoxelMap : public LocalMapIndex<PointT> {
+
+public:
+  typedef typename LocalMapIndex<PointT>::Cloud Cloud;
+
+  enum class Neighborhood
+  {
+    NEARBY7,
+    NEARBY27,
+  };
+
+  /*//{ VoxelMap() */
+  VoxelMap(const float resolution = 1.0f, const int maxPointsPerVoxel = 30, const Neighborhood neighborhood = Neighborhood::NEARBY27,
+           const size_t maxVoxels = 1000000)
+      : resolution_(resolution), maxPointsPerVoxel_(maxPointsPerVoxel), maxVoxels_(maxVoxels) {
+    offsets_.push_back(Key{{0, 0, 0}});
+    if (neighborhood == Neighborhood::NEARBY7) {
+      for (int axis = 0; axis < 3; axis++) {
+        for (const int step : {-1, 1}) {
+          Key offset{{0, 0, 0}};
+          offset.v[axis] = step;
+          offsets_.push_back(offset);
+        }
+      }
+    } else {
+      for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+          for (int z = -1; z <= 1; z++) {
+            if (x != 0 || y != 0 || z != 0) {
+              offsets_.push_back(Key{{x, y, z}});
+            }
+          }
+        }
+      }
+    }
+  }
+  /*//}*/
+
+  /*//{ build() */
+  void build(const Cloud &cloud) override {
+    clear();
+    addPoints(cloud, 0);
+  }
+  /*//}*/
+
+  /*//{ clear() */
+  void clear() override {
+    voxels_.clear();
+    lru_.clear();
+    pointCount_ = 0;
+  }
+  /*//}*/
+
+  /*//{ size() */
+  int size() const override {
+    return pointCount_;
+  }
+  /*//}*/
+
+  /*//{ addPoints() */
+  // a point is dropped if its voxel is full or if a point of the voxel is closer than leafSize
+  int addPoints(const Cloud &cloud, const float leafSize) override {
+    const float minSqDistance = leafSize * leafSize;
+    int         added         = 0;
+
+    for (const PointT &point : cloud.points) {
+      if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z)) {
+        continue;
+      }
+
+      const Key key = toKey(point);
+      auto      it  = voxels_.find(key);
+      if (it == voxels_.end()) {
+        lru_.push_front(key);
+        it = voxels_.emplace(key, Voxel()).first;
+        it->second.lruPosition = lru_.begin();
+        it->second.points.reserve(maxPointsPerVoxel_);
+      } else {
+        lru_.splice(lru_.begin(), lru_, it->second.lruPosition);
+      }
+
+      std::vector<PointT> &points = it->second.points;
+      if (int(points.size()) >= maxPointsPerVoxel_) {
+        continue;
+      }
+      bool tooClose = false;
+      for (const PointT &other : points) {
+        if (sqDistance(point, other) < minSqDistance) {
+          tooClose = true;
+          break;
+        }
+      }
+      if (tooClose) {
+        continue;
+      }
+
+      points.push_back(point);
+      pointCount_++;
+      added++;
+    }
+
+    // the least recently updated voxels go first
+    while (voxels_.size() > maxVoxels_) {
+      const auto it = voxels_.find(lru_.back());
+      pointCount_ -= it->second.points.size();
+      voxels_.erase(it);
+      lru_.pop_back();
+    }
+
+    return added;
+  }
+  /*//}*/
+
+  /*//{ keepBox() */
+  // whole voxels are deleted, the ones with the center outside of the box
+  int keepBox(const MapBox &box) override {
+    int deleted = 0;
+    for (auto it = voxels_.begin(); it != voxels_.end();) {
+      const Key &key = it->first;
+      if (box.contains((key.v[0] + 0.5f) * resolution_, (key.v[1] + 0.5f) * resolution_, (key.v[2] + 0.5f) * resolution_)) {
+        ++it;
+        continue;
+      }
+      deleted += it->second.points.size();
+      lru_.erase(it->second.lruPosition);
+      it = voxels_.erase(it);
+    }
+    pointCount_ -= deleted;
+    return deleted;
+  }
+  /*//}*/
+
+  /*//{ nearestKSearch() */
+  int nearestKSearch(const PointT &point, const int k, std::vector<PointT> &points, std::vector<float> &sqDistances) const override {
+    // the k best so far, sorted by distance, k is small so insertion is cheaper than collecting all candidates
+    points.clear();
+    sqDistances.clear();
+    if (k <= 0) {
+      return 0;
+    }
+
+    const Key center = toKey(point);
+    for (const Key &offset : offsets_) {
+      const auto it = voxels_.find(Key{{center.v[0] + offset.v[0], center.v[1] + offset.v[1], center.v[2] + offset.v[2]}});
+      if (it == voxels_.end()) {
+        continue;
+      }
+      for (const PointT &other : it->second.points) {
+        const float dist = sqDistance(point, other);
+        if (int(sqDistances.size()) == k) {
+          if (dist >= sqDistances.back()) {
+            continue;
+          }
+          sqDistances.pop_back();
+          points.pop_back();
+        }
+        int pos = sqDistances.size();
+        while (pos > 0 && sqDistances[pos - 1] > dist) {
+          pos--;
+        }
+        sqDistances.insert(sqDistances.begin() + pos, dist);
+        points.insert(points.begin() + pos, other);
+      }
+    }
+
+    return sqDistances.size();
+  }
+  /*//}*/
+
+  /*//{ flatten() */
+  void flatten(Cloud &cloud) const override {
+    cloud.clear();
+    for (const auto &voxel : voxels_) {
+      cloud.points.insert(cloud.points.end(), voxel.second.points.begin(), voxel.second.points.end());
+    }
+    cloud.width  = cloud.points.size();
+    cloud.height = 1;
+  }
+  /*//}*/
+
+private:
+  /*//{ struct Key */
+  struct Key
+  {
+    int v[3];
+
+    bool operator==(const Key &other) const {
+      return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2];
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key &key) const {
+      // spatial hash of Teschner et al.
+      return size_t((int64_t(key.v[0]) * 73856093) ^ (int64_t(key.v[1]) * 471943) ^ (int64_t(key.v[2]) * 83492791));
+    }
+  };
+  /*//}*/
+
+  /*//{ struct Voxel */
+  struct Voxel
+  {
+    std::vector<PointT>             points;
+    typename std::list<Key>::iterator lruPosition;
+  };
+  /*//}*/
+
+  float  resolution_;
+  int    maxPointsPerVoxel_;
+  size_t maxVoxels_;
+
+  std::vector<Key>                       offsets_;
+  std::unordered_map<Key, Voxel, KeyHash> voxels_;
+  std::list<Key>                         lru_;  // most recently updated first
+  int                                    pointCount_ = 0;
+
+  /*//{ toKey() */
+  Key toKey(const PointT &point) const {
+    return Key{{int(std::floor(point.x / resolution_)), int(std::floor(point.y / resolution_)), int(std::floor(point.z / resolution_))}};
+  }
+  /*//}*/
+
+  /*//{ sqDistance() */
+  static float sqDistance(const PointT &a, const PointT &b) {
+    const float dx = a.x - b.x;
+    const float dy = a.y - b.y;
+    const float dz = a.z - b.z;
+    return dx * dx + dy * dy + dz * dz;
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace liosam
+
+#endif  // VOXEL_MAP_H
@@ -1,18 +1,5 @@
 #include "utility.h"
-
-struct PointXYZIRT
-{
-  PCL_ADD_POINT4D
-  PCL_ADD_INTENSITY;
-  uint32_t t;
-  uint8_t  ring;
-  uint32_t range;
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-} EIGEN_ALIGN16;
-
-POINT_CLOUD_REGISTER_POINT_STRUCT(PointXYZIRT,
-                                  (float, x, x)(float, y, y)(float, z, z)(float, intensity, intensity)(std::uint32_t, t, t)(std::uint8_t, ring,
-                                                                                                                            ring)(std::uint32_t, range, range))
+#include "featureExtractor.h"
 
 namespace liosam
 {
@@ -21,10 +8,107 @@ namespace image_projection
 
 const int queueLength = 2000;
 
+/*//{ struct CloudField */
+// typed accessor of a single sensor_msgs::PointCloud2 field, resolved once from msg->fields
+struct CloudField
+{
+  bool     available = false;
+  uint32_t offset    = 0;
+  uint8_t  datatype  = 0;
+
+  void resolve(const std::vector<sensor_msgs::PointField> &fields, const std::string &name) {
+    available = false;
+    for (const auto &field : fields) {
+      if (field.name == name) {
+        available = true;
+        offset    = field.offset;
+        datatype  = field.datatype;
+        return;
+      }
+    }
+  }
+
+  bool isFloatingPoint() const {
+    return datatype == sensor_msgs::PointField::FLOAT32 || datatype == sensor_msgs::PointField::FLOAT64;
+  }
+
+  template <typename T>
+  T read(const uint8_t *point) const {
+    const uint8_t *ptr = point + offset;
+    switch (datatype) {
+      case sensor_msgs::PointField::FLOAT32:
+        return static_cast<T>(readRaw<float>(ptr));
+      case sensor_msgs::PointField::FLOAT64:
+        return static_cast<T>(readRaw<double>(ptr));
+      case sensor_msgs::PointField::UINT32:
+        return static_cast<T>(readRaw<uint32_t>(ptr));
+      case sensor_msgs::PointField::INT32:
+        return static_cast<T>(readRaw<int32_t>(ptr));
+      case sensor_msgs::PointField::UINT16:
+        return static_cast<T>(readRaw<uint16_t>(ptr));
+      case sensor_msgs::PointField::INT16:
+        return static_cast<T>(readRaw<int16_t>(ptr));
+      case sensor_msgs::PointField::UINT8:
+        return static_cast<T>(readRaw<uint8_t>(ptr));
+      case sensor_msgs::PointField::INT8:
+        return static_cast<T>(readRaw<int8_t>(ptr));
+      default:
+        return T(0);
+    }
+  }
+
+private:
+  template <typename R>
+  static R readRaw(const uint8_t *ptr) {
+    R value;
+    std::memcpy(&value, ptr, sizeof(R));
+    return value;
+  }
+};
+/*//}*/
+
+/*//{ struct CloudLayout */
+// field offsets of the incoming cloud, the sensor does not change them between scans
+struct CloudLayout
+{
+  CloudField x;
+  CloudField y;
+  CloudField z;
+  CloudField intensity;
+  CloudField ring;
+  CloudField range;
+  CloudField time;
+
+  // integer point times are in nanoseconds (Ouster "t"), floating point times in seconds (Velodyne "time")
+  double timeScale  = 1.0;
+  // integer ranges are in millimeters (Ouster "range"), floating point ranges in meters
+  float  rangeScale = 1.0f;
+
+  bool resolved = false;
+
+  void resolve(const sensor_msgs::PointCloud2 &msg, const std::string &timeField) {
+    x.resolve(msg.fields, "x");
+    y.resolve(msg.fields, "y");
+    z.resolve(msg.fields, "z");
+    intensity.resolve(msg.fields, "intensity");
+    ring.resolve(msg.fields, "ring");
+    range.resolve(msg.fields, "range");
+    time.resolve(msg.fields, timeField);
+
+    timeScale  = time.isFloatingPoint() ? 1.0 : 1.0e-9;
+    rangeScale = range.isFloatingPoint() ? 1.0f : 1.0e-3f;
+    resolved   = true;
+  }
+};
+/*//}*/
+
 /*//{ class ImageProjection() */
 class ImageProjection : public nodelet::Nodelet {
+protected:
+  // set by the Frontend nodelet, the features are extracted right here instead of in the FeatureExtraction nodelet
+  bool fusedFrontend = false;
+
 private:
-  std::mutex imuLock;
   std::mutex odoLock;
 
   ros::Subscriber subLaserCloud;
@@ -32,41 +116,57 @@ private:
 
   ros::Publisher pubExtractedCloud;
   ros::Publisher pubLaserCloudInfo;
-  ros::Publisher pubOrigCloudInfo;
 
-  ros::Subscriber              subImu;
-  std::deque<sensor_msgs::Imu> imuQueue;
+  // fused frontend only
+  FeatureExtractor                featureExtractor;
+  pcl::PointCloud<PointType>::Ptr cornerCloud;
+  pcl::PointCloud<PointType>::Ptr surfaceCloud;
+  ros::Publisher                  pubFeatureCloudInfo;
+  ros::Publisher                  pubCornerPoints;
+  ros::Publisher                  pubSurfacePoints;
+
+  // written only by imuHandler(), read only by cloudHandler() through imuCursor
+  ros::Subscriber       subImu;
+  liosam::ImuRingBuffer imuBuffer;
+  uint64_t              imuCursor = 0;
 
   ros::Subscriber                subOdom;
   std::deque<nav_msgs::Odometry> odomQueue;
 
   std::shared_ptr<mrs_lib::Transformer> transformer;
 
-  std::deque<sensor_msgs::PointCloud2> cloudQueue;
-  sensor_msgs::PointCloud2             currentCloudMsg;
+  std::deque<sensor_msgs::PointCloud2::ConstPtr> cloudQueue;
+  sensor_msgs::PointCloud2::ConstPtr             currentCloudMsg;
+  CloudLayout                                    cloudLayout;
 
   double *imuTime = new double[queueLength];
   double *imuRotX = new double[queueLength];
   double *imuRotY = new double[queueLength];
   double *imuRotZ = new double[queueLength];
 
-  int             imuPointerCur;
-  bool            firstPointFlag;
-  Eigen::Affine3f transStartInverse;
+  int imuPointerCur;
+
+  // rotations of the points to the scan start, one per deskewTimeResolution bucket of the point time, see buildDeskewTable()
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>> deskewTable;
+  bool                                                                    deskewEnabled;
 
-  pcl::PointCloud<PointXYZIRT>::Ptr laserCloudIn;
-  pcl::PointCloud<PointType>::Ptr   fullCloud;
-  pcl::PointCloud<PointType>::Ptr   extractedCloud;
+  pcl::PointCloud<PointType>::Ptr fullCloud;
+  pcl::PointCloud<PointType>::Ptr extractedCloud;
 
-  int     deskewFlag;
-  cv::Mat rangeMat;
+  int deskewFlag;
+
+  // range image, FLT_MAX marks an empty cell, the occupied cells of each ring are tracked in a bitmap so that resetting and extracting the image
+  // costs only the number of valid points
+  std::vector<float>    rangeImage;
+  std::vector<uint64_t> ringOccupancy;
+  int                   wordsPerRing;
 
   bool  odomDeskewFlag;
   float odomIncreX;
   float odomIncreY;
   float odomIncreZ;
 
-  liosam::cloud_info::Ptr cloudInfo = boost::make_shared<liosam::cloud_info>();
+  liosam::CloudFrame::Ptr cloudInfo = boost::make_shared<liosam::CloudFrame>();
   double                  timeScanCur;
   double                  timeScanEnd;
   std_msgs::Header        cloudHeader;
@@ -75,6 +175,12 @@ private:
   int  scanHeight;
   int  scanWidth;
 
+  // column lookup for unorganized clouds, see buildColumnLookup()
+  std::vector<float> columnBoundaries;
+  std::vector<int>   columnOfBin;
+  std::vector<int>   columnLut;
+  float              columnLutScale;
+
   /*//{ parameters */
 
   std::string uavName;
@@ -86,6 +192,8 @@ private:
 
   // LIDAR
   string timeField;
+  bool   organizedCloud;
+  double deskewTimeResolution;
   int    downsampleRate;
   float  lidarMinRange;
   float  lidarMaxRange;
@@ -135,15 +243,26 @@ public:
     addNamespace(uavName, baselinkFrame);
 
     pl.loadParam("timeField", timeField, std::string("t"));
+    pl.loadParam("organizedCloud", organizedCloud, false);
+    pl.loadParam("deskewTimeResolution", deskewTimeResolution, 1e-4);
     pl.loadParam("downsampleRate", downsampleRate, 1);
     pl.loadParam("lidarMinRange", lidarMinRange, 0.1f);
     pl.loadParam("lidarMaxRange", lidarMaxRange, 1000.0f);
 
+    if (fusedFrontend) {
+      featureExtractor.loadParams(pl);
+    }
+
     if (!pl.loadedSuccessfully()) {
       ROS_ERROR("[ImageProjection]: Could not load all parameters!");
       ros::shutdown();
     }
 
+    if (deskewTimeResolution <= 0.0) {
+      ROS_ERROR("[ImageProjection]: deskewTimeResolution has to be positive!");
+      ros::shutdown();
+    }
+
     /*//}*/
 
     if (imuDeskew) {
@@ -156,8 +275,16 @@ public:
     subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>("cloud_in", 5, &ImageProjection::cloudHandler, this, ros::TransportHints().tcpNoDelay());
 
     pubExtractedCloud = nh.advertise<sensor_msgs::PointCloud2>("liosam/deskew/deskewed_cloud_out", 1);
-    pubLaserCloudInfo = nh.advertise<liosam::cloud_info>("liosam/deskew/deskewed_cloud_info_out", 1);
-    pubOrigCloudInfo = nh.advertise<sensor_msgs::PointCloud2>("liosam/deskew/orig_cloud_info_out", 1);
+    pubLaserCloudInfo = nh.advertise<liosam::CloudFrame>("liosam/deskew/deskewed_cloud_info_out", 1);
+
+    if (fusedFrontend) {
+      cornerCloud.reset(new pcl::PointCloud<PointType>());
+      surfaceCloud.reset(new pcl::PointCloud<PointType>());
+
+      pubFeatureCloudInfo = nh.advertise<liosam::CloudFrame>("liosam/feature/cloud_info_out", 1);
+      pubCornerPoints     = nh.advertise<sensor_msgs::PointCloud2>("liosam/feature/cloud_corner_out", 1);
+      pubSurfacePoints    = nh.advertise<sensor_msgs::PointCloud2>("liosam/feature/cloud_surface_out", 1);
+    }
 
     /* pcl::console::setVerbosityLevel(pcl::console::L_ERROR); */
 
@@ -167,11 +294,15 @@ public:
 
   /*//{ allocateMemory() */
   void allocateMemory() {
-    laserCloudIn.reset(new pcl::PointCloud<PointXYZIRT>());
     fullCloud.reset(new pcl::PointCloud<PointType>());
     extractedCloud.reset(new pcl::PointCloud<PointType>());
 
     fullCloud->points.resize(scanHeight * scanWidth);
+    extractedCloud->reserve(scanHeight * scanWidth);
+
+    rangeImage.assign(scanHeight * scanWidth, FLT_MAX);
+    wordsPerRing = (scanWidth + 63) / 64;
+    ringOccupancy.assign(scanHeight * wordsPerRing, 0);
 
     cloudInfo->startRingIndex.assign(scanHeight, 0);
     cloudInfo->endRingIndex.assign(scanHeight, 0);
@@ -179,39 +310,135 @@ public:
     cloudInfo->pointColInd.assign(scanHeight * scanWidth, 0);
     cloudInfo->pointRange.assign(scanHeight * scanWidth, 0);
 
+    buildColumnLookup();
+
     resetParameters();
   }
   /*//}*/
 
+  /*//{ buildColumnLookup() */
+  // Precomputes the azimuth bins of the range image columns so that unorganized clouds can be projected without atan2 per point.
+  // The bins reproduce columnIdn = -round((atan2(x, y) [deg] - 90) / ang_res_x) + scanWidth / 2 (with wrap-around). Angles are
+  // compared through a pseudo-angle that is monotonic in atan2(), the bin boundaries are found through a uniform lookup table with
+  // at most one boundary per cell.
+  void buildColumnLookup() {
+    const double ang_res_x = 360.0 / double(scanWidth);
+
+    // boundaries between columns lie at horizonAngle = 90 + (k + 0.5) * ang_res_x
+    std::vector<double> boundaryAngles;
+    const int           kMin = int(std::floor(-270.0 / ang_res_x)) - 2;
+    const int           kMax = int(std::ceil(90.0 / ang_res_x)) + 2;
+    for (int k = kMin; k <= kMax; k++) {
+      const double angle = 90.0 + (k + 0.5) * ang_res_x;
+      if (angle > -180.0 && angle <= 180.0) {
+        boundaryAngles.push_back(angle);
+      }
+    }
+
+    columnBoundaries.resize(boundaryAngles.size());
+    for (size_t i = 0; i < boundaryAngles.size(); i++) {
+      const double angle  = boundaryAngles[i] * M_PI / 180.0;
+      columnBoundaries[i] = pseudoAngle(std::sin(angle), std::cos(angle));
+    }
+
+    // column of each bin, evaluated by the original formula in the middle of the bin
+    const int numBins = boundaryAngles.size() + 1;
+    columnOfBin.resize(numBins);
+    for (int i = 0; i < numBins; i++) {
+      const double lower = i == 0 ? -180.0 : boundaryAngles[i - 1];
+      const double upper = i == numBins - 1 ? 180.0 : boundaryAngles[i];
+      int          col   = -round(((lower + upper) / 2.0 - 90.0) / ang_res_x) + scanWidth / 2;
+      if (col >= scanWidth) {
+        col -= scanWidth;
+      }
+      columnOfBin[i] = (col < 0 || col >= scanWidth) ? -1 : col;
+    }
+
+    // the pseudo-angle spans [-2, 2], the narrowest bin is ~pi / scanWidth wide
+    const int numCells = 2 * scanWidth;
+    columnLutScale     = numCells / 4.0f;
+    columnLut.resize(numCells);
+    for (int i = 0; i < numCells; i++) {
+      const float edge = -2.0f + i / columnLutScale;
+      columnLut[i]     = std::upper_bound(columnBoundaries.begin(), columnBoundaries.end(), edge) - columnBoundaries.begin();
+    }
+  }
+  /*//}*/
+
+  /*//{ pseudoAngle() */
+  // monotonic in atan2(y, x) on (-pi, pi], maps to (-2, 2]
+  static inline float pseudoAngle(const float y, const float x) {
+    const float sum = std::abs(x) + std::abs(y);
+    if (sum == 0.0f) {
+      return 0.0f;
+    }
+    const float ratio = y / sum;
+    if (x >= 0.0f) {
+      return ratio;
+    }
+    return y >= 0.0f ? 2.0f - ratio : -2.0f - ratio;
+  }
+  /*//}*/
+
+  /*//{ lookupColumn() */
+  inline int lookupColumn(const float x, const float y) const {
+    const float p    = pseudoAngle(x, y);
+    const int   cell = std::min(std::max(int((p + 2.0f) * columnLutScale), 0), int(columnLut.size()) - 1);
+
+    size_t bin = columnLut[cell];
+    while (bin < columnBoundaries.size() && columnBoundaries[bin] <= p) {
+      bin++;
+    }
+    return columnOfBin[bin];
+  }
+  /*//}*/
+
   /*//{ resetParameters() */
   void resetParameters() {
-    laserCloudIn->clear();
-    extractedCloud->clear();
-    // reset range matrix for range image projection
-    rangeMat = cv::Mat(scanHeight, scanWidth, CV_32F, cv::Scalar::all(FLT_MAX));
+    // reset only the occupied cells of the range image
+    for (int i = 0; i < scanHeight; ++i) {
+      uint64_t *words = &ringOccupancy[i * wordsPerRing];
+      for (int w = 0; w < wordsPerRing; ++w) {
+        for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+          rangeImage[i * scanWidth + w * 64 + __builtin_ctzll(bits)] = FLT_MAX;
+        }
+        words[w] = 0;
+      }
+    }
 
+    // the imu arrays are overwritten up to imuPointerCur in imuDeskewInfo()
     imuPointerCur  = 0;
-    firstPointFlag = true;
+    deskewEnabled  = false;
     odomDeskewFlag = false;
+  }
+  /*//}*/
 
-    for (int i = 0; i < queueLength; ++i) {
-      imuTime[i] = 0;
-      imuRotX[i] = 0;
-      imuRotY[i] = 0;
-      imuRotZ[i] = 0;
+  /*//{ prepareFrame() */
+  // The published frame and its cloud are shared with the subscribers in the same process and must not change anymore. They are reused only when
+  // nobody holds them, otherwise new ones are allocated.
+  void prepareFrame() {
+    if (cloudInfo.use_count() > 1) {
+      cloudInfo = boost::make_shared<liosam::CloudFrame>(*cloudInfo);
+    } else {
+      cloudInfo->invalidateMsg();
     }
+
+    cloudInfo->cloudDeskewed.reset();
+    if (extractedCloud.use_count() > 1) {
+      extractedCloud.reset(new pcl::PointCloud<PointType>());
+      extractedCloud->reserve(scanHeight * scanWidth);
+    }
+    extractedCloud->clear();
   }
   /*//}*/
 
   /*//{ imuHandler() */
   void imuHandler(const sensor_msgs::Imu::ConstPtr &imuMsg) {
-    const sensor_msgs::Imu thisImu = imuConverter(*imuMsg, extRot, extQRPY, imuProvidesOrientation);
-
     ROS_INFO_ONCE("[ImageProjection]: imuHandler first callback");
 
-    std::lock_guard<std::mutex> lock1(imuLock);
-    imuQueue.push_back(thisImu);
-
+    if (!imuBuffer.push(imuSampleConverter(*imuMsg, extRot, extQRPY, imuProvidesOrientation))) {
+      ROS_WARN_THROTTLE(1.0, "[ImageProjection]: Dropping IMU message with non-increasing timestamp %0.4f", imuMsg->header.stamp.toSec());
+    }
   }
   /*//}*/
 
@@ -242,6 +469,8 @@ public:
       return;
     }
 
+    prepareFrame();
+
     if (!deskewInfo()) {
       return;
     }
@@ -252,67 +481,76 @@ public:
 
     publishClouds();
 
+    if (fusedFrontend) {
+      extractFeatures();
+    }
+
     resetParameters();
   }
   /*//}*/
 
   /*//{ cachePointCloud() */
   bool cachePointCloud(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg) {
-    // cache point cloud
-    cloudQueue.push_back(*laserCloudMsg);
+    // cache point cloud (only the shared pointer, the message buffer itself is never copied)
+    cloudQueue.push_back(laserCloudMsg);
     if (cloudQueue.size() <= 2) {
       return false;
     }
 
-    // convert cloud
     // why front of queue? this causes always the oldest point cloud to be processed i.e. delay of 200 ms?
     /* currentCloudMsg = std::move(cloudQueue.front()); */
     /* cloudQueue.pop_front(); */
     currentCloudMsg = std::move(cloudQueue.back());
     cloudQueue.pop_back();
-    pcl::fromROSMsg(currentCloudMsg, *laserCloudIn);
 
     // get timestamp
-    cloudHeader = currentCloudMsg.header;
+    cloudHeader = currentCloudMsg->header;
     timeScanCur = cloudHeader.stamp.toSec();
-    /* timeScanEnd = timeScanCur + laserCloudIn->points.back().time; // Velodyne */
-    /* timeScanEnd = timeScanCur + (float)laserCloudIn->points.back().t / 1.0e9;  // Ouster */
-    timeScanEnd = timeScanCur;  // sim
-
-    // check dense flag
-    if (!laserCloudIn->is_dense) {
-      removeNaNFromPointCloud(laserCloudIn, laserCloudIn);
-      /* ROS_ERROR("Point cloud is not in dense format, please remove NaN points first!"); */
-      /* ros::shutdown(); */
-    }
-
-    // check ring channel
-    static int ringFlag = 0;
-    if (ringFlag == 0) {
-      ringFlag = -1;
-      for (auto &field : currentCloudMsg.fields) {
-        if (field.name == "ring") {
-          ringFlag = 1;
-          break;
-        }
+
+    // resolve field offsets once, they do not change between scans
+    if (!cloudLayout.resolved) {
+      cloudLayout.resolve(*currentCloudMsg, timeField);
+
+      if (organizedCloud && (int(currentCloudMsg->height) != scanHeight || int(currentCloudMsg->width) != scanWidth || scanHeight == 1)) {
+        ROS_ERROR("[ImageProjection]: organizedCloud is set, but the point cloud is not organized as %d x %d!", scanHeight, scanWidth);
+        ros::shutdown();
+      }
+
+      if (currentCloudMsg->is_bigendian) {
+        ROS_ERROR("[ImageProjection]: Big endian point clouds are not supported!");
+        ros::shutdown();
+      }
+
+      if (!cloudLayout.x.available || !cloudLayout.y.available || !cloudLayout.z.available) {
+        ROS_ERROR("[ImageProjection]: Point cloud x/y/z channels not available, please configure your point cloud data!");
+        ros::shutdown();
       }
-      if (ringFlag == -1) {
+
+      // check ring channel
+      if (!organizedCloud && !cloudLayout.ring.available) {
         ROS_ERROR("Point cloud ring channel not available, please configure your point cloud data!");
         ros::shutdown();
       }
-    }
 
-    // check point time
-    if (deskewFlag == 0) {
-      deskewFlag = -1;
-      for (auto &field : currentCloudMsg.fields) {
-        if (field.name == timeField) {
-          deskewFlag = 1;
-          break;
-        }
+      if (!cloudLayout.range.available) {
+        ROS_WARN("[ImageProjection]: Point cloud range channel not available, range will be computed from x/y/z.");
       }
-      if (deskewFlag == -1)
+
+      // check point time
+      if (cloudLayout.time.available) {
+        deskewFlag = 1;
+      } else {
+        deskewFlag = -1;
         ROS_WARN("Point cloud timestamp not available, deskew function disabled, system will drift significantly!");
+      }
+    }
+
+    // the scan ends at the time of its last point, the IMU data have to cover the whole scan when deskewing
+    timeScanEnd = timeScanCur;
+    if (imuDeskew && deskewFlag == 1 && currentCloudMsg->width > 0 && currentCloudMsg->height > 0) {
+      const uint8_t *lastPoint =
+          currentCloudMsg->data.data() + (currentCloudMsg->height - 1) * currentCloudMsg->row_step + (currentCloudMsg->width - 1) * currentCloudMsg->point_step;
+      timeScanEnd += std::max(cloudLayout.time.read<double>(lastPoint) * cloudLayout.timeScale, 0.0);
     }
 
     return true;
@@ -323,18 +561,19 @@ public:
   bool deskewInfo() {
 
     if (imuDeskew) {
-      std::lock_guard<std::mutex> lock1(imuLock);
+      imuBuffer.clampCursor(imuCursor);
+      const uint64_t imuEnd = imuBuffer.end();
 
       // make sure IMU data available for the scan
-      if (imuQueue.empty() || imuQueue.front().header.stamp.toSec() > timeScanCur || imuQueue.back().header.stamp.toSec() < timeScanEnd) {
-        if (imuQueue.empty()) {
+      ImuSample imuFront, imuBack;
+      if (imuCursor >= imuEnd || !imuBuffer.read(imuCursor, imuFront) || !imuBuffer.read(imuEnd - 1, imuBack) || imuFront.t > timeScanCur ||
+          imuBack.t < timeScanEnd) {
+        if (imuCursor >= imuEnd) {
           ROS_WARN("[ImageProjection]: Waiting for IMU data ... imu queue is empty");
-        } else if (imuQueue.front().header.stamp.toSec() > timeScanCur) {
-          ROS_WARN("[ImageProjection]: Waiting for IMU data ... imu msg time (%0.2f) > time scan cur (%0.2f)", imuQueue.back().header.stamp.toSec(),
-                   timeScanCur);
-        } else if (imuQueue.back().header.stamp.toSec() < timeScanEnd) {
-          ROS_WARN("[ImageProjection]: Waiting for IMU data ... imu msg time (%0.2f) < time scan end time (%0.2f)", imuQueue.back().header.stamp.toSec(),
-                   timeScanEnd);
+        } else if (imuFront.t > timeScanCur) {
+          ROS_WARN("[ImageProjection]: Waiting for IMU data ... imu msg time (%0.2f) > time scan cur (%0.2f)", imuFront.t, timeScanCur);
+        } else if (imuBack.t < timeScanEnd) {
+          ROS_WARN("[ImageProjection]: Waiting for IMU data ... imu msg time (%0.2f) < time scan end time (%0.2f)", imuBack.t, timeScanEnd);
         }
         return false;
       }
@@ -352,27 +591,26 @@ public:
   void imuDeskewInfo() {
     cloudInfo->imuAvailable = false;
 
-    while (!imuQueue.empty()) {
-      if (imuQueue.front().header.stamp.toSec() < timeScanCur - 0.01) {
-        imuQueue.pop_front();
-      } else {
-        break;
-      }
-    }
+    // skip the samples older than the scan
+    const uint64_t imuEnd = imuBuffer.end();
+    imuCursor             = imuBuffer.lowerBound(timeScanCur - 0.01, imuCursor, imuEnd);
 
-    if (imuQueue.empty()) {
+    if (imuCursor >= imuEnd) {
       return;
     }
 
     imuPointerCur = 0;
 
-    for (int i = 0; i < (int)imuQueue.size(); ++i) {
-      sensor_msgs::Imu thisImuMsg     = imuQueue[i];
-      const double     currentImuTime = thisImuMsg.header.stamp.toSec();
+    ImuSample thisImu;
+    for (uint64_t i = imuCursor; i < imuEnd && imuPointerCur < queueLength; ++i) {
+      if (!imuBuffer.read(i, thisImu)) {
+        continue;
+      }
+      const double currentImuTime = thisImu.t;
 
       // get roll, pitch, and yaw estimation for this scan
       if (currentImuTime <= timeScanCur) {
-        imuRPY2rosRPY(&thisImuMsg, &cloudInfo->imuRollInit, &cloudInfo->imuPitchInit, &cloudInfo->imuYawInit);
+        imuRPY2rosRPY(thisImu, &cloudInfo->imuRollInit, &cloudInfo->imuPitchInit, &cloudInfo->imuYawInit);
       }
 
       if (currentImuTime > timeScanEnd + 0.01) {
@@ -390,7 +628,7 @@ public:
 
       // get angular velocity
       double angular_x, angular_y, angular_z;
-      imuAngular2rosAngular(&thisImuMsg, &angular_x, &angular_y, &angular_z);
+      imuAngular2rosAngular(thisImu, &angular_x, &angular_y, &angular_z);
 
       // integrate rotation
       const double timeDiff  = currentImuTime - imuTime[imuPointerCur - 1];
@@ -503,12 +741,12 @@ public:
   /*//}*/
 
   /*//{ findRotation() */
-  void findRotation(double pointTime, float *rotXCur, float *rotYCur, float *rotZCur) {
+  // imuPointerFront is the search cursor, it only moves forward, so the queries have to come in increasing pointTime
+  void findRotation(double pointTime, int &imuPointerFront, float *rotXCur, float *rotYCur, float *rotZCur) {
     *rotXCur = 0;
     *rotYCur = 0;
     *rotZCur = 0;
 
-    int imuPointerFront = 0;
     while (imuPointerFront < imuPointerCur) {
       if (pointTime < imuTime[imuPointerFront]) {
         break;
@@ -550,115 +788,141 @@ public:
   }
   /*//}*/
 
-  /*//{ deskewPoint() */
-  PointType deskewPoint(PointType *point, double relTime) {
-    if (deskewFlag == -1 || cloudInfo->imuAvailable == false) {
-      return *point;
+  /*//{ buildDeskewTable() */
+  // Points fired at the same time share their deskew transformation (e.g., a whole Ouster column), so instead of looking up the IMU rotation per
+  // point, the scan duration is split into buckets of deskewTimeResolution and one transformation is precomputed for each of them.
+  void buildDeskewTable() {
+    deskewEnabled = imuDeskew && deskewFlag == 1 && cloudInfo->imuAvailable;
+    if (!deskewEnabled) {
+      return;
     }
 
-    const double pointTime = timeScanCur + relTime;
+    // bound the table in case of corrupted point times
+    const double scanDuration = std::min(std::max(timeScanEnd - timeScanCur, 0.0), 1.0);
+    const int    numBuckets   = int(scanDuration / deskewTimeResolution) + 1;
+    deskewTable.resize(numBuckets);
 
+    int   imuPointerFront = 0;
     float rotXCur, rotYCur, rotZCur;
-    findRotation(pointTime, &rotXCur, &rotYCur, &rotZCur);  // petrlmat: from imu only
-
     float posXCur, posYCur, posZCur;
-    findPosition(relTime, &posXCur, &posYCur, &posZCur);  // petrlmat: not used, always zero position
 
-    if (firstPointFlag == true) {
-      transStartInverse = (pcl::getTransformation(posXCur, posYCur, posZCur, rotXCur, rotYCur, rotZCur)).inverse();
-      firstPointFlag    = false;
+    findRotation(timeScanCur, imuPointerFront, &rotXCur, &rotYCur, &rotZCur);
+    findPosition(0.0, &posXCur, &posYCur, &posZCur);
+    const Eigen::Affine3f transStartInverse = (pcl::getTransformation(posXCur, posYCur, posZCur, rotXCur, rotYCur, rotZCur)).inverse();
+
+    for (int i = 0; i < numBuckets; i++) {
+      // evaluated in the middle of the bucket
+      const double relTime = (i + 0.5) * deskewTimeResolution;
+
+      findRotation(timeScanCur + relTime, imuPointerFront, &rotXCur, &rotYCur, &rotZCur);  // petrlmat: from imu only
+      findPosition(relTime, &posXCur, &posYCur, &posZCur);                                // petrlmat: not used, always zero position
+
+      // transform points to start
+      const Eigen::Affine3f transFinal = pcl::getTransformation(posXCur, posYCur, posZCur, rotXCur, rotYCur, rotZCur);
+      deskewTable[i]                   = (transStartInverse * transFinal).matrix();
     }
+  }
+  /*//}*/
 
-    // transform points to start
-    const Eigen::Affine3f transFinal = pcl::getTransformation(posXCur, posYCur, posZCur, rotXCur, rotYCur, rotZCur);
-    const Eigen::Affine3f transBt    = transStartInverse * transFinal;
+  /*//{ deskewPoint() */
+  inline void deskewPoint(PointType &point, const double relTime) const {
+    const int bucket = std::min(std::max(int(relTime / deskewTimeResolution), 0), int(deskewTable.size()) - 1);
 
-    PointType newPoint;
-    newPoint.x         = transBt(0, 0) * point->x + transBt(0, 1) * point->y + transBt(0, 2) * point->z + transBt(0, 3);
-    newPoint.y         = transBt(1, 0) * point->x + transBt(1, 1) * point->y + transBt(1, 2) * point->z + transBt(1, 3);
-    newPoint.z         = transBt(2, 0) * point->x + transBt(2, 1) * point->y + transBt(2, 2) * point->z + transBt(2, 3);
-    newPoint.intensity = point->intensity;
+    // homogeneous 4x4 product, vectorized by Eigen
+    const Eigen::Vector4f deskewed = deskewTable[bucket] * Eigen::Vector4f(point.x, point.y, point.z, 1.0f);
 
-    return newPoint;
+    point.x = deskewed.x();
+    point.y = deskewed.y();
+    point.z = deskewed.z();
   }
   /*//}*/
 
   /*//{ projectPointCloud() */
-  // petrlmat: this functions only copies points from one point cloud to another (of another type) when deskewing is disabled (default so far) - potential
-  // performance gain if we get rid of the copy
+  // reads the points straight from the PointCloud2 byte buffer and writes them into the range image and fullCloud
   void projectPointCloud() {
+    const sensor_msgs::PointCloud2 &msg      = *currentCloudMsg;
+    const bool                      checkNaN = !msg.is_dense;
+
+    buildDeskewTable();
+
     // range image projection
-    const unsigned int cloudSize = laserCloudIn->points.size();
-    for (unsigned int i = 0; i < cloudSize; i++) {
-      /* ROS_WARN("(%d, %d) - xyz: (%0.2f, %0.2f, %0.2f), ring: %d", j, rowIdn, laserCloudIn->at(j, rowIdn).x, laserCloudIn->at(j, rowIdn).y, */
-      /*          laserCloudIn->at(j, rowIdn).z, laserCloudIn->at(j, rowIdn).ring); */
-
-      /* const float range = pointDistance(thisPoint); */
-      const float range = laserCloudIn->points.at(i).range / 1000.0f;
-      if (range < lidarMinRange || range > lidarMaxRange) {
-        continue;
-      }
+    for (uint32_t row = 0; row < msg.height; row++) {
+      const uint8_t *rowData = msg.data.data() + row * msg.row_step;
 
-      const int rowIdn = laserCloudIn->points.at(i).ring;
-      if (rowIdn < 0 || rowIdn >= scanHeight) {
-        /* ROS_ERROR("Invalid ring: %d", rowIdn); */
-        continue;
-      }
+      for (uint32_t col = 0; col < msg.width; col++) {
+        const uint8_t *pointData = rowData + col * msg.point_step;
 
-      if (rowIdn % downsampleRate != 0) {
-        /* ROS_ERROR("Downsampling. Throwing away row: %d", rowIdn); */
-        continue;
-      }
+        PointType thisPoint;
+        thisPoint.x         = cloudLayout.x.read<float>(pointData);
+        thisPoint.y         = cloudLayout.y.read<float>(pointData);
+        thisPoint.z         = cloudLayout.z.read<float>(pointData);
+        thisPoint.intensity = cloudLayout.intensity.available ? cloudLayout.intensity.read<float>(pointData) : 0.0f;
 
-      PointType thisPoint;
-      thisPoint.x         = laserCloudIn->points.at(i).x;
-      thisPoint.y         = laserCloudIn->points.at(i).y;
-      thisPoint.z         = laserCloudIn->points.at(i).z;
-      thisPoint.intensity = laserCloudIn->points.at(i).intensity;
-
-      // TODO: polish this monstrosity
-      const float  horizonAngle = atan2(thisPoint.x, thisPoint.y) * 180 / M_PI;
-      static float ang_res_x    = 360.0 / float(scanWidth);
-      int          columnIdn    = -round((horizonAngle - 90.0) / ang_res_x) + scanWidth / 2;
-      if (columnIdn >= scanWidth) {
-        columnIdn -= scanWidth;
-      }
+        if (checkNaN && (!std::isfinite(thisPoint.x) || !std::isfinite(thisPoint.y) || !std::isfinite(thisPoint.z))) {
+          continue;
+        }
 
-      if (columnIdn < 0 || columnIdn >= scanWidth) {
-        continue;
-      }
+        const float range =
+            cloudLayout.range.available ? cloudLayout.range.read<float>(pointData) * cloudLayout.rangeScale : pointDistance(thisPoint);
+        if (range < lidarMinRange || range > lidarMaxRange) {
+          continue;
+        }
 
-      if (rangeMat.at<float>(rowIdn, columnIdn) != FLT_MAX) {
-        continue;
-      }
+        // organized clouds encode (ring, column) in the point position
+        const int rowIdn = organizedCloud ? int(row) : cloudLayout.ring.read<int>(pointData);
+        if (rowIdn < 0 || rowIdn >= scanHeight) {
+          /* ROS_ERROR("Invalid ring: %d", rowIdn); */
+          continue;
+        }
+
+        if (rowIdn % downsampleRate != 0) {
+          /* ROS_ERROR("Downsampling. Throwing away row: %d", rowIdn); */
+          continue;
+        }
+
+        const int columnIdn = organizedCloud ? int(col) : lookupColumn(thisPoint.x, thisPoint.y);
+        if (columnIdn < 0 || columnIdn >= scanWidth) {
+          continue;
+        }
 
-      // petrlmat: so far, we were using liosam without deskewing
-      /* thisPoint = deskewPoint(&thisPoint, laserCloudIn->at(j, rowIdn).time); // Velodyne */
-      /* thisPoint = deskewPoint(&thisPoint, (float)laserCloudIn->at(j, rowIdn).t / 1000000000.0);  // Ouster */
+        const int index = columnIdn + rowIdn * scanWidth;
+        if (rangeImage[index] != FLT_MAX) {
+          continue;
+        }
 
-      rangeMat.at<float>(rowIdn, columnIdn) = range;
+        if (deskewEnabled) {
+          deskewPoint(thisPoint, cloudLayout.time.read<double>(pointData) * cloudLayout.timeScale);
+        }
 
-      const int index          = columnIdn + rowIdn * scanWidth;
-      fullCloud->points[index] = thisPoint;
+        rangeImage[index] = range;
+        ringOccupancy[rowIdn * wordsPerRing + (columnIdn >> 6)] |= uint64_t(1) << (columnIdn & 63);
+
+        fullCloud->points[index] = thisPoint;
+      }
     }
   }
   /*//}*/
 
   /*//{ cloudExtraction() */
   void cloudExtraction() {
+    // no reallocation, the capacity is kept from the previous scans
+    cloudInfo->pointColInd.resize(scanHeight * scanWidth);
+    cloudInfo->pointRange.resize(scanHeight * scanWidth);
+
     int count = 0;
     // extract segmented cloud for lidar odometry
     for (int i = 0; i < scanHeight; ++i) {
       cloudInfo->startRingIndex[i] = count - 1 + 5;
 
-      for (int j = 0; j < scanWidth; ++j) {
-        /* ROS_WARN("i: %d, j: %d, rangeMat: %0.10f, isFltMax: %d", i, j, rangeMat.at<float>(i,j), rangeMat.at<float>(i,j) == FLT_MAX); */
-        if (rangeMat.at<float>(i, j) != FLT_MAX) {
-          /* ROS_WARN("i: %d, j: %d, rangeMat: %0.10f, isFltMax: %d", i, j, rangeMat.at<float>(i,j), rangeMat.at<float>(i,j) == FLT_MAX); */
+      // visit the occupied cells in increasing column order
+      const uint64_t *words = &ringOccupancy[i * wordsPerRing];
+      for (int w = 0; w < wordsPerRing; ++w) {
+        for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+          const int j = w * 64 + __builtin_ctzll(bits);
           // mark the points' column index for marking occlusion later
           cloudInfo->pointColInd[count] = j;
           // save range info
-          cloudInfo->pointRange[count] = rangeMat.at<float>(i, j);
+          cloudInfo->pointRange[count] = rangeImage[j + i * scanWidth];
           // save extracted cloud
           extractedCloud->push_back(fullCloud->points[j + i * scanWidth]);
           // size of extracted cloud
@@ -667,26 +931,22 @@ public:
       }
       cloudInfo->endRingIndex[i] = count - 1 - 5;
     }
+
+    // only the extracted points are passed on
+    cloudInfo->pointColInd.resize(count);
+    cloudInfo->pointRange.resize(count);
   }
   /*//}*/
 
   /*//{ publishClouds() */
   void publishClouds() {
-    cloudInfo->header         = cloudHeader;
-    cloudInfo->cloud_deskewed = publishCloud(&pubExtractedCloud, extractedCloud, cloudHeader.stamp, lidarFrame);
-    try {
-      pubLaserCloudInfo.publish(cloudInfo);
+    cloudInfo->header        = cloudHeader;
+    cloudInfo->cloudDeskewed = extractedCloud;
+    if (pubExtractedCloud.getNumSubscribers() > 0) {
+      publishCloud(&pubExtractedCloud, extractedCloud, cloudHeader.stamp, lidarFrame);
     }
-    catch (...) {
-      ROS_ERROR("[ImageProjection]: Exception caught during publishing topic %s.", pubLaserCloudInfo.getTopic().c_str());
-    }
-    
-    sensor_msgs::PointCloud2 cloudInfoOrig;
-    cloudInfoOrig.header = cloudHeader;
-    cloudInfoOrig.height = scanHeight;
-    cloudInfoOrig.width = scanWidth;
     try {
-      pubOrigCloudInfo.publish(cloudInfoOrig);
+      pubLaserCloudInfo.publish(cloudInfo);
     }
     catch (...) {
       ROS_ERROR("[ImageProjection]: Exception caught during publishing topic %s.", pubLaserCloudInfo.getTopic().c_str());
@@ -694,38 +954,52 @@ public:
   }
   /*//}*/
 
-  /*//{ removeNaNFromPointCloud() */
-  void removeNaNFromPointCloud(const pcl::PointCloud<PointXYZIRT>::Ptr &cloud_in, pcl::PointCloud<PointXYZIRT>::Ptr &cloud_out) {
-
-    if (cloud_in->is_dense) {
-      cloud_out = cloud_in;
-      return;
+  /*//{ extractFeatures() */
+  // fused frontend, works on the frame that was just built, without passing it through a topic
+  void extractFeatures() {
+    // the previous feature clouds may still be used by the subscribers of the published frame
+    if (cornerCloud.use_count() > 1) {
+      cornerCloud.reset(new pcl::PointCloud<PointType>());
+    }
+    if (surfaceCloud.use_count() > 1) {
+      surfaceCloud.reset(new pcl::PointCloud<PointType>());
     }
 
-    unsigned int k = 0;
-
-    cloud_out->resize(cloud_in->size());
-
-    for (unsigned int i = 0; i < cloud_in->size(); i++) {
+    featureExtractor.extract(*cloudInfo, *cornerCloud, *surfaceCloud);
 
-      if (std::isfinite(cloud_in->at(i).x) && std::isfinite(cloud_in->at(i).y) && std::isfinite(cloud_in->at(i).z)) {
-        cloud_out->at(k++) = cloud_in->at(i);
-      }
+    if (pubCornerPoints.getNumSubscribers() > 0) {
+      publishCloud(&pubCornerPoints, cornerCloud, cloudHeader.stamp, lidarFrame);
+    }
+    if (pubSurfacePoints.getNumSubscribers() > 0) {
+      publishCloud(&pubSurfacePoints, surfaceCloud, cloudHeader.stamp, lidarFrame);
     }
 
-    cloud_out->header   = cloud_in->header;
-    cloud_out->is_dense = true;
-
-    if (cloud_in->size() != k) {
-      cloud_out->resize(k);
+    try {
+      pubFeatureCloudInfo.publish(FeatureExtractor::featureFrame(*cloudInfo, cornerCloud, surfaceCloud));
+    }
+    catch (...) {
+      ROS_ERROR("[ImageProjection]: Exception caught during publishing topic %s.", pubFeatureCloudInfo.getTopic().c_str());
     }
   }
   /*//}*/
 };
 /*//}*/
 
+/*//{ class Frontend() */
+// ImageProjection and FeatureExtraction in a single nodelet: projection, smoothness, occlusion marking and feature selection run in one callback on
+// the same buffers. Publishes the topics of both nodelets, the split layout stays available for debugging.
+class Frontend : public ImageProjection {
+public:
+  virtual void onInit() override {
+    fusedFrontend = true;
+    ImageProjection::onInit();
+  }
+};
+/*//}*/
+
 }  // namespace image_projection
 }  // namespace liosam
 
 #include <pluginlib/class_list_macros.h>
 PLUGINLIB_EXPORT_CLASS(liosam::image_projection::ImageProjection, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(liosam::image_projection::Frontend, nodelet::Nodelet)
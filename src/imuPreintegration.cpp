@@ -86,8 +86,11 @@ namespace liosam
       gtsam::PreintegratedImuMeasurements* imuIntegratorOpt_;
       gtsam::PreintegratedImuMeasurements* imuIntegratorPredict_;
 
-      std::deque<sensor_msgs::Imu> imuQueOpt;
-      std::deque<sensor_msgs::Imu> imuQuePredict;
+      // written by imuHandler(), the optimization and the prediction read it through their own cursors
+      liosam::ImuRingBuffer imuBuffer;
+      uint64_t imuOptCursor = 0;      // first sample not yet integrated by imuIntegratorOpt_
+      uint64_t imuPredictCursor = 0;  // first sample after the last correction
+      uint64_t imuPredictEnd = 0;     // first sample not yet integrated by imuIntegratorPredict_
 
       gtsam::Pose3 prevPose_;
       gtsam::Vector3 prevLinVel_;
@@ -230,7 +233,11 @@ namespace liosam
         const double currentCorrectionTime = ROS_TIME(odomMsg);
 
         // make sure we have imu data to integrate
-        if (imuQueOpt.empty())
+        if (!imuBuffer.clampCursor(imuOptCursor))
+        {
+          ROS_WARN("[ImuPreintegration]: IMU buffer overflow, some IMU measurements were not integrated!");
+        }
+        if (imuOptCursor >= imuBuffer.end())
         {
           return;
         }
@@ -251,18 +258,14 @@ namespace liosam
         {
           resetOptimization();
 
-          // pop old IMU message
-          while (!imuQueOpt.empty())
+          // skip old IMU message
+          const uint64_t firstImu = imuBuffer.lowerBound(currentCorrectionTime - delta_t, imuOptCursor, imuBuffer.end());
+          ImuSample lastImu;
+          if (firstImu > imuOptCursor && imuBuffer.read(firstImu - 1, lastImu))
           {
-            if (ROS_TIME(&imuQueOpt.front()) < currentCorrectionTime - delta_t)
-            {
-              lastImuT_opt = ROS_TIME(&imuQueOpt.front());
-              imuQueOpt.pop_front();
-            } else
-            {
-              break;
-            }
+            lastImuT_opt = lastImu.t;
           }
+          imuOptCursor = firstImu;
 
           // initial pose
           prevPose_ = lidarPose.compose(lidar2Imu);
@@ -349,11 +352,16 @@ namespace liosam
 
         bool      isImuIntegrated = false;
         // 1. integrate imu data and optimize
-        while (!imuQueOpt.empty())
+        const uint64_t imuOptEnd = imuBuffer.end();
+        ImuSample thisImu;
+        for (; imuOptCursor < imuOptEnd; ++imuOptCursor)
         {
-          // pop and integrate imu data that is between two optimizations
-          const sensor_msgs::Imu* thisImu = &imuQueOpt.front();
-          const double imuTime = ROS_TIME(thisImu);
+          // integrate imu data that is between two optimizations
+          if (!imuBuffer.read(imuOptCursor, thisImu))
+          {
+            continue;
+          }
+          const double imuTime = thisImu.t;
           if (imuTime < currentCorrectionTime - delta_t)
           {
             const double dt = (lastImuT_opt < 0) ? (1.0 / 500.0) : (imuTime - lastImuT_opt);
@@ -361,15 +369,13 @@ namespace liosam
             if (dt <= 0)
             {
               ROS_WARN_COND(dt < 0, "invalid dt (opt): (%0.2f - %0.2f) = %0.2f", imuTime, lastImuT_opt, dt);
-              imuQueOpt.pop_front();
               continue;
             }
 
-          imuIntegratorOpt_->integrateMeasurement(gtsam::Vector3(thisImu->linear_acceleration.x, thisImu->linear_acceleration.y, thisImu->linear_acceleration.z), 
-              gtsam::Vector3(thisImu->angular_velocity.x, thisImu->angular_velocity.y, thisImu->angular_velocity.z), dt);
+          imuIntegratorOpt_->integrateMeasurement(gtsam::Vector3(thisImu.acc[0], thisImu.acc[1], thisImu.acc[2]), 
+              gtsam::Vector3(thisImu.gyr[0], thisImu.gyr[1], thisImu.gyr[2]), dt);
 
             lastImuT_opt = imuTime;
-            imuQueOpt.pop_front();
             isImuIntegrated = true;
           } else
           {
@@ -449,25 +455,31 @@ namespace liosam
         prevStateOdom_ = prevState_;
         prevBiasOdom_ = prevBias_;
 
-        // first pop imu message older than current correction data
+        // first skip imu message older than current correction data
         double lastImuQT = -1;
-        while (!imuQuePredict.empty() && ROS_TIME(&imuQuePredict.front()) < currentCorrectionTime - delta_t)
+        const uint64_t imuEnd = imuBuffer.end();
+        imuBuffer.clampCursor(imuPredictCursor);
+        const uint64_t firstImu = imuBuffer.lowerBound(currentCorrectionTime - delta_t, imuPredictCursor, imuEnd);
+        if (firstImu > imuPredictCursor && imuBuffer.read(firstImu - 1, thisImu))
         {
-          lastImuQT = ROS_TIME(&imuQuePredict.front());
-          imuQuePredict.pop_front();
+          lastImuQT = thisImu.t;
         }
+        imuPredictCursor = firstImu;
 
         // repropogate
-        if (!imuQuePredict.empty())
+        if (imuPredictCursor < imuEnd)
         {
           // reset bias use the newly optimized bias
           imuIntegratorPredict_->resetIntegrationAndSetBias(prevBiasOdom_);
 
           // integrate imu message from the beginning of this optimization
-          for (int i = 0; i < (int)imuQuePredict.size(); ++i)
+          for (uint64_t i = imuPredictCursor; i < imuEnd; ++i)
           {
-            sensor_msgs::Imu* thisImu = &imuQuePredict[i];
-            const double imuTime = ROS_TIME(thisImu);
+            if (!imuBuffer.read(i, thisImu))
+            {
+              continue;
+            }
+            const double imuTime = thisImu.t;
             const double dt = (lastImuQT < 0) ? (1.0 / 500.0) : (imuTime - lastImuQT);
 
             if (dt <= 0)
@@ -476,10 +488,17 @@ namespace liosam
               continue;
             }
 
-            imuIntegratorPredict_->integrateMeasurement(gtsam::Vector3(thisImu->linear_acceleration.x, thisImu->linear_acceleration.y, thisImu->linear_acceleration.z),
-                                                  gtsam::Vector3(thisImu->angular_velocity.x, thisImu->angular_velocity.y, thisImu->angular_velocity.z), dt);
+            imuIntegratorPredict_->integrateMeasurement(gtsam::Vector3(thisImu.acc[0], thisImu.acc[1], thisImu.acc[2]),
+                                                  gtsam::Vector3(thisImu.gyr[0], thisImu.gyr[1], thisImu.gyr[2]), dt);
             lastImuQT = imuTime;
           }
+
+          // imuHandler() continues from here
+          imuPredictEnd = imuEnd;
+          if (lastImuQT > 0)
+          {
+            lastImuT_predict = lastImuQT;
+          }
         }
 
         geometry_msgs::Vector3Stamped lin_acc_bias_msg;
@@ -534,12 +553,15 @@ namespace liosam
         }
 
         ROS_INFO_ONCE("[ImuPreintegration]: imuHandler first callback");
-        std::lock_guard<std::mutex> lock(mtx);
 
-        const sensor_msgs::Imu thisImu = imuConverter(*msg_in, extRot, extQRPY, imuProvidesOrientation);
+        // the buffer does not need the lock, this is its only writer
+        if (!imuBuffer.push(imuSampleConverter(*msg_in, extRot, extQRPY, imuProvidesOrientation)))
+        {
+          ROS_WARN_THROTTLE(1.0, "[ImuPreintegration]: Dropping IMU message with non-increasing timestamp %0.4f", ROS_TIME(msg_in));
+          return;
+        }
 
-        imuQueOpt.push_back(thisImu);
-        imuQuePredict.push_back(thisImu);
+        std::lock_guard<std::mutex> lock(mtx);
 
         if (doneFirstOpt == false)
         {
@@ -547,18 +569,35 @@ namespace liosam
           return;
         }
 
-        const double imuTime = ROS_TIME(msg_in);
-        const double dt = (lastImuT_predict < 0) ? (1.0 / 500.0) : (imuTime - lastImuT_predict);
-        if (dt <= 0)
+        // integrate the new imu messages, odometryHandler() may have integrated this one already while re-propagating
+        const uint64_t imuEnd = imuBuffer.end();
+        imuBuffer.clampCursor(imuPredictEnd);
+        ImuSample thisImu;
+        bool isImuIntegrated = false;
+        for (; imuPredictEnd < imuEnd; ++imuPredictEnd)
         {
-          ROS_WARN_COND(dt < 0, "invalid dt (imu): (%0.2f - %0.2f) = %0.2f", imuTime, lastImuT_predict, dt);
-          return;
+          if (!imuBuffer.read(imuPredictEnd, thisImu))
+          {
+            continue;
+          }
+          const double imuTime = thisImu.t;
+          const double dt = (lastImuT_predict < 0) ? (1.0 / 500.0) : (imuTime - lastImuT_predict);
+          if (dt <= 0)
+          {
+            ROS_WARN_COND(dt < 0, "invalid dt (imu): (%0.2f - %0.2f) = %0.2f", imuTime, lastImuT_predict, dt);
+            continue;
+          }
+          lastImuT_predict = imuTime;
+
+          imuIntegratorPredict_->integrateMeasurement(gtsam::Vector3(thisImu.acc[0], thisImu.acc[1], thisImu.acc[2]),
+                                              gtsam::Vector3(thisImu.gyr[0], thisImu.gyr[1], thisImu.gyr[2]), dt);
+          isImuIntegrated = true;
         }
-        lastImuT_predict = imuTime;
 
-        // integrate this single imu message
-        imuIntegratorPredict_->integrateMeasurement(gtsam::Vector3(thisImu.linear_acceleration.x, thisImu.linear_acceleration.y, thisImu.linear_acceleration.z),
-                                            gtsam::Vector3(thisImu.angular_velocity.x, thisImu.angular_velocity.y, thisImu.angular_velocity.z), dt);
+        if (!isImuIntegrated)
+        {
+          return;
+        }
 
         // predict odometry
         const gtsam::NavState currentState = imuIntegratorPredict_->predict(prevStateOdom_, prevBiasOdom_);
@@ -584,9 +623,9 @@ namespace liosam
         odometry->twist.twist.linear.x = currentState.velocity().x();
         odometry->twist.twist.linear.y = currentState.velocity().y();
         odometry->twist.twist.linear.z = currentState.velocity().z();
-        odometry->twist.twist.angular.x = thisImu.angular_velocity.x + prevBiasOdom_.gyroscope().x();
-        odometry->twist.twist.angular.y = thisImu.angular_velocity.y + prevBiasOdom_.gyroscope().y();
-        odometry->twist.twist.angular.z = thisImu.angular_velocity.z + prevBiasOdom_.gyroscope().z();
+        odometry->twist.twist.angular.x = thisImu.gyr[0] + prevBiasOdom_.gyroscope().x();
+        odometry->twist.twist.angular.y = thisImu.gyr[1] + prevBiasOdom_.gyroscope().y();
+        odometry->twist.twist.angular.z = thisImu.gyr[2] + prevBiasOdom_.gyroscope().z();
         pubPreOdometry.publish(odometry);
 
       }
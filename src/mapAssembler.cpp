@@ -0,0 +1,195 @@
+#include "utility.h"
+
+#include "liosam/MapDelta.h"
+#include "liosam/TrajectoryDelta.h"
+
+#include <unordered_map>
+
+namespace liosam
+{
+namespace map_assembler
+{
+
+/*//{ class MapAssembler() */
+// Reference consumer of the map and trajectory deltas of MapOptimization (deltaPublishing), e.g. at a ground station. It rebuilds the global map
+// and the trajectory from the deltas and publishes them in full locally. After a lost message nothing is published until the next full one.
+class MapAssembler : public nodelet::Nodelet {
+public:
+  struct VoxelKey
+  {
+    int v[3];
+
+    bool operator==(const VoxelKey& other) const {
+      return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2];
+    }
+  };
+
+  struct VoxelKeyHash
+  {
+    size_t operator()(const VoxelKey& key) const {
+      return size_t((int64_t(key.v[0]) * 73856093) ^ (int64_t(key.v[1]) * 19349663) ^ (int64_t(key.v[2]) * 83492791));
+    }
+  };
+
+  std::mutex mtxMap;
+  std::mutex mtxTrajectory;
+
+  ros::Subscriber subMapDelta;
+  ros::Subscriber subTrajectoryDelta;
+
+  ros::Publisher pubMap;
+  ros::Publisher pubPath;
+
+  std::unordered_map<VoxelKey, PointType, VoxelKeyHash> voxels;
+  bool                                                   mapValid = false;
+  uint32_t                                               mapSeq   = 0;  // the next expected
+
+  std::vector<geometry_msgs::PoseStamped> poses;
+  bool                                    trajectoryValid = false;
+  uint32_t                                trajectorySeq   = 0;  // the next expected
+
+  bool is_initialized_ = false;
+
+public:
+  /*//{ onInit() */
+  virtual void onInit() {
+
+    ros::NodeHandle nh = nodelet::Nodelet::getMTPrivateNodeHandle();
+
+    subMapDelta = nh.subscribe<liosam::MapDelta>("liosam/assembler/map_delta_in", 10, &MapAssembler::mapDeltaHandler, this, ros::TransportHints().tcpNoDelay());
+    subTrajectoryDelta = nh.subscribe<liosam::TrajectoryDelta>("liosam/assembler/trajectory_delta_in", 10, &MapAssembler::trajectoryDeltaHandler, this,
+                                                               ros::TransportHints().tcpNoDelay());
+
+    pubMap  = nh.advertise<sensor_msgs::PointCloud2>("liosam/assembler/map_out", 1);
+    pubPath = nh.advertise<nav_msgs::Path>("liosam/assembler/path_out", 1);
+
+    ROS_INFO("\033[1;32m----> [MapAssembler]: initialized.\033[0m");
+    is_initialized_ = true;
+  }
+  /*//}*/
+
+  /*//{ mapDeltaHandler() */
+  void mapDeltaHandler(const liosam::MapDelta::ConstPtr& msg) {
+
+    if (!is_initialized_) {
+      return;
+    }
+
+    ROS_INFO_ONCE("[MapAssembler]: mapDeltaHandler first callback");
+
+    std::lock_guard<std::mutex> lock(mtxMap);
+
+    if (msg->full) {
+      voxels.clear();
+      mapValid = true;
+    } else if (!mapValid || msg->seq != mapSeq) {
+      if (mapValid) {
+        ROS_WARN("[MapAssembler]: map delta %u lost, waiting for the next full map", mapSeq);
+      }
+      mapValid = false;
+      return;
+    }
+    mapSeq = msg->seq + 1;
+
+    pcl::PointCloud<PointType> cloud;
+    pcl::fromROSMsg(msg->cloud, cloud);
+    if (msg->keys.size() != 3 * cloud.size() || msg->removed_keys.size() % 3 != 0) {
+      ROS_ERROR("[MapAssembler]: malformed map delta %u, waiting for the next full map", msg->seq);
+      mapValid = false;
+      return;
+    }
+
+    for (size_t i = 0; i < cloud.size(); i++) {
+      voxels[toKey(msg->keys, i)] = cloud.points[i];
+    }
+    for (size_t i = 0; i < msg->removed_keys.size() / 3; i++) {
+      voxels.erase(toKey(msg->removed_keys, i));
+    }
+
+    ROS_INFO_THROTTLE(10.0, "[MapAssembler]: map: %d voxels, last delta: %d changed, %d removed (%s)", int(voxels.size()), int(cloud.size()),
+                      int(msg->removed_keys.size() / 3), msg->full ? "full" : "delta");
+
+    if (pubMap.getNumSubscribers() == 0) {
+      return;
+    }
+
+    pcl::PointCloud<PointType>::Ptr map(new pcl::PointCloud<PointType>());
+    map->points.reserve(voxels.size());
+    for (const auto& voxel : voxels) {
+      map->points.push_back(voxel.second);
+    }
+    map->width  = map->points.size();
+    map->height = 1;
+    publishCloud(&pubMap, map, msg->header.stamp, msg->header.frame_id);
+  }
+  /*//}*/
+
+  /*//{ trajectoryDeltaHandler() */
+  void trajectoryDeltaHandler(const liosam::TrajectoryDelta::ConstPtr& msg) {
+
+    if (!is_initialized_) {
+      return;
+    }
+
+    ROS_INFO_ONCE("[MapAssembler]: trajectoryDeltaHandler first callback");
+
+    std::lock_guard<std::mutex> lock(mtxTrajectory);
+
+    if (msg->full) {
+      poses.clear();
+      trajectoryValid = true;
+    } else if (!trajectoryValid || msg->seq != trajectorySeq) {
+      if (trajectoryValid) {
+        ROS_WARN("[MapAssembler]: trajectory delta %u lost, waiting for the next full trajectory", trajectorySeq);
+      }
+      trajectoryValid = false;
+      return;
+    }
+    trajectorySeq = msg->seq + 1;
+
+    if (msg->indices.size() != msg->poses.size()) {
+      ROS_ERROR("[MapAssembler]: malformed trajectory delta %u, waiting for the next full trajectory", msg->seq);
+      trajectoryValid = false;
+      return;
+    }
+
+    poses.resize(msg->size);
+    for (size_t i = 0; i < msg->indices.size(); i++) {
+      if (msg->indices[i] >= msg->size) {
+        ROS_ERROR("[MapAssembler]: malformed trajectory delta %u, waiting for the next full trajectory", msg->seq);
+        trajectoryValid = false;
+        return;
+      }
+      poses[msg->indices[i]] = msg->poses[i];
+    }
+
+    if (pubPath.getNumSubscribers() == 0) {
+      return;
+    }
+
+    nav_msgs::Path::Ptr path = boost::make_shared<nav_msgs::Path>();
+    path->header             = msg->header;
+    path->poses              = poses;
+
+    try {
+      pubPath.publish(path);
+    }
+    catch (...) {
+      ROS_ERROR("[MapAssembler]: Exception caught during publishing topic %s.", pubPath.getTopic().c_str());
+    }
+  }
+  /*//}*/
+
+  /*//{ toKey() */
+  static VoxelKey toKey(const std::vector<int32_t>& keys, const size_t index) {
+    return VoxelKey{{keys[3 * index], keys[3 * index + 1], keys[3 * index + 2]}};
+  }
+  /*//}*/
+};
+/*//}*/
+
+}  // namespace map_assembler
+}  // namespace liosam
+
+#include <pluginlib/class_list_macros.h>
+PLUGINLIB_EXPORT_CLASS(liosam::map_assembler::MapAssembler, nodelet::Nodelet)
@@ -1,4 +1,23 @@
 #include "utility.h"
+#include "ikdTree.h"
+#include "voxelMap.h"
+#include "keyFrameCache.h"
+#include "keyPoseGrid.h"
+#include "primitiveCache.h"
+#include "lineFit.h"
+#include "mortonOrder.h"
+#include "globalMap.h"
+#include "mapExporter.h"
+#include "sessionFile.h"
+
+#include "liosam/MapDelta.h"
+#include "liosam/TrajectoryDelta.h"
+
+#include <std_srvs/Trigger.h>
+
+#include <atomic>
+#include <memory>
+#include <numeric>
 
 #include <gtsam/geometry/Rot3.h>
 #include <gtsam/geometry/Pose3.h>
@@ -98,6 +117,10 @@ public:
   float globalMapVisualizationSearchRadius;
   float globalMapVisualizationPoseDensity;
   float globalMapVisualizationLeafSize;
+  bool  globalMapIncremental;
+  float globalMapPoseTolerance;
+  bool  deltaPublishing;
+  float deltaFullPeriod;
 
   // CPU Params
   double mappingProcessInterval;
@@ -109,9 +132,30 @@ public:
   float surroundingkeyframeAddingDistThreshold;
   float surroundingkeyframeAddingAngleThreshold;
 
+  // Local map of the scan-to-map matching
+  string localMapType;
+  float  voxelMapResolution;
+  int    voxelMapMaxPoints;
+  int    voxelMapNeighbors;
+
   // Save pcd
   bool   savePCD;
   string savePCDDirectory;
+  float  mapExportMergePeriod;
+
+  // Session
+  string sessionFile;
+  bool   sessionLoad;
+  float  sessionSavePeriod;
+  int    relocalizationYawSteps;
+
+  // Localization in a prebuilt map
+  bool   localizationOnly;
+  string localizationMap;
+  float  localizationInitialX;
+  float  localizationInitialY;
+  float  localizationInitialZ;
+  float  localizationInitialYaw;
   /*//}*/
 
   // TF
@@ -134,6 +178,8 @@ public:
   ros::Publisher pubLaserOdometryIncremental;
   ros::Publisher pubKeyPoses;
   ros::Publisher pubPath;
+  ros::Publisher pubMapDelta;
+  ros::Publisher pubTrajectoryDelta;
 
   ros::Publisher pubHistoryKeyFrames;
   ros::Publisher pubIcpKeyFrames;
@@ -143,7 +189,6 @@ public:
   ros::Publisher pubLoopConstraintEdge;
 
   ros::Subscriber subCloud;
-  ros::Subscriber subOrigCloudInfo;
   ros::Subscriber subGPS;
   ros::Subscriber subLoop;
   ros::Subscriber subOrientation;
@@ -151,15 +196,11 @@ public:
   std::shared_ptr<mrs_lib::Transformer> transformer;
 
   std::deque<nav_msgs::Odometry> gpsQueue;
-  liosam::cloud_info             cloudInfo;
+  liosam::CloudFrame::ConstPtr   cloudInfo;
 
   geometry_msgs::QuaternionStamped orientationMsg;
   bool                             gotOrientation = false;
 
-  bool isMemoryAllocated = false;
-  int scanHeight;
-  int scanWidth;
-
   vector<pcl::PointCloud<PointType>::Ptr> cornerCloudKeyFrames;
   vector<pcl::PointCloud<PointType>::Ptr> surfCloudKeyFrames;
 
@@ -168,8 +209,8 @@ public:
   pcl::PointCloud<PointType>::Ptr     copy_cloudKeyPoses3D;
   pcl::PointCloud<PointTypePose>::Ptr copy_cloudKeyPoses6D;
 
-  pcl::PointCloud<PointType>::Ptr laserCloudCornerLast;    // corner feature set from odoOptimization
-  pcl::PointCloud<PointType>::Ptr laserCloudSurfLast;      // surf feature set from odoOptimization
+  pcl::PointCloud<PointType>::ConstPtr laserCloudCornerLast;  // corner feature set from odoOptimization, shared with cloudInfo
+  pcl::PointCloud<PointType>::ConstPtr laserCloudSurfLast;    // surf feature set from odoOptimization, shared with cloudInfo
   pcl::PointCloud<PointType>::Ptr laserCloudCornerLastDS;  // downsampled corner featuer set from odoOptimization
   pcl::PointCloud<PointType>::Ptr laserCloudSurfLastDS;    // downsampled surf featuer set from odoOptimization
 
@@ -183,17 +224,110 @@ public:
   std::vector<PointType> coeffSelSurfVec;
   std::vector<bool>      laserCloudOriSurfFlag;
 
-  map<int, pair<pcl::PointCloud<PointType>, pcl::PointCloud<PointType>>> laserCloudMapContainer;
-  pcl::PointCloud<PointType>::Ptr                                        laserCloudCornerFromMap;
-  pcl::PointCloud<PointType>::Ptr                                        laserCloudSurfFromMap;
-  pcl::PointCloud<PointType>::Ptr                                        laserCloudCornerFromMapDS;
-  pcl::PointCloud<PointType>::Ptr                                        laserCloudSurfFromMapDS;
+  // local map primitives matched to the feature points, kept across the LM iterations of a scan while the pose moves less than
+  // associationMaxTranslation / associationMaxRotation
+  struct AssociationStats
+  {
+    uint64_t searched = 0;  // LM iterations with new correspondences
+    uint64_t reused   = 0;  // LM iterations with the correspondences of the previous one
+  };
+  std::vector<MapPrimitive> cornerAssociations;
+  std::vector<MapPrimitive> surfAssociations;
+  float                     associationMaxTranslation;
+  float                     associationMaxRotation;
+  AssociationStats          associationStats;
+
+  // order in which the feature points query the local map, along the Z-order curve with mortonOrderedQueries so that neighbouring queries (and
+  // the contiguous blocks of the threads) visit the same parts of the map
+  bool             mortonOrderedQueries;
+  std::vector<int> cornerQueryOrder;
+  std::vector<int> surfQueryOrder;
+
+  // lines and planes of the local map by the voxel of the query, null if primitiveCacheResolution is 0, cleared whenever the local map changes
+  std::unique_ptr<PrimitiveCache> cornerPrimitiveCache;
+  std::unique_ptr<PrimitiveCache> surfPrimitiveCache;
+  float                           primitiveCacheResolution;
+  struct PrimitiveCacheStats
+  {
+    uint64_t hits   = 0;
+    uint64_t misses = 0;
+  };
+  PrimitiveCacheStats primitiveCacheStats;  // counted per thread in the parallel passes, summed after them
+
+  // keyframes (index, pose version) the kdtree local map was built from, it is rebuilt only when they change
+  std::vector<std::pair<int, uint32_t>> localMapKeyFrames;
+  bool                                  localMapKdtreeOutdated = true;
+
+  pcl::PointCloud<PointType>::Ptr laserCloudCornerFromMap;
+  pcl::PointCloud<PointType>::Ptr laserCloudSurfFromMap;
+  pcl::PointCloud<PointType>::Ptr laserCloudCornerFromMapDS;
+  pcl::PointCloud<PointType>::Ptr laserCloudSurfFromMapDS;
+
+  // keyframe clouds transformed to the map frame, an entry is valid while the pose version of its keyframe stays the same
+  KeyFrameCache<PointType>   keyFrameCache;
+  std::vector<uint32_t>      keyPoseVersions;
+  std::vector<PointTypePose> keyPosesVersioned;  // the poses the current versions stand for
+  int                        keyFrameCacheSize;
+  float                      keyFrameCachePoseTolerance;
 
   pcl::KdTreeFLANN<PointType>::Ptr kdtreeCornerFromMap;
   pcl::KdTreeFLANN<PointType>::Ptr kdtreeSurfFromMap;
 
-  pcl::KdTreeFLANN<PointType>::Ptr kdtreeSurroundingKeyPoses;
-  pcl::KdTreeFLANN<PointType>::Ptr kdtreeHistoryKeyPoses;
+  // incremental local map (localMapType: ikdtree, ivox), a box around the robot that is moved with it, null with the kdtree rebuilt every scan
+  std::unique_ptr<LocalMapIndex<PointType>> incrementalCornerMap;
+  std::unique_ptr<LocalMapIndex<PointType>> incrementalSurfMap;
+  MapBox                                    localMapBox;
+  bool                                      localMapValid = false;
+  std::vector<bool>                         keyFrameInLocalMap;
+
+  // voxelized global map (globalMapIncremental), keyframes are inserted by the visualization timer, only it touches the accumulator
+  GlobalMapAccumulator<PointType> globalMap;
+  std::vector<PointTypePose>      globalMapPoses;  // the poses the keyframes are (to be) inserted with, guarded by mtx
+  KeyFrameQueue                   globalMapQueue;  // keyframes to be (re)inserted, guarded by mtx
+
+  // messages of one delta topic (deltaPublishing), a full message is sent periodically and whenever a new subscriber connects
+  struct DeltaStream
+  {
+    uint32_t  seq         = 0;
+    int       subscribers = 0;
+    ros::Time lastFull;
+
+    bool nextIsFull(const int numSubscribers, const ros::Time& now, const double fullPeriod) {
+      const bool full = numSubscribers > subscribers || (now - lastFull).toSec() >= fullPeriod;
+      subscribers     = numSubscribers;
+      if (full) {
+        lastFull = now;
+      }
+      return full;
+    }
+  };
+
+  DeltaStream   mapDeltaStream;         // only the visualization timer touches it
+  DeltaStream   trajectoryDeltaStream;  // guarded by mtx
+  KeyFrameQueue trajectoryQueue;        // keyframes added or moved since the last trajectory delta, guarded by mtx
+
+  // keyframes and their poses appended to files as they change, merged to the map in the background (savePCD)
+  std::unique_ptr<MapExporter<PointType, PointTypePose>> mapExporter;
+  ros::Time                                              mapExportLastMerge;
+
+  // session file (sessionFile), every factor of the graph is kept to be saved with the keyframes, guarded by mtx
+  std::vector<SessionFactor> sessionFactors;
+  std::mutex                 mtxSession;  // one save at a time
+  ros::Timer                 timerSessionSave;
+  ros::Timer                 timerLoadSession;  // one shot, the session is loaded after onInit()
+  ros::ServiceServer         srvSaveSession;
+  bool                       relocalizationPending = false;  // the first scan after a warm start is aligned to the loaded map
+  double                     relocalizationNoise   = -1;     // variance of the factor linking the warm-started session to the loaded one
+
+  // localization in a prebuilt map (localizationOnly), the map is loaded once as the local map of scan2MapOptimization and never changes, no
+  // keyframes are created and the pose graph is not used
+  pcl::PointCloud<PointType>::Ptr localizationMapCloud;          // corner and surf points of the map, the target of the relocalization
+  pcl::PointCloud<PointType>::Ptr localizationMapVisualization;  // downsampled for map_global_out
+  bool                            localizationStarted = false;    // the first scan was relocalized in the map
+
+  // positions of all keyframes, appended with every keyframe and updated by loop closures, guarded by mtx
+  KeyPoseGrid keyPoseGrid;
+  float       keyPoseGridCellSize;
 
   pcl::VoxelGrid<PointType> downSizeFilterCorner;
   pcl::VoxelGrid<PointType> downSizeFilterSurf;
@@ -213,6 +347,17 @@ public:
   bool    isDegenerate = false;
   cv::Mat matP;
 
+  // scan-to-map normal equations accumulated in the fused pass (lmNormalEquations), one block per thread
+  struct NormalEquations
+  {
+    Eigen::Matrix<float, 6, 6> JtJ;
+    Eigen::Matrix<float, 6, 1> Jtr;
+    int                        count;  // number of residuals
+  };
+  bool                         lmNormalEquations;
+  std::vector<NormalEquations> lmNormalEquationBlocks;
+  Eigen::Matrix<float, 6, 6>   degeneracyProjection = Eigen::Matrix<float, 6, 6>::Identity();
+
   int laserCloudCornerFromMapDSNum = 0;
   int laserCloudSurfFromMapDSNum   = 0;
   int laserCloudCornerLastDSNum    = 0;
@@ -231,7 +376,7 @@ public:
   Eigen::Affine3f incrementalOdometryAffineFront;
   Eigen::Affine3f incrementalOdometryAffineBack;
 
-  bool isInitialized = false;
+  std::atomic<bool> isInitialized{false};  // set by callbackLoadSessionTimer() instead of onInit() when a session is loaded
 
   ros::Timer timerVisualizeGlobalMap;
   ros::Timer timerLoopClosure;
@@ -263,6 +408,19 @@ public:
 
     pl.loadParam("savePCD", savePCD, false);
     pl.loadParam("savePCDDirectory", savePCDDirectory, std::string("/Downloads/LOAM/"));
+    pl.loadParam("mapExportMergePeriod", mapExportMergePeriod, 60.0f);
+
+    pl.loadParam("sessionFile", sessionFile, std::string(""));
+    pl.loadParam("sessionLoad", sessionLoad, false);
+    pl.loadParam("sessionSavePeriod", sessionSavePeriod, 0.0f);
+    pl.loadParam("relocalizationYawSteps", relocalizationYawSteps, 8);
+
+    pl.loadParam("localizationOnly", localizationOnly, false);
+    pl.loadParam("localizationMap", localizationMap, std::string(""));
+    pl.loadParam("localizationInitialX", localizationInitialX, 0.0f);
+    pl.loadParam("localizationInitialY", localizationInitialY, 0.0f);
+    pl.loadParam("localizationInitialZ", localizationInitialZ, 0.0f);
+    pl.loadParam("localizationInitialYaw", localizationInitialYaw, 0.0f);
 
     pl.loadParam("imu/interpolateOrientation/enable", imuRPYInterpolate, false);
     pl.loadParam("imu/interpolateOrientation/weight", imuRPYWeight, 0.01f);
@@ -278,12 +436,27 @@ public:
 
     pl.loadParam("numberOfCores", numberOfCores, 4);
     pl.loadParam("mappingProcessInterval", mappingProcessInterval, 0.15);
+    pl.loadParam("lmNormalEquations", lmNormalEquations, false);
+    pl.loadParam("associationMaxTranslation", associationMaxTranslation, 0.0f);
+    pl.loadParam("associationMaxRotation", associationMaxRotation, 0.0f);
+    pl.loadParam("primitiveCacheResolution", primitiveCacheResolution, 0.0f);
+    pl.loadParam("mortonOrderedQueries", mortonOrderedQueries, false);
 
     pl.loadParam("surroundingkeyframeAddingDistThreshold", surroundingkeyframeAddingDistThreshold, 1.0f);
     pl.loadParam("surroundingkeyframeAddingAngleThreshold", surroundingkeyframeAddingAngleThreshold, 0.2f);
     pl.loadParam("surroundingKeyframeDensity", surroundingKeyframeDensity, 1.0f);
     pl.loadParam("surroundingKeyframeSearchRadius", surroundingKeyframeSearchRadius, 50.0f);
 
+    pl.loadParam("localMapType", localMapType, std::string("kdtree"));
+    pl.loadParam("voxelMapResolution", voxelMapResolution, 1.0f);
+    pl.loadParam("voxelMapMaxPointsPerVoxel", voxelMapMaxPoints, 30);
+    pl.loadParam("voxelMapNeighbors", voxelMapNeighbors, 27);
+
+    pl.loadParam("keyPoseGridCellSize", keyPoseGridCellSize, 10.0f);
+
+    pl.loadParam("keyFrameCacheSize", keyFrameCacheSize, 512);
+    pl.loadParam("keyFrameCachePoseTolerance", keyFrameCachePoseTolerance, 0.001f);
+
     pl.loadParam("loopClosureEnableFlag", loopClosureEnableFlag, false);
     pl.loadParam("loopClosureFrequency", loopClosureFrequency, 1.0f);
     pl.loadParam("surroundingKeyframeSize", surroundingKeyframeSize, 50);
@@ -295,6 +468,10 @@ public:
     pl.loadParam("globalMapVisualizationSearchRadius", globalMapVisualizationSearchRadius, 1e3f);
     pl.loadParam("globalMapVisualizationPoseDensity", globalMapVisualizationPoseDensity, 10.0f);
     pl.loadParam("globalMapVisualizationLeafSize", globalMapVisualizationLeafSize, 1.0f);
+    pl.loadParam("globalMapIncremental", globalMapIncremental, false);
+    pl.loadParam("globalMapPoseTolerance", globalMapPoseTolerance, 0.05f);
+    pl.loadParam("deltaPublishing", deltaPublishing, false);
+    pl.loadParam("deltaFullPeriod", deltaFullPeriod, 30.0f);
 
     if (!pl.loadedSuccessfully()) {
       ROS_ERROR("[MapOptimization]: Could not load all parameters!");
@@ -303,6 +480,53 @@ public:
 
     /*//}*/
 
+    if (localizationOnly) {
+      // the static map is searched by a kd-tree built once, the incremental maps would only add the scans to it
+      if (localMapType != "kdtree") {
+        ROS_WARN("[MapOptimization]: localizationOnly uses the kdtree local map, ignoring localMapType '%s'", localMapType.c_str());
+        localMapType = "kdtree";
+      }
+      if (savePCD || sessionLoad || !sessionFile.empty()) {
+        ROS_WARN("[MapOptimization]: no keyframes are created in localizationOnly, disabling savePCD and the session");
+        savePCD     = false;
+        sessionLoad = false;
+        sessionFile.clear();
+      }
+      loopClosureEnableFlag = false;
+      globalMapIncremental  = false;
+      deltaPublishing       = false;
+    }
+
+    keyFrameCache = KeyFrameCache<PointType>(size_t(keyFrameCacheSize) * 1024 * 1024);
+    if (deltaPublishing && !globalMapIncremental) {
+      ROS_WARN("[MapOptimization]: deltaPublishing needs the incremental global map, enabling globalMapIncremental");
+      globalMapIncremental = true;
+    }
+    globalMap = GlobalMapAccumulator<PointType>(globalMapVisualizationLeafSize, deltaPublishing);
+
+    if (savePCD) {
+      savePCDDirectory = std::getenv("HOME") + savePCDDirectory;
+      mapExporter      = std::make_unique<MapExporter<PointType, PointTypePose>>(savePCDDirectory, mappingCornerLeafSize, mappingSurfLeafSize);
+      ROS_INFO("[MapOptimization]: exporting the map to %s", savePCDDirectory.c_str());
+    }
+
+    if (primitiveCacheResolution > 0) {
+      cornerPrimitiveCache = std::make_unique<PrimitiveCache>(primitiveCacheResolution);
+      surfPrimitiveCache   = std::make_unique<PrimitiveCache>(primitiveCacheResolution);
+    }
+
+    if (localMapType == "ikdtree") {
+      incrementalCornerMap = std::make_unique<IkdTree<PointType>>();
+      incrementalSurfMap   = std::make_unique<IkdTree<PointType>>();
+    } else if (localMapType == "ivox") {
+      const auto neighborhood = voxelMapNeighbors == 7 ? VoxelMap<PointType>::Neighborhood::NEARBY7 : VoxelMap<PointType>::Neighborhood::NEARBY27;
+      incrementalCornerMap    = std::make_unique<VoxelMap<PointType>>(voxelMapResolution, voxelMapMaxPoints, neighborhood);
+      incrementalSurfMap      = std::make_unique<VoxelMap<PointType>>(voxelMapResolution, voxelMapMaxPoints, neighborhood);
+    } else if (localMapType != "kdtree") {
+      ROS_ERROR("[MapOptimization]: unknown localMapType '%s', use 'kdtree', 'ikdtree' or 'ivox'", localMapType.c_str());
+      ros::shutdown();
+    }
+
     geometry_msgs::TransformStamped tfLidar2Imu;
     findLidar2ImuTf(transformer, lidarFrame, imuFrame, baselinkFrame, extRot, extQRPY, tfLidar2Baselink, tfLidar2Imu);
 
@@ -311,12 +535,17 @@ public:
     parameters.relinearizeSkip      = 1;
     isam                            = new ISAM2(parameters);
 
+    allocateMemory();
+
     timerLoopClosure        = nh.createTimer(ros::Rate(loopClosureFrequency), &MapOptimization::callbackLoopClosureTimer, this);
     timerVisualizeGlobalMap = nh.createTimer(ros::Rate(0.2), &MapOptimization::callbackVisualizeGlobalMapTimer, this);
+    if (!sessionFile.empty() && sessionSavePeriod > 0) {
+      timerSessionSave = nh.createTimer(ros::Duration(sessionSavePeriod), &MapOptimization::callbackSessionSaveTimer, this);
+    }
+    srvSaveSession = nh.advertiseService("liosam/mapping/save_session_in", &MapOptimization::callbackSaveSession, this);
 
     subCloud =
-        nh.subscribe<liosam::cloud_info>("liosam/mapping/cloud_info_in", 1, &MapOptimization::laserCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
-    subOrigCloudInfo = nh.subscribe<sensor_msgs::PointCloud2>("liosam/mapping/orig_cloud_info_in", 1, &MapOptimization::origCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
+        nh.subscribe<liosam::CloudFrame>("liosam/mapping/cloud_info_in", 1, &MapOptimization::laserCloudInfoHandler, this, ros::TransportHints().tcpNoDelay());
     subGPS         = nh.subscribe<nav_msgs::Odometry>("liosam/mapping/gps_in", 200, &MapOptimization::gpsHandler, this, ros::TransportHints().tcpNoDelay());
     subLoop        = nh.subscribe<std_msgs::Float64MultiArray>("liosam/mapping/loop_closure_detection_in", 1, &MapOptimization::loopInfoHandler, this,
                                                         ros::TransportHints().tcpNoDelay());
@@ -328,6 +557,8 @@ public:
     pubLaserOdometryGlobal      = nh.advertise<nav_msgs::Odometry>("liosam/mapping/odometry_out", 1);
     pubLaserOdometryIncremental = nh.advertise<nav_msgs::Odometry>("liosam/mapping/odometry_incremental_out", 1);
     pubPath                     = nh.advertise<nav_msgs::Path>("liosam/mapping/path_out", 1);
+    pubMapDelta                 = nh.advertise<liosam::MapDelta>("liosam/mapping/map_delta_out", 10);
+    pubTrajectoryDelta          = nh.advertise<liosam::TrajectoryDelta>("liosam/mapping/trajectory_delta_out", 10);
 
 
     pubHistoryKeyFrames   = nh.advertise<sensor_msgs::PointCloud2>("liosam/mapping/icp_loop_closure_history_cloud_out", 1);
@@ -344,6 +575,19 @@ public:
     downSizeFilterSurroundingKeyPoses.setLeafSize(surroundingKeyframeDensity, surroundingKeyframeDensity,
                                                   surroundingKeyframeDensity);  // for surrounding key poses of scan-to-map optimization
 
+    if (localizationOnly && !loadLocalizationMap()) {
+      ROS_ERROR("[MapOptimization]: could not load the localization map from '%s'", localizationMap.c_str());
+      ros::shutdown();
+      return;
+    }
+
+    // a large session takes seconds to load, it is loaded outside of onInit() and the callbacks start once it is restored
+    if (!sessionFile.empty() && sessionLoad) {
+      timerLoadSession = nh.createTimer(ros::Duration(0.01), &MapOptimization::callbackLoadSessionTimer, this, true);
+      ROS_INFO("\033[1;32m----> [MapOptimization]: initialized, loading the session.\033[0m");
+      return;
+    }
+
     ROS_INFO("\033[1;32m----> [MapOptimization]: initialized.\033[0m");
     isInitialized = true;
   }
@@ -356,8 +600,7 @@ public:
     copy_cloudKeyPoses3D.reset(new pcl::PointCloud<PointType>());
     copy_cloudKeyPoses6D.reset(new pcl::PointCloud<PointTypePose>());
 
-    kdtreeSurroundingKeyPoses.reset(new pcl::KdTreeFLANN<PointType>());
-    kdtreeHistoryKeyPoses.reset(new pcl::KdTreeFLANN<PointType>());
+    keyPoseGrid = KeyPoseGrid(keyPoseGridCellSize);
 
     laserCloudCornerLast.reset(new pcl::PointCloud<PointType>());    // corner feature set from odoOptimization
     laserCloudSurfLast.reset(new pcl::PointCloud<PointType>());      // surf feature set from odoOptimization
@@ -367,15 +610,7 @@ public:
     laserCloudOri.reset(new pcl::PointCloud<PointType>());
     coeffSel.reset(new pcl::PointCloud<PointType>());
 
-    laserCloudOriCornerVec.resize(scanHeight * scanWidth);
-    coeffSelCornerVec.resize(scanHeight * scanWidth);
-    laserCloudOriCornerFlag.resize(scanHeight * scanWidth);
-    laserCloudOriSurfVec.resize(scanHeight * scanWidth);
-    coeffSelSurfVec.resize(scanHeight * scanWidth);
-    laserCloudOriSurfFlag.resize(scanHeight * scanWidth);
-
-    std::fill(laserCloudOriCornerFlag.begin(), laserCloudOriCornerFlag.end(), false);
-    std::fill(laserCloudOriSurfFlag.begin(), laserCloudOriSurfFlag.end(), false);
+    // laserCloudOri*Vec, coeffSel*Vec and laserCloudOri*Flag are sized by the incoming scans, see downsampleCurrentScan()
 
     laserCloudCornerFromMap.reset(new pcl::PointCloud<PointType>());
     laserCloudSurfFromMap.reset(new pcl::PointCloud<PointType>());
@@ -390,6 +625,7 @@ public:
     }
 
     matP = cv::Mat(6, 6, CV_32F, cv::Scalar::all(0));
+    lmNormalEquationBlocks.resize(std::max(numberOfCores, 1));
   }
   /*//}*/
 
@@ -409,7 +645,7 @@ public:
   /*//}*/
 
   /*//{ laserCloudInfoHandler() */
-  void laserCloudInfoHandler(const liosam::cloud_info::ConstPtr& msgIn) {
+  void laserCloudInfoHandler(const liosam::CloudFrame::ConstPtr& msgIn) {
 
     if (!isInitialized) {
       return;
@@ -417,23 +653,32 @@ public:
 
     ROS_INFO_ONCE("[MapOptimization]: laserCloudInfoHandler first callback");
 
-    if (!isMemoryAllocated) {
-      return;
-    }
-
     // extract time stamp
     timeLaserInfoStamp = msgIn->header.stamp;
     timeLaserInfoCur   = msgIn->header.stamp.toSec();
 
     // extract info and feature cloud
-    cloudInfo = *msgIn;
-    pcl::fromROSMsg(msgIn->cloud_corner, *laserCloudCornerLast);
-    pcl::fromROSMsg(msgIn->cloud_surface, *laserCloudSurfLast);
+    cloudInfo            = msgIn;
+    laserCloudCornerLast = msgIn->cloudCorner;
+    laserCloudSurfLast   = msgIn->cloudSurface;
 
     std::lock_guard<std::mutex> lock(mtx);
 
     updateInitialGuess();
 
+    if (localizationOnly) {
+      localizeInMap();
+      return;
+    }
+
+    if (relocalizationPending) {
+      const PointTypePose& last = cloudKeyPoses6D->back();
+      if (!relocalize(last, loadedMapAround(last))) {
+        return;
+      }
+      relocalizationPending = false;
+    }
+
     extractSurroundingKeyFrames();
 
     downsampleCurrentScan();
@@ -455,31 +700,10 @@ public:
   }
   /*//}*/
 
-  /*//{ origCloudInfoHandler() */
-  void origCloudInfoHandler(const sensor_msgs::PointCloud2::ConstPtr &msgIn) {
-
-    if (!isInitialized) {
-      return;
-    }
-
-    ROS_INFO_ONCE("[MapOptimization]: origCloudInfoHandler first callback");
-
-    if (!isMemoryAllocated) {
-      scanHeight = msgIn->height;
-      scanWidth  = msgIn->width;
-      allocateMemory();
-      isMemoryAllocated = true;
-      ROS_INFO("[MapOptimization]: First scan height: %d width: %d", scanHeight, scanWidth);
-      subOrigCloudInfo.shutdown();
-    }
-
-  }
-  /*//}*/
-
   /*//{ gpsHandler() */
   void gpsHandler(const nav_msgs::Odometry::ConstPtr& gpsMsg) {
 
-    if (!isInitialized) {
+    if (!isInitialized || localizationOnly) {
       return;
     }
 
@@ -500,7 +724,7 @@ public:
   /*//}*/
 
   /*//{ transformPointCloud() */
-  pcl::PointCloud<PointType>::Ptr transformPointCloud(pcl::PointCloud<PointType>::Ptr cloudIn, PointTypePose* transformIn) {
+  pcl::PointCloud<PointType>::Ptr transformPointCloud(const pcl::PointCloud<PointType>::ConstPtr& cloudIn, PointTypePose* transformIn) {
     pcl::PointCloud<PointType>::Ptr cloudOut(new pcl::PointCloud<PointType>());
 
     const int cloudSize = cloudIn->size();
@@ -568,49 +792,403 @@ public:
 
     publishGlobalMap();
 
-    if (!savePCD) {
+    // the exporter merges in its own thread, the request only wakes it up
+    if (mapExporter && mapExportMergePeriod > 0 && (ros::Time::now() - mapExportLastMerge).toSec() >= mapExportMergePeriod) {
+      mapExporter->requestMerge();
+      mapExportLastMerge = ros::Time::now();
+    }
+  }
+  /*//}*/
+
+  /*//{ callbackSessionSaveTimer() */
+  void callbackSessionSaveTimer([[maybe_unused]] const ros::TimerEvent& event) {
+
+    if (!isInitialized) {
+      return;
+    }
+
+    saveSession();
+  }
+  /*//}*/
+
+  /*//{ callbackLoadSessionTimer() */
+  void callbackLoadSessionTimer([[maybe_unused]] const ros::TimerEvent& event) {
+    loadSession();
+    isInitialized = true;
+  }
+  /*//}*/
+
+  /*//{ callbackSaveSession() */
+  bool callbackSaveSession([[maybe_unused]] std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res) {
+
+    if (!isInitialized) {
+      res.success = false;
+      res.message = "not initialized";
+      return true;
+    }
+
+    if (sessionFile.empty()) {
+      res.success = false;
+      res.message = "sessionFile is not set";
+      return true;
+    }
+
+    res.success = saveSession();
+    res.message = res.success ? "session saved to " + sessionFile : "could not save the session to " + sessionFile;
+    return true;
+  }
+  /*//}*/
+
+  /*//{ saveSession() */
+  bool saveSession() {
+    // a save already running will do
+    std::unique_lock<std::mutex> saving(mtxSession, std::try_to_lock);
+    if (!saving.owns_lock()) {
+      return false;
+    }
+
+    // only the poses and the pointers to the keyframe clouds are copied under the lock, the clouds are never modified
+    std::vector<SessionKeyFrame>                      keyFrames;
+    std::vector<pcl::PointCloud<PointType>::ConstPtr> corners;
+    std::vector<pcl::PointCloud<PointType>::ConstPtr> surfs;
+    std::vector<SessionFactor>                        factors;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      keyFrames.resize(cloudKeyPoses6D->size());
+      for (size_t i = 0; i < cloudKeyPoses6D->size(); i++) {
+        const PointTypePose& pose = cloudKeyPoses6D->points[i];
+        keyFrames[i]              = SessionKeyFrame{{pose.x, pose.y, pose.z, pose.roll, pose.pitch, pose.yaw}, 0, 0, pose.time, 0};
+      }
+      corners.assign(cornerCloudKeyFrames.begin(), cornerCloudKeyFrames.end());
+      surfs.assign(surfCloudKeyFrames.begin(), surfCloudKeyFrames.end());
+      factors = sessionFactors;
+    }
+
+    const ros::WallTime start = ros::WallTime::now();
+    const int           saved = keyFrames.size();
+    if (!writeSession<PointType>(sessionFile, std::move(keyFrames), corners, surfs, factors)) {
+      ROS_ERROR("[MapOptimization]: could not save the session to %s", sessionFile.c_str());
+      return false;
+    }
+    ROS_INFO("[MapOptimization]: session of %d keyframes and %d factors saved to %s in %.3f s", saved, int(factors.size()), sessionFile.c_str(),
+             (ros::WallTime::now() - start).toSec());
+    return true;
+  }
+  /*//}*/
+
+  /*//{ loadSession() */
+  // warm start: the keyframes, the pose graph and the derived structures are restored from the session file, the first scan is then relocalized
+  void loadSession() {
+    const ros::WallTime start = ros::WallTime::now();
+
+    SessionFile session;
+    if (!session.open(sessionFile)) {
+      ROS_WARN("[MapOptimization]: no valid session in %s, starting a new one", sessionFile.c_str());
+      return;
+    }
+
+    const int numKeyFrames = session.header().numKeyFrames;
+    if (numKeyFrames == 0) {
+      ROS_WARN("[MapOptimization]: the session in %s is empty, starting a new one", sessionFile.c_str());
+      return;
+    }
+
+    // the clouds are most of the loading time, they are copied out of the mapping in parallel
+    cornerCloudKeyFrames.resize(numKeyFrames);
+    surfCloudKeyFrames.resize(numKeyFrames);
+#pragma omp parallel for num_threads(numberOfCores) schedule(dynamic, 64)
+    for (int i = 0; i < numKeyFrames; i++) {
+      cornerCloudKeyFrames[i].reset(new pcl::PointCloud<PointType>());
+      surfCloudKeyFrames[i].reset(new pcl::PointCloud<PointType>());
+      session.clouds(i, *cornerCloudKeyFrames[i], *surfCloudKeyFrames[i]);
+    }
+    const double cloudsTime = (ros::WallTime::now() - start).toSec();
+
+    for (int i = 0; i < numKeyFrames; i++) {
+      const SessionKeyFrame&                 keyFrame           = session.keyFrame(i);
+      const pcl::PointCloud<PointType>::Ptr& thisCornerKeyFrame = cornerCloudKeyFrames[i];
+      const pcl::PointCloud<PointType>::Ptr& thisSurfKeyFrame   = surfCloudKeyFrames[i];
+
+      PointType thisPose3D;
+      thisPose3D.x         = keyFrame.pose[0];
+      thisPose3D.y         = keyFrame.pose[1];
+      thisPose3D.z         = keyFrame.pose[2];
+      thisPose3D.intensity = i;
+      cloudKeyPoses3D->push_back(thisPose3D);
+
+      PointTypePose thisPose6D;
+      thisPose6D.x         = thisPose3D.x;
+      thisPose6D.y         = thisPose3D.y;
+      thisPose6D.z         = thisPose3D.z;
+      thisPose6D.intensity = thisPose3D.intensity;
+      thisPose6D.roll      = keyFrame.pose[3];
+      thisPose6D.pitch     = keyFrame.pose[4];
+      thisPose6D.yaw       = keyFrame.pose[5];
+      thisPose6D.time      = keyFrame.time;
+      cloudKeyPoses6D->push_back(thisPose6D);
+
+      keyPoseGrid.add(thisPose3D.x, thisPose3D.y, thisPose3D.z);
+      keyPoseVersions.push_back(0);
+      keyPosesVersioned.push_back(thisPose6D);
+      globalMapPoses.push_back(thisPose6D);
+      queueGlobalMapKeyFrame(i);
+      queueTrajectoryKeyFrame(i);
+      if (mapExporter) {
+        mapExporter->addKeyFrame(i, thisPose6D, thisCornerKeyFrame, thisSurfKeyFrame);
+      }
+      updatePath(thisPose6D);
+
+      initialEstimate.insert(i, pclPointTogtsamPose3(thisPose6D));
+    }
+
+    for (int i = 0; i < int(session.header().numFactors); i++) {
+      const SessionFactor& factor = session.factor(i);
+      if (factor.from < 0 || factor.from >= numKeyFrames || factor.to < 0 || factor.to >= numKeyFrames) {
+        continue;
+      }
+
+      const gtsam::Pose3 value = Pose3(Rot3::RzRyRx(factor.value[3], factor.value[4], factor.value[5]), Point3(factor.value[0], factor.value[1], factor.value[2]));
+      const int          size  = factor.type == SessionFactor::GPS ? 3 : 6;
+      gtsam::Vector      sigmas(size);
+      for (int j = 0; j < size; j++) {
+        sigmas(j) = factor.sigmas[j];
+      }
+      const noiseModel::Diagonal::shared_ptr noise = noiseModel::Diagonal::Sigmas(sigmas);
+
+      switch (factor.type) {
+        case SessionFactor::PRIOR:
+          gtSAMgraph.add(PriorFactor<Pose3>(factor.from, value, noise));
+          break;
+        case SessionFactor::LOOP:
+          loopIndexContainer[factor.from] = factor.to;
+          gtSAMgraph.add(BetweenFactor<Pose3>(factor.from, factor.to, value, noise));
+          break;
+        case SessionFactor::ODOMETRY:
+          gtSAMgraph.add(BetweenFactor<Pose3>(factor.from, factor.to, value, noise));
+          break;
+        case SessionFactor::GPS:
+          gtSAMgraph.add(gtsam::GPSFactor(factor.from, gtsam::Point3(factor.value[0], factor.value[1], factor.value[2]), noise));
+          break;
+        default:
+          continue;
+      }
+      sessionFactors.push_back(factor);
+    }
+
+    // the saved poses are the optimum of the saved graph, a single update linearizes and eliminates it once
+    const ros::WallTime graphStart = ros::WallTime::now();
+    isam->update(gtSAMgraph, initialEstimate);
+    gtSAMgraph.resize(0);
+    initialEstimate.clear();
+
+    isamCurrentEstimate = isam->calculateEstimate();
+    poseCovariance      = isam->marginalCovariance(numKeyFrames - 1);
+    const double graphTime = (ros::WallTime::now() - graphStart).toSec();
+
+    // the robot is expected near the last keyframe, the first scan is aligned to the map around it
+    const PointTypePose& last = cloudKeyPoses6D->back();
+    transformTobeMapped[0]    = last.roll;
+    transformTobeMapped[1]    = last.pitch;
+    transformTobeMapped[2]    = last.yaw;
+    transformTobeMapped[3]    = last.x;
+    transformTobeMapped[4]    = last.y;
+    transformTobeMapped[5]    = last.z;
+    relocalizationPending     = true;
+
+    ROS_INFO("[MapOptimization]: session of %d keyframes and %d factors loaded from %s in %.3f s (clouds %.3f s, pose graph %.3f s)", numKeyFrames,
+             int(sessionFactors.size()), sessionFile.c_str(), (ros::WallTime::now() - start).toSec(), cloudsTime, graphTime);
+  }
+  /*//}*/
+
+  /*//{ loadedMapAround() */
+  // the keyframes of the loaded session within surroundingKeyframeSearchRadius of the pose, downsampled for relocalize()
+  pcl::PointCloud<PointType>::Ptr loadedMapAround(const PointTypePose& pose) {
+    pcl::PointCloud<PointType>::Ptr map(new pcl::PointCloud<PointType>());
+    pcl::PointCloud<PointType>::Ptr mapDS(new pcl::PointCloud<PointType>());
+    std::vector<int>                indices;
+    std::vector<float>              sqDistances;
+    keyPoseGrid.radiusSearch(pose.x, pose.y, pose.z, surroundingKeyframeSearchRadius, indices, sqDistances);
+    for (const int index : indices) {
+      pcl::PointCloud<PointType>::ConstPtr corner, surf;
+      transformedKeyFrame(index, corner, surf);
+      *map += *corner;
+      *map += *surf;
+    }
+    downSizeFilterICP.setInputCloud(map);
+    downSizeFilterICP.filter(*mapDS);
+    return mapDS;
+  }
+  /*//}*/
+
+  /*//{ relocalize() */
+  // aligns the current scan to the map (downsampled by downSizeFilterICP) around the guess, the heading is searched in relocalizationYawSteps steps,
+  // returns false if no alignment is good enough and the next scan should be tried
+  bool relocalize(const PointTypePose& guess, const pcl::PointCloud<PointType>::Ptr& mapDS) {
+    pcl::PointCloud<PointType>::Ptr scan(new pcl::PointCloud<PointType>());
+    pcl::PointCloud<PointType>::Ptr scanDS(new pcl::PointCloud<PointType>());
+    *scan += *laserCloudCornerLast;
+    *scan += *laserCloudSurfLast;
+    downSizeFilterICP.setInputCloud(scan);
+    downSizeFilterICP.filter(*scanDS);
+
+    if (mapDS->empty() || scanDS->size() < 300) {
+      return false;
+    }
+
+    pcl::IterativeClosestPoint<PointType, PointType> icp;
+    icp.setMaxCorrespondenceDistance(historyKeyframeSearchRadius * 2);
+    icp.setMaximumIterations(100);
+    icp.setTransformationEpsilon(1e-6);
+    icp.setEuclideanFitnessEpsilon(1e-6);
+    icp.setRANSACIterations(0);
+    icp.setInputSource(scanDS);
+    icp.setInputTarget(mapDS);
+
+    // roll and pitch are observable by the IMU, the heading is not known well enough
+    const float roll  = cloudInfo->imuAvailable ? cloudInfo->imuRollInit : guess.roll;
+    const float pitch = cloudInfo->imuAvailable ? cloudInfo->imuPitchInit : guess.pitch;
+
+    double                          bestScore = std::numeric_limits<double>::max();
+    Eigen::Matrix4f                 bestTransformation;
+    pcl::PointCloud<PointType>::Ptr unused_result(new pcl::PointCloud<PointType>());
+    for (int i = 0; i < std::max(relocalizationYawSteps, 1); i++) {
+      const float           yaw     = guess.yaw + 2 * M_PI * i / std::max(relocalizationYawSteps, 1);
+      const Eigen::Affine3f initial = pcl::getTransformation(guess.x, guess.y, guess.z, roll, pitch, yaw);
+      icp.align(*unused_result, initial.matrix());
+      if (icp.hasConverged() && icp.getFitnessScore() < bestScore) {
+        bestScore          = icp.getFitnessScore();
+        bestTransformation = icp.getFinalTransformation();
+      }
+    }
+
+    if (bestScore > historyKeyframeFitnessScore) {
+      ROS_WARN_THROTTLE(1.0, "[MapOptimization]: relocalization in the map failed (fitness %.3f), trying the next scan", bestScore);
+      return false;
+    }
+
+    const Eigen::Affine3f relocalized(bestTransformation);
+    pcl::getTranslationAndEulerAngles(relocalized, transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5], transformTobeMapped[0],
+                                      transformTobeMapped[1], transformTobeMapped[2]);
+    incrementalOdometryAffineFront = relocalized;
+    relocalizationNoise            = bestScore;
+
+    ROS_INFO("[MapOptimization]: relocalized in the map at [%.2f %.2f %.2f] (fitness %.3f)", transformTobeMapped[3], transformTobeMapped[4],
+             transformTobeMapped[5], bestScore);
+    return true;
+  }
+  /*//}*/
+
+  /*//{ loadLocalizationMap() */
+  // the map of localizationOnly from a session file or from cloudCorner.pcd and cloudSurf.pcd of a savePCD export in the directory, it becomes the
+  // local map of scan2MapOptimization for the whole run
+  bool loadLocalizationMap() {
+    const ros::WallTime start = ros::WallTime::now();
+
+    pcl::PointCloud<PointType>::Ptr corners(new pcl::PointCloud<PointType>());
+    pcl::PointCloud<PointType>::Ptr surfs(new pcl::PointCloud<PointType>());
+
+    SessionFile session;
+    if (session.open(localizationMap)) {
+      pcl::PointCloud<PointType> corner, surf;
+      for (int i = 0; i < int(session.header().numKeyFrames); i++) {
+        const SessionKeyFrame& keyFrame  = session.keyFrame(i);
+        const Eigen::Affine3f  transform = pcl::getTransformation(keyFrame.pose[0], keyFrame.pose[1], keyFrame.pose[2], keyFrame.pose[3], keyFrame.pose[4],
+                                                                 keyFrame.pose[5]);
+        session.clouds(i, corner, surf);
+        pcl::transformPointCloud(corner, corner, transform);
+        pcl::transformPointCloud(surf, surf, transform);
+        *corners += corner;
+        *surfs += surf;
+      }
+    } else if (pcl::io::loadPCDFile(localizationMap + "/cloudCorner.pcd", *corners) != 0 ||
+               pcl::io::loadPCDFile(localizationMap + "/cloudSurf.pcd", *surfs) != 0) {
+      return false;
+    }
+
+    downSizeFilterCorner.setInputCloud(corners);
+    downSizeFilterCorner.filter(*laserCloudCornerFromMapDS);
+    laserCloudCornerFromMapDSNum = laserCloudCornerFromMapDS->size();
+    downSizeFilterSurf.setInputCloud(surfs);
+    downSizeFilterSurf.filter(*laserCloudSurfFromMapDS);
+    laserCloudSurfFromMapDSNum = laserCloudSurfFromMapDS->size();
+    if (laserCloudCornerFromMapDSNum == 0 || laserCloudSurfFromMapDSNum == 0) {
+      return false;
+    }
+    localMapKdtreeOutdated = true;
+    localMapChanged();
+
+    localizationMapCloud.reset(new pcl::PointCloud<PointType>());
+    *localizationMapCloud += *laserCloudCornerFromMapDS;
+    *localizationMapCloud += *laserCloudSurfFromMapDS;
+
+    localizationMapVisualization.reset(new pcl::PointCloud<PointType>());
+    pcl::VoxelGrid<PointType> downSizeFilterVisualization;
+    downSizeFilterVisualization.setLeafSize(globalMapVisualizationLeafSize, globalMapVisualizationLeafSize, globalMapVisualizationLeafSize);
+    downSizeFilterVisualization.setInputCloud(localizationMapCloud);
+    downSizeFilterVisualization.filter(*localizationMapVisualization);
+
+    ROS_INFO("[MapOptimization]: localization map of %d corner and %d surf points loaded from %s in %.3f s", laserCloudCornerFromMapDSNum,
+             laserCloudSurfFromMapDSNum, localizationMap.c_str(), (ros::WallTime::now() - start).toSec());
+    return true;
+  }
+  /*//}*/
+
+  /*//{ localizeInMap() */
+  // localizationOnly: the scan is matched to the static map, nothing is added to the map or to the pose graph, the first scan is relocalized around
+  // the initial pose
+  void localizeInMap() {
+    if (!localizationStarted) {
+      PointTypePose guess;
+      guess.x     = localizationInitialX;
+      guess.y     = localizationInitialY;
+      guess.z     = localizationInitialZ;
+      guess.roll  = transformTobeMapped[0];
+      guess.pitch = transformTobeMapped[1];
+      guess.yaw   = localizationInitialYaw;
+
+      pcl::PointCloud<PointType>::Ptr map(new pcl::PointCloud<PointType>());
+      pcl::CropBox<PointType>         cropBox;
+      const float                     radius = surroundingKeyframeSearchRadius;
+      cropBox.setMin(Eigen::Vector4f(guess.x - radius, guess.y - radius, guess.z - radius, 1.0f));
+      cropBox.setMax(Eigen::Vector4f(guess.x + radius, guess.y + radius, guess.z + radius, 1.0f));
+      cropBox.setInputCloud(localizationMapCloud);
+      cropBox.filter(*map);
+
+      if (!relocalize(guess, map)) {
+        return;
+      }
+      localizationStarted = true;
+    }
+
+    downsampleCurrentScan();
+
+    scan2MapOptimization();
+
+    if (!isFirstMapOptimizationSuccessful) {
+      ROS_WARN("[MapOptimization]: optimization was not successful");
       return;
     }
 
-    cout << "****************************************************" << endl;
-    cout << "Saving map to pcd files ..." << endl;
-    // create directory and remove old files;
-    savePCDDirectory = std::getenv("HOME") + savePCDDirectory;
-    int unused       = system((std::string("exec rm -r ") + savePCDDirectory).c_str());
-    unused           = system((std::string("mkdir ") + savePCDDirectory).c_str());
-    // save key frame transformations
-    pcl::io::savePCDFileASCII(savePCDDirectory + "trajectory.pcd", *cloudKeyPoses3D);
-    pcl::io::savePCDFileASCII(savePCDDirectory + "transformations.pcd", *cloudKeyPoses6D);
-    // extract global point cloud map
-    pcl::PointCloud<PointType>::Ptr globalCornerCloud(new pcl::PointCloud<PointType>());
-    pcl::PointCloud<PointType>::Ptr globalCornerCloudDS(new pcl::PointCloud<PointType>());
-    pcl::PointCloud<PointType>::Ptr globalSurfCloud(new pcl::PointCloud<PointType>());
-    pcl::PointCloud<PointType>::Ptr globalSurfCloudDS(new pcl::PointCloud<PointType>());
-    pcl::PointCloud<PointType>::Ptr globalMapCloud(new pcl::PointCloud<PointType>());
-    for (int i = 0; i < (int)cloudKeyPoses3D->size(); i++) {
-      *globalCornerCloud += *transformPointCloud(cornerCloudKeyFrames[i], &cloudKeyPoses6D->points[i]);
-      *globalSurfCloud += *transformPointCloud(surfCloudKeyFrames[i], &cloudKeyPoses6D->points[i]);
-      cout << "\r" << std::flush << "Processing feature cloud " << i << " of " << cloudKeyPoses6D->size() << " ...";
-    }
-    // down-sample and save corner cloud
-    downSizeFilterCorner.setInputCloud(globalCornerCloud);
-    downSizeFilterCorner.filter(*globalCornerCloudDS);
-    pcl::io::savePCDFileASCII(savePCDDirectory + "cloudCorner.pcd", *globalCornerCloudDS);
-    // down-sample and save surf cloud
-    downSizeFilterSurf.setInputCloud(globalSurfCloud);
-    downSizeFilterSurf.filter(*globalSurfCloudDS);
-    pcl::io::savePCDFileASCII(savePCDDirectory + "cloudSurf.pcd", *globalSurfCloudDS);
-    // down-sample and save global point cloud map
-    *globalMapCloud += *globalCornerCloud;
-    *globalMapCloud += *globalSurfCloud;
-    pcl::io::savePCDFileASCII(savePCDDirectory + "cloudGlobal.pcd", *globalMapCloud);
-    cout << "****************************************************" << endl;
-    cout << "Saving map to pcd files completed" << endl;
+    publishOdometry();
+
+    publishFrames();
   }
   /*//}*/
 
   /*//{ publishGlobalMap() */
   void publishGlobalMap() {
+    if (localizationOnly) {
+      if (pubLaserCloudSurround.getNumSubscribers() > 0) {
+        publishCloud(&pubLaserCloudSurround, localizationMapVisualization, timeLaserInfoStamp, odometryFrame);
+      }
+      return;
+    }
+
+    if (globalMapIncremental) {
+      publishIncrementalGlobalMap();
+      return;
+    }
+
     if (pubLaserCloudSurround.getNumSubscribers() == 0) {
       return;
     }
@@ -667,6 +1245,108 @@ public:
   }
   /*//}*/
 
+  /*//{ publishIncrementalGlobalMap() */
+  void publishIncrementalGlobalMap() {
+    const bool publishMap   = pubLaserCloudSurround.getNumSubscribers() > 0;
+    const bool publishDelta = deltaPublishing && pubMapDelta.getNumSubscribers() > 0;
+    if (!publishMap && !publishDelta) {
+      return;
+    }
+
+    struct PendingKeyFrame
+    {
+      int                                  index;
+      PointTypePose                        pose;
+      pcl::PointCloud<PointType>::ConstPtr corner;
+      pcl::PointCloud<PointType>::ConstPtr surf;
+    };
+
+    // only the new and the moved keyframes are taken from the mapping thread
+    std::vector<PendingKeyFrame> pending;
+    PointType                    current;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (cloudKeyPoses3D->points.empty()) {
+        return;
+      }
+      for (const int index : globalMapQueue.take()) {
+        pending.push_back(PendingKeyFrame{index, globalMapPoses[index], cornerCloudKeyFrames[index], surfCloudKeyFrames[index]});
+      }
+      current = cloudKeyPoses3D->back();
+    }
+
+    pcl::PointCloud<PointType> keyFrame;
+    for (PendingKeyFrame& thisKeyFrame : pending) {
+      keyFrame = *transformPointCloud(thisKeyFrame.corner, &thisKeyFrame.pose);
+      keyFrame += *transformPointCloud(thisKeyFrame.surf, &thisKeyFrame.pose);
+      globalMap.insert(thisKeyFrame.index, keyFrame);
+    }
+
+    if (publishMap) {
+      pcl::PointCloud<PointType>::Ptr globalMapCloud(new pcl::PointCloud<PointType>());
+      globalMap.snapshot(*globalMapCloud, current.x, current.y, current.z, globalMapVisualizationSearchRadius);
+      publishCloud(&pubLaserCloudSurround, globalMapCloud, timeLaserInfoStamp, odometryFrame);
+    }
+
+    if (publishDelta) {
+      publishMapDelta();
+    }
+
+    ROS_INFO_THROTTLE(10.0, "[MapOptimization]: global map: %d keyframes, %d voxels, %d keyframes (re)inserted", globalMap.numKeyFrames(),
+                      globalMap.numVoxels(), int(pending.size()));
+  }
+  /*//}*/
+
+  /*//{ publishMapDelta() */
+  // the whole map is not cropped to globalMapVisualizationSearchRadius, the receiver keeps all of it
+  void publishMapDelta() {
+    liosam::MapDelta::Ptr      msg = boost::make_shared<liosam::MapDelta>();
+    pcl::PointCloud<PointType> cloud;
+
+    msg->full = mapDeltaStream.nextIsFull(pubMapDelta.getNumSubscribers(), ros::Time::now(), deltaFullPeriod);
+    if (msg->full) {
+      globalMap.takeAll(cloud, msg->keys);
+    } else {
+      globalMap.takeChanges(cloud, msg->keys, msg->removed_keys);
+      if (msg->keys.empty() && msg->removed_keys.empty()) {
+        return;
+      }
+    }
+
+    msg->header.stamp    = timeLaserInfoStamp;
+    msg->header.frame_id = odometryFrame;
+    msg->seq             = mapDeltaStream.seq++;
+    msg->leaf_size       = globalMap.leafSize();
+    pcl::toROSMsg(cloud, msg->cloud);
+    msg->cloud.header = msg->header;
+
+    try {
+      pubMapDelta.publish(msg);
+    }
+    catch (...) {
+      ROS_ERROR("[LioSam|MO]: Exception caught during publishing topic %s.", pubMapDelta.getTopic().c_str());
+    }
+  }
+  /*//}*/
+
+  /*//{ queueGlobalMapKeyFrame() */
+  // call with mtx locked
+  void queueGlobalMapKeyFrame(const int index) {
+    if (globalMapIncremental) {
+      globalMapQueue.push(index);
+    }
+  }
+  /*//}*/
+
+  /*//{ queueTrajectoryKeyFrame() */
+  // call with mtx locked
+  void queueTrajectoryKeyFrame(const int index) {
+    if (deltaPublishing) {
+      trajectoryQueue.push(index);
+    }
+  }
+  /*//}*/
+
   /*//{ callbackLoopClosureTimer() */
   void callbackLoopClosureTimer([[maybe_unused]] const ros::TimerEvent& event) {
 
@@ -804,11 +1484,18 @@ public:
     // find the closest history key frame
     std::vector<int>   pointSearchIndLoop;
     std::vector<float> pointSearchSqDisLoop;
-    kdtreeHistoryKeyPoses->setInputCloud(copy_cloudKeyPoses3D);
-    kdtreeHistoryKeyPoses->radiusSearch(copy_cloudKeyPoses3D->back(), historyKeyframeSearchRadius, pointSearchIndLoop, pointSearchSqDisLoop, 0);
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      const PointType&            cur = copy_cloudKeyPoses3D->back();
+      keyPoseGrid.radiusSearch(cur.x, cur.y, cur.z, historyKeyframeSearchRadius, pointSearchIndLoop, pointSearchSqDisLoop);
+    }
 
     for (int i = 0; i < (int)pointSearchIndLoop.size(); ++i) {
       int id = pointSearchIndLoop[i];
+      // keyframes added after the copy was taken
+      if (id >= loopKeyCur) {
+        continue;
+      }
       if (abs(copy_cloudKeyPoses6D->points[id].time - timeLaserInfoCur) > historyKeyframeSearchTimeDiff) {
         loopKeyPre = id;
         break;
@@ -987,25 +1674,31 @@ public:
     // initialization
     // orientation is needed here to initialize the orientation of the map origin
     // we can set it to orientation obtained from other source than IMU, e.g., orientation from HW API
-    if (cloudKeyPoses3D->points.empty()) {
-      transformTobeMapped[0] = cloudInfo.imuRollInit;
-      transformTobeMapped[1] = cloudInfo.imuPitchInit;
-      transformTobeMapped[2] = cloudInfo.imuYawInit;
+    if (cloudKeyPoses3D->points.empty() && !localizationStarted) {
+      transformTobeMapped[0] = cloudInfo->imuRollInit;
+      transformTobeMapped[1] = cloudInfo->imuPitchInit;
+      transformTobeMapped[2] = cloudInfo->imuYawInit;
 
       if (!useImuHeadingInitialization) {
         transformTobeMapped[2] = 0;
       }
 
-      lastImuTransformation = pcl::getTransformation(0, 0, 0, cloudInfo.imuRollInit, cloudInfo.imuPitchInit, cloudInfo.imuYawInit);  // save imu before return;
+      lastImuTransformation = pcl::getTransformation(0, 0, 0, cloudInfo->imuRollInit, cloudInfo->imuPitchInit, cloudInfo->imuYawInit);  // save imu before return;
+      return;
+    }
+
+    // after a warm start the pose comes from relocalize(), only the IMU orientation is kept for the increments of the following scans
+    if (relocalizationPending) {
+      lastImuTransformation = pcl::getTransformation(0, 0, 0, cloudInfo->imuRollInit, cloudInfo->imuPitchInit, cloudInfo->imuYawInit);  // save imu before return;
       return;
     }
 
     // use imu pre-integration estimation for pose guess
     static bool            lastImuPreTransAvailable = false;
     static Eigen::Affine3f lastImuPreTransformation;
-    if (cloudInfo.odomAvailable) {
-      const Eigen::Affine3f transBack = pcl::getTransformation(cloudInfo.initialGuessX, cloudInfo.initialGuessY, cloudInfo.initialGuessZ,
-                                                               cloudInfo.initialGuessRoll, cloudInfo.initialGuessPitch, cloudInfo.initialGuessYaw);
+    if (cloudInfo->odomAvailable) {
+      const Eigen::Affine3f transBack = pcl::getTransformation(cloudInfo->initialGuessX, cloudInfo->initialGuessY, cloudInfo->initialGuessZ,
+                                                               cloudInfo->initialGuessRoll, cloudInfo->initialGuessPitch, cloudInfo->initialGuessYaw);
       if (!lastImuPreTransAvailable) {
         lastImuPreTransformation = transBack;
         lastImuPreTransAvailable = true;
@@ -1021,7 +1714,7 @@ public:
         lastImuPreTransformation = transBack;
 
         lastImuTransformation =
-            pcl::getTransformation(0, 0, 0, cloudInfo.imuRollInit, cloudInfo.imuPitchInit, cloudInfo.imuYawInit);  // save imu before return;
+            pcl::getTransformation(0, 0, 0, cloudInfo->imuRollInit, cloudInfo->imuPitchInit, cloudInfo->imuYawInit);  // save imu before return;
         return;
       }
     }
@@ -1030,8 +1723,8 @@ public:
     // if available, use imu incremental estimation for pose guess (only rotation)
     // if not available, the pre-integrated rotation from above will be used
     // therefore, IMU orientation is not necessary here
-    if (cloudInfo.imuAvailable) {
-      const Eigen::Affine3f transBack  = pcl::getTransformation(0, 0, 0, cloudInfo.imuRollInit, cloudInfo.imuPitchInit, cloudInfo.imuYawInit);
+    if (cloudInfo->imuAvailable) {
+      const Eigen::Affine3f transBack  = pcl::getTransformation(0, 0, 0, cloudInfo->imuRollInit, cloudInfo->imuPitchInit, cloudInfo->imuYawInit);
       const Eigen::Affine3f transIncre = lastImuTransformation.inverse() * transBack;  // only place where lastImuTransformation is used
 
       const Eigen::Affine3f transTobe  = trans2Affine3f(transformTobeMapped);
@@ -1039,7 +1732,7 @@ public:
       pcl::getTranslationAndEulerAngles(transFinal, transformTobeMapped[3], transformTobeMapped[4], transformTobeMapped[5], transformTobeMapped[0],
                                         transformTobeMapped[1], transformTobeMapped[2]);
 
-      lastImuTransformation = pcl::getTransformation(0, 0, 0, cloudInfo.imuRollInit, cloudInfo.imuPitchInit, cloudInfo.imuYawInit);  // save imu before return;
+      lastImuTransformation = pcl::getTransformation(0, 0, 0, cloudInfo->imuRollInit, cloudInfo->imuPitchInit, cloudInfo->imuYawInit);  // save imu before return;
       return;
     }
   }
@@ -1069,8 +1762,8 @@ public:
     std::vector<float>              pointSearchSqDis;
 
     // extract all the nearby key poses and downsample them
-    kdtreeSurroundingKeyPoses->setInputCloud(cloudKeyPoses3D);  // create kd-tree
-    kdtreeSurroundingKeyPoses->radiusSearch(cloudKeyPoses3D->back(), (double)surroundingKeyframeSearchRadius, pointSearchInd, pointSearchSqDis);
+    const PointType& cur = cloudKeyPoses3D->back();
+    keyPoseGrid.radiusSearch(cur.x, cur.y, cur.z, surroundingKeyframeSearchRadius, pointSearchInd, pointSearchSqDis);
     for (int i = 0; i < (int)pointSearchInd.size(); ++i) {
       int id = pointSearchInd[i];
       surroundingKeyPoses->push_back(cloudKeyPoses3D->points[id]);
@@ -1079,8 +1772,8 @@ public:
     downSizeFilterSurroundingKeyPoses.setInputCloud(surroundingKeyPoses);
     downSizeFilterSurroundingKeyPoses.filter(*surroundingKeyPosesDS);
     for (auto& pt : surroundingKeyPosesDS->points) {
-      kdtreeSurroundingKeyPoses->nearestKSearch(pt, 1, pointSearchInd, pointSearchSqDis);
-      pt.intensity = cloudKeyPoses3D->points[pointSearchInd[0]].intensity;
+      float sqDistance;
+      pt.intensity = cloudKeyPoses3D->points[keyPoseGrid.nearestSearch(pt.x, pt.y, pt.z, sqDistance)].intensity;
     }
 
     // also extract some latest key frames in case the robot rotates in one position
@@ -1099,42 +1792,69 @@ public:
 
   /*//{ extractCloud() */
   void extractCloud(pcl::PointCloud<PointType>::Ptr cloudToExtract) {
-    // fuse the map
-    laserCloudCornerFromMap->clear();
-    laserCloudSurfFromMap->clear();
+    const auto& stats = keyFrameCache.stats();
+    ROS_INFO_THROTTLE(10.0, "[MapOptimization]: keyframe cache: %lu keyframes, %.1f MB, hits: %lu, misses: %lu (outdated pose: %lu), evictions: %lu",
+                      keyFrameCache.size(), keyFrameCache.bytes() / (1024.0 * 1024.0), stats.hits, stats.misses, stats.invalidations, stats.evictions);
+
+    std::vector<std::pair<int, uint32_t>> keyFrames;
     for (int i = 0; i < (int)cloudToExtract->size(); ++i) {
       if (pointDistance(cloudToExtract->points[i], cloudKeyPoses3D->back()) > surroundingKeyframeSearchRadius) {
         continue;
       }
-
       const int thisKeyInd = (int)cloudToExtract->points[i].intensity;
-      if (laserCloudMapContainer.find(thisKeyInd) != laserCloudMapContainer.end()) {
-        // transformed cloud available
-        *laserCloudCornerFromMap += laserCloudMapContainer[thisKeyInd].first;
-        *laserCloudSurfFromMap += laserCloudMapContainer[thisKeyInd].second;
-      } else {
-        // transformed cloud not available
-        pcl::PointCloud<PointType> laserCloudCornerTemp = *transformPointCloud(cornerCloudKeyFrames[thisKeyInd], &cloudKeyPoses6D->points[thisKeyInd]);
-        pcl::PointCloud<PointType> laserCloudSurfTemp   = *transformPointCloud(surfCloudKeyFrames[thisKeyInd], &cloudKeyPoses6D->points[thisKeyInd]);
-        *laserCloudCornerFromMap += laserCloudCornerTemp;
-        *laserCloudSurfFromMap += laserCloudSurfTemp;
-        laserCloudMapContainer[thisKeyInd] = make_pair(laserCloudCornerTemp, laserCloudSurfTemp);
-      }
+      keyFrames.emplace_back(thisKeyInd, keyPoseVersions[thisKeyInd]);
     }
 
-    // Downsample the surrounding corner key frames (or map)
-    downSizeFilterCorner.setInputCloud(laserCloudCornerFromMap);
-    downSizeFilterCorner.filter(*laserCloudCornerFromMapDS);
+    // the same keyframes with the same poses give the same map
+    if (keyFrames == localMapKeyFrames) {
+      return;
+    }
+    localMapKeyFrames.swap(keyFrames);
+
+    // fuse the map
+    laserCloudCornerFromMap->clear();
+    laserCloudSurfFromMap->clear();
+    for (const auto& keyFrame : localMapKeyFrames) {
+      pcl::PointCloud<PointType>::ConstPtr corner, surf;
+      transformedKeyFrame(keyFrame.first, corner, surf);
+      *laserCloudCornerFromMap += *corner;
+      *laserCloudSurfFromMap += *surf;
+    }
+
+    // Downsample the surrounding corner key frames (or map)
+    downSizeFilterCorner.setInputCloud(laserCloudCornerFromMap);
+    downSizeFilterCorner.filter(*laserCloudCornerFromMapDS);
     laserCloudCornerFromMapDSNum = laserCloudCornerFromMapDS->size();
     // Downsample the surrounding surf key frames (or map)
     downSizeFilterSurf.setInputCloud(laserCloudSurfFromMap);
     downSizeFilterSurf.filter(*laserCloudSurfFromMapDS);
     laserCloudSurfFromMapDSNum = laserCloudSurfFromMapDS->size();
 
-    // clear map cache if too large
-    if (laserCloudMapContainer.size() > 1000) {
-      laserCloudMapContainer.clear();
+    localMapKdtreeOutdated = true;
+    localMapChanged();
+  }
+  /*//}*/
+
+  /*//{ localMapChanged() */
+  // the primitives cached for the previous local map are no longer valid
+  void localMapChanged() {
+    if (cornerPrimitiveCache) {
+      ROS_INFO_THROTTLE(10.0, "[MapOptimization]: primitive cache hits: %lu, misses: %lu", primitiveCacheStats.hits, primitiveCacheStats.misses);
+      cornerPrimitiveCache->clear();
+      surfPrimitiveCache->clear();
+    }
+  }
+  /*//}*/
+
+  /*//{ transformedKeyFrame() */
+  // feature clouds of the keyframe in the map frame, transformed only if the cache has none for its current pose
+  void transformedKeyFrame(const int keyInd, pcl::PointCloud<PointType>::ConstPtr& corner, pcl::PointCloud<PointType>::ConstPtr& surf) {
+    if (keyFrameCache.get(keyInd, keyPoseVersions[keyInd], corner, surf)) {
+      return;
     }
+    corner = transformPointCloud(cornerCloudKeyFrames[keyInd], &cloudKeyPoses6D->points[keyInd]);
+    surf   = transformPointCloud(surfCloudKeyFrames[keyInd], &cloudKeyPoses6D->points[keyInd]);
+    keyFrameCache.put(keyInd, keyPoseVersions[keyInd], corner, surf);
   }
   /*//}*/
 
@@ -1151,10 +1871,124 @@ public:
     //     extractNearby();
     // }
 
+    if (incrementalCornerMap) {
+      updateIncrementalLocalMap();
+      return;
+    }
+
     extractNearby();
   }
   /*//}*/
 
+  /*//{ updateIncrementalLocalMap() */
+  // The incremental local map is a box of surroundingKeyframeSearchRadius around the robot. Nothing is done until the robot gets half of that
+  // distance away from the center, then the box is moved: the points that left it are deleted and the keyframes that entered it are inserted.
+  // Keyframes are tracked by their positions. New keyframes are inserted as they are saved, a loop closure rebuilds the map from scratch.
+  void updateIncrementalLocalMap() {
+    const float x = transformTobeMapped[3];
+    const float y = transformTobeMapped[4];
+    const float z = transformTobeMapped[5];
+
+    if (localMapValid) {
+      const float dx = std::abs(x - 0.5f * (localMapBox.min[0] + localMapBox.max[0]));
+      const float dy = std::abs(y - 0.5f * (localMapBox.min[1] + localMapBox.max[1]));
+      const float dz = std::abs(z - 0.5f * (localMapBox.min[2] + localMapBox.max[2]));
+      if (std::max(dx, std::max(dy, dz)) < 0.5f * surroundingKeyframeSearchRadius) {
+        return;
+      }
+    }
+
+    const bool rebuild = !localMapValid;
+    localMapBox        = MapBox::around(x, y, z, surroundingKeyframeSearchRadius);
+
+    if (rebuild) {
+      keyFrameInLocalMap.assign(cloudKeyPoses3D->size(), false);
+    } else {
+      incrementalCornerMap->keepBox(localMapBox);
+      incrementalSurfMap->keepBox(localMapBox);
+    }
+
+    laserCloudCornerFromMap->clear();
+    laserCloudSurfFromMap->clear();
+    for (int i = 0; i < (int)cloudKeyPoses3D->size(); ++i) {
+      const PointType& pose = cloudKeyPoses3D->points[i];
+      if (!localMapBox.contains(pose.x, pose.y, pose.z)) {
+        keyFrameInLocalMap[i] = false;
+        continue;
+      }
+      if (keyFrameInLocalMap[i]) {
+        continue;
+      }
+      pcl::PointCloud<PointType>::ConstPtr corner, surf;
+      transformedKeyFrame(i, corner, surf);
+      *laserCloudCornerFromMap += *corner;
+      *laserCloudSurfFromMap += *surf;
+      keyFrameInLocalMap[i] = true;
+    }
+
+    if (rebuild) {
+      downSizeFilterCorner.setInputCloud(laserCloudCornerFromMap);
+      downSizeFilterCorner.filter(*laserCloudCornerFromMapDS);
+      incrementalCornerMap->build(*laserCloudCornerFromMapDS);
+
+      downSizeFilterSurf.setInputCloud(laserCloudSurfFromMap);
+      downSizeFilterSurf.filter(*laserCloudSurfFromMapDS);
+      incrementalSurfMap->build(*laserCloudSurfFromMapDS);
+
+      localMapValid = true;
+    } else {
+      incrementalCornerMap->addPoints(*laserCloudCornerFromMap, mappingCornerLeafSize);
+      incrementalSurfMap->addPoints(*laserCloudSurfFromMap, mappingSurfLeafSize);
+    }
+
+    laserCloudCornerFromMapDSNum = incrementalCornerMap->size();
+    laserCloudSurfFromMapDSNum   = incrementalSurfMap->size();
+    localMapChanged();
+
+    ROS_INFO("[MapOptimization]: local map %s at [%.1f, %.1f, %.1f], corners: %d, surfs: %d", rebuild ? "built" : "moved", x, y, z,
+             laserCloudCornerFromMapDSNum, laserCloudSurfFromMapDSNum);
+  }
+  /*//}*/
+
+  /*//{ addKeyFrameToLocalMap() */
+  // the last saved keyframe goes to the incremental local map
+  void addKeyFrameToLocalMap() {
+    keyFrameInLocalMap.resize(cloudKeyPoses3D->size(), false);
+    if (!localMapValid) {
+      return;
+    }
+
+    const int                            thisKeyInd = cloudKeyPoses3D->size() - 1;
+    pcl::PointCloud<PointType>::ConstPtr corner, surf;
+    transformedKeyFrame(thisKeyInd, corner, surf);
+    incrementalCornerMap->addPoints(*corner, mappingCornerLeafSize);
+    incrementalSurfMap->addPoints(*surf, mappingSurfLeafSize);
+    keyFrameInLocalMap[thisKeyInd] = true;
+
+    laserCloudCornerFromMapDSNum = incrementalCornerMap->size();
+    laserCloudSurfFromMapDSNum   = incrementalSurfMap->size();
+    localMapChanged();
+  }
+  /*//}*/
+
+  /*//{ searchLocalMap() */
+  // k nearest points of the local map, sorted by distance, returns false if the map has less than k points
+  bool searchLocalMap(const bool corner, const PointType& point, const int k, std::vector<PointType>& nearPoints, std::vector<float>& sqDistances,
+                      std::vector<int>& indices) const {
+    if (incrementalCornerMap) {
+      return (corner ? incrementalCornerMap : incrementalSurfMap)->nearestKSearch(point, k, nearPoints, sqDistances) == k;
+    }
+
+    const pcl::PointCloud<PointType>::Ptr& cloud = corner ? laserCloudCornerFromMapDS : laserCloudSurfFromMapDS;
+    (corner ? kdtreeCornerFromMap : kdtreeSurfFromMap)->nearestKSearch(point, k, indices, sqDistances);
+    nearPoints.resize(indices.size());
+    for (size_t j = 0; j < indices.size(); j++) {
+      nearPoints[j] = cloud->points[indices[j]];
+    }
+    return int(indices.size()) == k;
+  }
+  /*//}*/
+
   /*//{ downsampleCurrentScan() */
   void downsampleCurrentScan() {
     // Downsample cloud from current scan
@@ -1167,6 +2001,31 @@ public:
     downSizeFilterSurf.setInputCloud(laserCloudSurfLast);
     downSizeFilterSurf.filter(*laserCloudSurfLastDS);
     laserCloudSurfLastDSNum = laserCloudSurfLastDS->size();
+
+    // the buffers of the optimization grow with the largest scan seen so far, the new flags are false
+    if (int(laserCloudOriCornerVec.size()) < laserCloudCornerLastDSNum) {
+      laserCloudOriCornerVec.resize(laserCloudCornerLastDSNum);
+      coeffSelCornerVec.resize(laserCloudCornerLastDSNum);
+      laserCloudOriCornerFlag.resize(laserCloudCornerLastDSNum, false);
+      cornerAssociations.resize(laserCloudCornerLastDSNum);
+    }
+    if (int(laserCloudOriSurfVec.size()) < laserCloudSurfLastDSNum) {
+      laserCloudOriSurfVec.resize(laserCloudSurfLastDSNum);
+      coeffSelSurfVec.resize(laserCloudSurfLastDSNum);
+      laserCloudOriSurfFlag.resize(laserCloudSurfLastDSNum, false);
+      surfAssociations.resize(laserCloudSurfLastDSNum);
+    }
+
+    // the order is computed in the lidar frame once per scan, a rigid transformation keeps the points close to each other
+    if (mortonOrderedQueries) {
+      mortonOrder(*laserCloudCornerLastDS, 1.0f, cornerQueryOrder);
+      mortonOrder(*laserCloudSurfLastDS, 1.0f, surfQueryOrder);
+    } else {
+      cornerQueryOrder.resize(laserCloudCornerLastDSNum);
+      std::iota(cornerQueryOrder.begin(), cornerQueryOrder.end(), 0);
+      surfQueryOrder.resize(laserCloudSurfLastDSNum);
+      std::iota(surfQueryOrder.begin(), surfQueryOrder.end(), 0);
+    }
   }
   /*//}*/
 
@@ -1176,183 +2035,245 @@ public:
   }
   /*//}*/
 
-  /*//{ cornerOptimization() */
-  void cornerOptimization() {
-    updatePointAssociateToMap();
+  /*//{ struct LocalMapQuery */
+  // buffers of the local map search of one point, reused by a thread for all its points
+  struct LocalMapQuery
+  {
+    std::vector<int>       indices;
+    std::vector<float>     sqDistances;
+    std::vector<PointType> nearPoints;
+    uint64_t               cacheHits   = 0;  // primitive cache lookups
+    uint64_t               cacheMisses = 0;
+  };
+  /*//}*/
 
-#pragma omp parallel for num_threads(numberOfCores)
-    for (int i = 0; i < laserCloudCornerLastDSNum; i++) {
-      PointType          pointOri, pointSel, coeff;
-      std::vector<int>   pointSearchInd;
-      std::vector<float> pointSearchSqDis;
-
-      pointOri = laserCloudCornerLastDS->points[i];
-      pointAssociateToMap(&pointOri, &pointSel);
-      kdtreeCornerFromMap->nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-
-      cv::Mat matA1(3, 3, CV_32F, cv::Scalar::all(0));
-      cv::Mat matD1(1, 3, CV_32F, cv::Scalar::all(0));
-      cv::Mat matV1(3, 3, CV_32F, cv::Scalar::all(0));
-
-      if (pointSearchSqDis[4] < 1.0) {
-        float cx = 0, cy = 0, cz = 0;
-        for (int j = 0; j < 5; j++) {
-          cx += laserCloudCornerFromMapDS->points[pointSearchInd[j]].x;
-          cy += laserCloudCornerFromMapDS->points[pointSearchInd[j]].y;
-          cz += laserCloudCornerFromMapDS->points[pointSearchInd[j]].z;
-        }
-        cx /= 5.0f;
-        cy /= 5.0f;
-        cz /= 5.0f;
-
-        float a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
-        for (int j = 0; j < 5; j++) {
-          const float ax = laserCloudCornerFromMapDS->points[pointSearchInd[j]].x - cx;
-          const float ay = laserCloudCornerFromMapDS->points[pointSearchInd[j]].y - cy;
-          const float az = laserCloudCornerFromMapDS->points[pointSearchInd[j]].z - cz;
-
-          a11 += ax * ax;
-          a12 += ax * ay;
-          a13 += ax * az;
-          a22 += ay * ay;
-          a23 += ay * az;
-          a33 += az * az;
-        }
-        a11 /= 5;
-        a12 /= 5;
-        a13 /= 5;
-        a22 /= 5;
-        a23 /= 5;
-        a33 /= 5;
-
-        matA1.at<float>(0, 0) = a11;
-        matA1.at<float>(0, 1) = a12;
-        matA1.at<float>(0, 2) = a13;
-        matA1.at<float>(1, 0) = a12;
-        matA1.at<float>(1, 1) = a22;
-        matA1.at<float>(1, 2) = a23;
-        matA1.at<float>(2, 0) = a13;
-        matA1.at<float>(2, 1) = a23;
-        matA1.at<float>(2, 2) = a33;
-
-        cv::eigen(matA1, matD1, matV1);
-
-        if (matD1.at<float>(0, 0) > 3 * matD1.at<float>(0, 1)) {
-
-          const float x0 = pointSel.x;
-          const float y0 = pointSel.y;
-          const float z0 = pointSel.z;
-          const float x1 = cx + 0.1f * matV1.at<float>(0, 0);
-          const float y1 = cy + 0.1f * matV1.at<float>(0, 1);
-          const float z1 = cz + 0.1f * matV1.at<float>(0, 2);
-          const float x2 = cx - 0.1f * matV1.at<float>(0, 0);
-          const float y2 = cy - 0.1f * matV1.at<float>(0, 1);
-          const float z2 = cz - 0.1f * matV1.at<float>(0, 2);
-
-          const float a012 = sqrt(((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) +
-                                  ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) +
-                                  ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1)) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1)));
-
-          const float l12 = sqrt((x1 - x2) * (x1 - x2) + (y1 - y2) * (y1 - y2) + (z1 - z2) * (z1 - z2));
-
-          const float la =
-              ((y1 - y2) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) + (z1 - z2) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1))) / a012 / l12;
-
-          const float lb =
-              -((x1 - x2) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) - (z1 - z2) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1))) / a012 / l12;
-
-          const float lc =
-              -((x1 - x2) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) + (y1 - y2) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1))) / a012 / l12;
-
-          const float ld2 = a012 / l12;
-
-          const float s = 1.0f - 0.9f * fabs(ld2);
-
-          coeff.x         = s * la;
-          coeff.y         = s * lb;
-          coeff.z         = s * lc;
-          coeff.intensity = s * ld2;
-
-          if (s > 0.1) {
-            laserCloudOriCornerVec[i]  = pointOri;
-            coeffSelCornerVec[i]       = coeff;
-            laserCloudOriCornerFlag[i] = true;
-          }
-        }
+  /*//{ cornerCoefficients() */
+  // point-to-line residual of the corner point (in the lidar frame) and its gradient in the map frame, false if it has no usable line in the local
+  // map; the transform is the one of the last updatePointAssociateToMap(), the line is searched again only with reassociate
+  bool cornerCoefficients(const PointType& pointOri, LocalMapQuery& query, MapPrimitive& association, const bool reassociate, PointType& coeff) {
+    PointType pointSel;
+    pointAssociateToMap(&pointOri, &pointSel);
+    if (reassociate) {
+      mapPrimitive(true, pointSel, query, association);
+    }
+    if (!association.valid) {
+      return false;
+    }
+
+    const float cx = association.p[0];
+    const float cy = association.p[1];
+    const float cz = association.p[2];
+
+    const float x0 = pointSel.x;
+    const float y0 = pointSel.y;
+    const float z0 = pointSel.z;
+    const float x1 = cx + 0.1f * association.p[3];
+    const float y1 = cy + 0.1f * association.p[4];
+    const float z1 = cz + 0.1f * association.p[5];
+    const float x2 = cx - 0.1f * association.p[3];
+    const float y2 = cy - 0.1f * association.p[4];
+    const float z2 = cz - 0.1f * association.p[5];
+
+    const float a012 = sqrt(((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) +
+                            ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) +
+                            ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1)) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1)));
+
+    const float l12 = sqrt((x1 - x2) * (x1 - x2) + (y1 - y2) * (y1 - y2) + (z1 - z2) * (z1 - z2));
+
+    const float la =
+        ((y1 - y2) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) + (z1 - z2) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1))) / a012 / l12;
+
+    const float lb =
+        -((x1 - x2) * ((x0 - x1) * (y0 - y2) - (x0 - x2) * (y0 - y1)) - (z1 - z2) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1))) / a012 / l12;
+
+    const float lc =
+        -((x1 - x2) * ((x0 - x1) * (z0 - z2) - (x0 - x2) * (z0 - z1)) + (y1 - y2) * ((y0 - y1) * (z0 - z2) - (y0 - y2) * (z0 - z1))) / a012 / l12;
+
+    const float ld2 = a012 / l12;
+
+    const float s = 1.0f - 0.9f * fabs(ld2);
+
+    coeff.x         = s * la;
+    coeff.y         = s * lb;
+    coeff.z         = s * lc;
+    coeff.intensity = s * ld2;
+
+    return s > 0.1;
+  }
+  /*//}*/
+
+  /*//{ mapPrimitive() */
+  // line (corner) or plane of the local map around the point; with the primitive cache the one of the voxel of the point, fitted around the voxel
+  // centre if the cache does not have it yet, so it is the same whichever point of the voxel comes first
+  void mapPrimitive(const bool corner, const PointType& pointSel, LocalMapQuery& query, MapPrimitive& primitive) {
+    PrimitiveCache* cache = corner ? cornerPrimitiveCache.get() : surfPrimitiveCache.get();
+    if (!cache) {
+      primitive.valid = corner ? fitLine(pointSel, query, primitive) : fitPlane(pointSel, query, primitive);
+      return;
+    }
+
+    if (cache->find(pointSel.x, pointSel.y, pointSel.z, primitive)) {
+      query.cacheHits++;
+      return;
+    }
+    query.cacheMisses++;
+
+    PointType centre = pointSel;
+    cache->centre(pointSel.x, pointSel.y, pointSel.z, centre.x, centre.y, centre.z);
+    primitive.valid = corner ? fitLine(centre, query, primitive) : fitPlane(centre, query, primitive);
+    cache->insert(pointSel.x, pointSel.y, pointSel.z, primitive);
+  }
+  /*//}*/
+
+  /*//{ fitLine() */
+  // line through the 5 nearest corners of the local map, false if they are too far or not linear enough
+  bool fitLine(const PointType& pointSel, LocalMapQuery& query, MapPrimitive& association) {
+    if (!searchLocalMap(true, pointSel, 5, query.nearPoints, query.sqDistances, query.indices)) {
+      return false;
+    }
+
+    if (query.sqDistances[4] < 1.0) {
+      float centroid[3], covariance[6];
+      lineCovariance(query.nearPoints.data(), 5, centroid, covariance);
+      if (lineDirection(covariance, association.p + 3)) {
+        association.p[0] = centroid[0];
+        association.p[1] = centroid[1];
+        association.p[2] = centroid[2];
+        return true;
       }
     }
+    return false;
   }
   /*//}*/
 
-  /*//{ surfOptimization() */
-  void surfOptimization() {
-    updatePointAssociateToMap();
+  /*//{ surfCoefficients() */
+  // point-to-plane residual of the surface point, see cornerCoefficients()
+  bool surfCoefficients(const PointType& pointOri, LocalMapQuery& query, MapPrimitive& association, const bool reassociate, PointType& coeff) {
+    PointType pointSel;
+    pointAssociateToMap(&pointOri, &pointSel);
+    if (reassociate) {
+      mapPrimitive(false, pointSel, query, association);
+    }
+    if (!association.valid) {
+      return false;
+    }
 
-#pragma omp parallel for num_threads(numberOfCores)
-    for (int i = 0; i < laserCloudSurfLastDSNum; i++) {
-      PointType          pointOri, pointSel, coeff;
-      std::vector<int>   pointSearchInd;
-      std::vector<float> pointSearchSqDis;
-
-      pointOri = laserCloudSurfLastDS->points[i];
-      pointAssociateToMap(&pointOri, &pointSel);
-      kdtreeSurfFromMap->nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-
-      Eigen::Matrix<float, 5, 3> matA0;
-      Eigen::Matrix<float, 5, 1> matB0;
-      Eigen::Vector3f            matX0;
-
-      matA0.setZero();
-      matB0.fill(-1);
-      matX0.setZero();
-
-      if (pointSearchSqDis[4] < 1.0) {
-        for (int j = 0; j < 5; j++) {
-          matA0(j, 0) = laserCloudSurfFromMapDS->points[pointSearchInd[j]].x;
-          matA0(j, 1) = laserCloudSurfFromMapDS->points[pointSearchInd[j]].y;
-          matA0(j, 2) = laserCloudSurfFromMapDS->points[pointSearchInd[j]].z;
-        }
+    const float pa = association.p[0];
+    const float pb = association.p[1];
+    const float pc = association.p[2];
+    const float pd = association.p[3];
 
-        matX0 = matA0.colPivHouseholderQr().solve(matB0);
+    const float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
 
-        float pa = matX0(0, 0);
-        float pb = matX0(1, 0);
-        float pc = matX0(2, 0);
-        float pd = 1;
+    const float s = 1.0f - 0.9f * fabs(pd2) / sqrt(sqrt(pointSel.x * pointSel.x + pointSel.y * pointSel.y + pointSel.z * pointSel.z));
 
-        const float ps = sqrt(pa * pa + pb * pb + pc * pc);
-        pa /= ps;
-        pb /= ps;
-        pc /= ps;
-        pd /= ps;
+    coeff.x         = s * pa;
+    coeff.y         = s * pb;
+    coeff.z         = s * pc;
+    coeff.intensity = s * pd2;
 
-        bool planeValid = true;
-        for (int j = 0; j < 5; j++) {
-          if (fabs(pa * laserCloudSurfFromMapDS->points[pointSearchInd[j]].x + pb * laserCloudSurfFromMapDS->points[pointSearchInd[j]].y +
-                   pc * laserCloudSurfFromMapDS->points[pointSearchInd[j]].z + pd) > 0.2) {
-            planeValid = false;
-            break;
-          }
-        }
+    return s > 0.1;
+  }
+  /*//}*/
 
-        if (planeValid) {
-          const float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
+  /*//{ fitPlane() */
+  // plane through the 5 nearest surface points of the local map, false if they are too far or not planar enough
+  bool fitPlane(const PointType& pointSel, LocalMapQuery& query, MapPrimitive& association) {
+    if (!searchLocalMap(false, pointSel, 5, query.nearPoints, query.sqDistances, query.indices)) {
+      return false;
+    }
 
-          const float s = 1.0f - 0.9f * fabs(pd2) / sqrt(sqrt(pointSel.x * pointSel.x + pointSel.y * pointSel.y + pointSel.z * pointSel.z));
+    Eigen::Matrix<float, 5, 3> matA0;
+    Eigen::Matrix<float, 5, 1> matB0;
+    Eigen::Vector3f            matX0;
 
-          coeff.x         = s * pa;
-          coeff.y         = s * pb;
-          coeff.z         = s * pc;
-          coeff.intensity = s * pd2;
+    matA0.setZero();
+    matB0.fill(-1);
+    matX0.setZero();
 
-          if (s > 0.1) {
-            laserCloudOriSurfVec[i]  = pointOri;
-            coeffSelSurfVec[i]       = coeff;
-            laserCloudOriSurfFlag[i] = true;
-          }
+    if (query.sqDistances[4] < 1.0) {
+      for (int j = 0; j < 5; j++) {
+        matA0(j, 0) = query.nearPoints[j].x;
+        matA0(j, 1) = query.nearPoints[j].y;
+        matA0(j, 2) = query.nearPoints[j].z;
+      }
+
+      matX0 = matA0.colPivHouseholderQr().solve(matB0);
+
+      float pa = matX0(0, 0);
+      float pb = matX0(1, 0);
+      float pc = matX0(2, 0);
+      float pd = 1;
+
+      const float ps = sqrt(pa * pa + pb * pb + pc * pc);
+      pa /= ps;
+      pb /= ps;
+      pc /= ps;
+      pd /= ps;
+
+      bool planeValid = true;
+      for (int j = 0; j < 5; j++) {
+        if (fabs(pa * query.nearPoints[j].x + pb * query.nearPoints[j].y + pc * query.nearPoints[j].z + pd) > 0.2) {
+          planeValid = false;
+          break;
         }
       }
+
+      if (planeValid) {
+        association.p[0] = pa;
+        association.p[1] = pb;
+        association.p[2] = pc;
+        association.p[3] = pd;
+        return true;
+      }
+    }
+    return false;
+  }
+  /*//}*/
+
+  /*//{ cornerOptimization() */
+  void cornerOptimization(const bool reassociate) {
+    updatePointAssociateToMap();
+
+    uint64_t cacheHits = 0, cacheMisses = 0;
+#pragma omp parallel for num_threads(numberOfCores) reduction(+ : cacheHits, cacheMisses)
+    for (int k = 0; k < laserCloudCornerLastDSNum; k++) {
+      const int     i = cornerQueryOrder[k];
+      LocalMapQuery query;
+      PointType     coeff;
+      if (cornerCoefficients(laserCloudCornerLastDS->points[i], query, cornerAssociations[i], reassociate, coeff)) {
+        laserCloudOriCornerVec[i]  = laserCloudCornerLastDS->points[i];
+        coeffSelCornerVec[i]       = coeff;
+        laserCloudOriCornerFlag[i] = true;
+      }
+      cacheHits += query.cacheHits;
+      cacheMisses += query.cacheMisses;
     }
+    primitiveCacheStats.hits += cacheHits;
+    primitiveCacheStats.misses += cacheMisses;
+  }
+  /*//}*/
+
+  /*//{ surfOptimization() */
+  void surfOptimization(const bool reassociate) {
+    updatePointAssociateToMap();
+
+    uint64_t cacheHits = 0, cacheMisses = 0;
+#pragma omp parallel for num_threads(numberOfCores) reduction(+ : cacheHits, cacheMisses)
+    for (int k = 0; k < laserCloudSurfLastDSNum; k++) {
+      const int     i = surfQueryOrder[k];
+      LocalMapQuery query;
+      PointType     coeff;
+      if (surfCoefficients(laserCloudSurfLastDS->points[i], query, surfAssociations[i], reassociate, coeff)) {
+        laserCloudOriSurfVec[i]  = laserCloudSurfLastDS->points[i];
+        coeffSelSurfVec[i]       = coeff;
+        laserCloudOriSurfFlag[i] = true;
+      }
+      cacheHits += query.cacheHits;
+      cacheMisses += query.cacheMisses;
+    }
+    primitiveCacheStats.hits += cacheHits;
+    primitiveCacheStats.misses += cacheMisses;
   }
   /*//}*/
 
@@ -1378,6 +2299,57 @@ public:
   }
   /*//}*/
 
+  /*//{ struct LmJacobian */
+  // one row of the Jacobian of the scan-to-map residuals, in the camera convention of loam_velodyne (see LMOptimization())
+  struct LmJacobian
+  {
+    float srx, crx, sry, cry, srz, crz;
+
+    // lidar -> camera
+    explicit LmJacobian(const float transform[6])
+        : srx(sin(transform[1])),
+          crx(cos(transform[1])),
+          sry(sin(transform[2])),
+          cry(cos(transform[2])),
+          srz(sin(transform[0])),
+          crz(cos(transform[0])) {
+    }
+
+    // fills the row of the correspondence and returns its right hand side
+    float row(const PointType& pointLidar, const PointType& coeffLidar, float a[6]) const {
+      PointType pointOri, coeff;
+      // lidar -> camera
+      pointOri.x = pointLidar.y;
+      pointOri.y = pointLidar.z;
+      pointOri.z = pointLidar.x;
+      // lidar -> camera
+      coeff.x         = coeffLidar.y;
+      coeff.y         = coeffLidar.z;
+      coeff.z         = coeffLidar.x;
+      coeff.intensity = coeffLidar.intensity;
+      // in camera
+      const float arx = (crx * sry * srz * pointOri.x + crx * crz * sry * pointOri.y - srx * sry * pointOri.z) * coeff.x +
+                        (-srx * srz * pointOri.x - crz * srx * pointOri.y - crx * pointOri.z) * coeff.y +
+                        (crx * cry * srz * pointOri.x + crx * cry * crz * pointOri.y - cry * srx * pointOri.z) * coeff.z;
+
+      const float ary = ((cry * srx * srz - crz * sry) * pointOri.x + (sry * srz + cry * crz * srx) * pointOri.y + crx * cry * pointOri.z) * coeff.x +
+                        ((-cry * crz - srx * sry * srz) * pointOri.x + (cry * srz - crz * srx * sry) * pointOri.y - crx * sry * pointOri.z) * coeff.z;
+
+      const float arz = ((crz * srx * sry - cry * srz) * pointOri.x + (-cry * crz - srx * sry * srz) * pointOri.y) * coeff.x +
+                        (crx * crz * pointOri.x - crx * srz * pointOri.y) * coeff.y +
+                        ((sry * srz + cry * crz * srx) * pointOri.x + (crz * sry - cry * srx * srz) * pointOri.y) * coeff.z;
+      // lidar -> camera
+      a[0] = arz;
+      a[1] = arx;
+      a[2] = ary;
+      a[3] = coeff.z;
+      a[4] = coeff.x;
+      a[5] = coeff.y;
+      return -coeff.intensity;
+    }
+  };
+  /*//}*/
+
   /*//{ LMOptimization() */
   bool LMOptimization(int iterCount) {
     // This optimization is from the original loam_velodyne by Ji Zhang, need to cope with coordinate transformation
@@ -1389,19 +2361,13 @@ public:
     // pitch = roll         ---     pitch = yaw
     // yaw = pitch          ---     yaw = roll
 
-    // lidar -> camera
-    const float srx = sin(transformTobeMapped[1]);
-    const float crx = cos(transformTobeMapped[1]);
-    const float sry = sin(transformTobeMapped[2]);
-    const float cry = cos(transformTobeMapped[2]);
-    const float srz = sin(transformTobeMapped[0]);
-    const float crz = cos(transformTobeMapped[0]);
-
     const int laserCloudSelNum = laserCloudOri->size();
     if (laserCloudSelNum < 50) {
       return false;
     }
 
+    const LmJacobian jacobian(transformTobeMapped);
+
     cv::Mat matA(laserCloudSelNum, 6, CV_32F, cv::Scalar::all(0));
     cv::Mat matAt(6, laserCloudSelNum, CV_32F, cv::Scalar::all(0));
     cv::Mat matAtA(6, 6, CV_32F, cv::Scalar::all(0));
@@ -1409,37 +2375,8 @@ public:
     cv::Mat matAtB(6, 1, CV_32F, cv::Scalar::all(0));
     cv::Mat matX(6, 1, CV_32F, cv::Scalar::all(0));
 
-    PointType pointOri, coeff;
-
     for (int i = 0; i < laserCloudSelNum; i++) {
-      // lidar -> camera
-      pointOri.x = laserCloudOri->points[i].y;
-      pointOri.y = laserCloudOri->points[i].z;
-      pointOri.z = laserCloudOri->points[i].x;
-      // lidar -> camera
-      coeff.x         = coeffSel->points[i].y;
-      coeff.y         = coeffSel->points[i].z;
-      coeff.z         = coeffSel->points[i].x;
-      coeff.intensity = coeffSel->points[i].intensity;
-      // in camera
-      const float arx = (crx * sry * srz * pointOri.x + crx * crz * sry * pointOri.y - srx * sry * pointOri.z) * coeff.x +
-                        (-srx * srz * pointOri.x - crz * srx * pointOri.y - crx * pointOri.z) * coeff.y +
-                        (crx * cry * srz * pointOri.x + crx * cry * crz * pointOri.y - cry * srx * pointOri.z) * coeff.z;
-
-      const float ary = ((cry * srx * srz - crz * sry) * pointOri.x + (sry * srz + cry * crz * srx) * pointOri.y + crx * cry * pointOri.z) * coeff.x +
-                        ((-cry * crz - srx * sry * srz) * pointOri.x + (cry * srz - crz * srx * sry) * pointOri.y - crx * sry * pointOri.z) * coeff.z;
-
-      const float arz = ((crz * srx * sry - cry * srz) * pointOri.x + (-cry * crz - srx * sry * srz) * pointOri.y) * coeff.x +
-                        (crx * crz * pointOri.x - crx * srz * pointOri.y) * coeff.y +
-                        ((sry * srz + cry * crz * srx) * pointOri.x + (crz * sry - cry * srx * srz) * pointOri.y) * coeff.z;
-      // lidar -> camera
-      matA.at<float>(i, 0) = arz;
-      matA.at<float>(i, 1) = arx;
-      matA.at<float>(i, 2) = ary;
-      matA.at<float>(i, 3) = coeff.z;
-      matA.at<float>(i, 4) = coeff.x;
-      matA.at<float>(i, 5) = coeff.y;
-      matB.at<float>(i, 0) = -coeff.intensity;
+      matB.at<float>(i, 0) = jacobian.row(laserCloudOri->points[i], coeffSel->points[i], matA.ptr<float>(i));
     }
 
     cv::transpose(matA, matAt);
@@ -1477,16 +2414,108 @@ public:
       matX = matP * matX2;
     }
 
-    transformTobeMapped[0] += matX.at<float>(0, 0);
-    transformTobeMapped[1] += matX.at<float>(1, 0);
-    transformTobeMapped[2] += matX.at<float>(2, 0);
-    transformTobeMapped[3] += matX.at<float>(3, 0);
-    transformTobeMapped[4] += matX.at<float>(4, 0);
-    transformTobeMapped[5] += matX.at<float>(5, 0);
+    return applyLmStep(matX.ptr<float>(0));
+  }
+  /*//}*/
+
+  /*//{ scanToMapStep() */
+  // One LM iteration in a single parallel pass with lmNormalEquations: the residuals of the corner and surface points go straight into J^T J and
+  // J^T r, without the intermediate clouds and the N x 6 Jacobian. Every thread sums a contiguous block of the corners followed by the surfaces
+  // (in the query order) and the blocks are added in order, so the result does not depend on the scheduling.
+  bool scanToMapStep(const int iterCount, const bool reassociate) {
+    updatePointAssociateToMap();
+    const LmJacobian jacobian(transformTobeMapped);
+
+    const int numPoints = laserCloudCornerLastDSNum + laserCloudSurfLastDSNum;
+    const int numBlocks = lmNormalEquationBlocks.size();
+
+    uint64_t cacheHits = 0, cacheMisses = 0;
+#pragma omp parallel for num_threads(numBlocks) schedule(static) reduction(+ : cacheHits, cacheMisses)
+    for (int block = 0; block < numBlocks; block++) {
+      Eigen::Matrix<float, 6, 6> JtJ   = Eigen::Matrix<float, 6, 6>::Zero();
+      Eigen::Matrix<float, 6, 1> Jtr   = Eigen::Matrix<float, 6, 1>::Zero();
+      int                        count = 0;
+      Eigen::Matrix<float, 6, 1> a;
+      LocalMapQuery              query;
+      PointType                  coeff;
+
+      const int end = int((int64_t(numPoints) * (block + 1)) / numBlocks);
+      for (int i = int((int64_t(numPoints) * block) / numBlocks); i < end; i++) {
+        const bool       corner   = i < laserCloudCornerLastDSNum;
+        const int        j        = corner ? cornerQueryOrder[i] : surfQueryOrder[i - laserCloudCornerLastDSNum];
+        const PointType& pointOri = corner ? laserCloudCornerLastDS->points[j] : laserCloudSurfLastDS->points[j];
+        if (corner ? !cornerCoefficients(pointOri, query, cornerAssociations[j], reassociate, coeff)
+                   : !surfCoefficients(pointOri, query, surfAssociations[j], reassociate, coeff)) {
+          continue;
+        }
+
+        const float b = jacobian.row(pointOri, coeff, a.data());
+        JtJ.noalias() += a * a.transpose();
+        Jtr.noalias() += a * b;
+        count++;
+      }
+
+      lmNormalEquationBlocks[block].JtJ   = JtJ;
+      lmNormalEquationBlocks[block].Jtr   = Jtr;
+      lmNormalEquationBlocks[block].count = count;
+      cacheHits += query.cacheHits;
+      cacheMisses += query.cacheMisses;
+    }
+    primitiveCacheStats.hits += cacheHits;
+    primitiveCacheStats.misses += cacheMisses;
+
+    Eigen::Matrix<float, 6, 6> JtJ   = Eigen::Matrix<float, 6, 6>::Zero();
+    Eigen::Matrix<float, 6, 1> Jtr   = Eigen::Matrix<float, 6, 1>::Zero();
+    int                        count = 0;
+    for (const NormalEquations& block : lmNormalEquationBlocks) {
+      JtJ += block.JtJ;
+      Jtr += block.Jtr;
+      count += block.count;
+    }
+
+    if (count < 50) {
+      return false;
+    }
+
+    Eigen::Matrix<float, 6, 1> x = JtJ.ldlt().solve(Jtr);
+
+    // directions with eigenvalues under the threshold are degenerate, the update is projected out of them for the whole scan
+    if (iterCount == 0) {
+      const Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 6, 6>> eigen(JtJ);
+
+      Eigen::Matrix<float, 6, 6> kept = eigen.eigenvectors();
+      isDegenerate                    = false;
+      for (int i = 0; i < 6; i++) {
+        if (eigen.eigenvalues()(i) < 100) {
+          kept.col(i).setZero();
+          isDegenerate = true;
+        } else {
+          break;
+        }
+      }
+      degeneracyProjection = kept * eigen.eigenvectors().transpose();
+    }
+
+    if (isDegenerate) {
+      x = degeneracyProjection * x;
+    }
 
-    const float deltaR =
-        sqrt(pow(pcl::rad2deg(matX.at<float>(0, 0)), 2) + pow(pcl::rad2deg(matX.at<float>(1, 0)), 2) + pow(pcl::rad2deg(matX.at<float>(2, 0)), 2));
-    const float deltaT = sqrt(pow(matX.at<float>(3, 0) * 100, 2) + pow(matX.at<float>(4, 0) * 100, 2) + pow(matX.at<float>(5, 0) * 100, 2));
+    return applyLmStep(x.data());
+  }
+  /*//}*/
+
+  /*//{ applyLmStep() */
+  // adds the update (camera convention order roll, pitch, yaw, x, y, z of transformTobeMapped) and returns true when converged
+  bool applyLmStep(const float matX[6]) {
+    transformTobeMapped[0] += matX[0];
+    transformTobeMapped[1] += matX[1];
+    transformTobeMapped[2] += matX[2];
+    transformTobeMapped[3] += matX[3];
+    transformTobeMapped[4] += matX[4];
+    transformTobeMapped[5] += matX[5];
+
+    const float deltaR = sqrt(pow(pcl::rad2deg(matX[0]), 2) + pow(pcl::rad2deg(matX[1]), 2) + pow(pcl::rad2deg(matX[2]), 2));
+    const float deltaT = sqrt(pow(matX[3] * 100, 2) + pow(matX[4] * 100, 2) + pow(matX[5] * 100, 2));
 
     if (deltaR < 0.05 && deltaT < 0.05) {
       return true;  // converged
@@ -1497,20 +2526,40 @@ public:
 
   /*//{ scan2MapOptimization() */
   void scan2MapOptimization() {
-    if (cloudKeyPoses3D->points.empty()) {
+    if (cloudKeyPoses3D->points.empty() && !localizationStarted) {
       return;
     }
 
     if (laserCloudCornerLastDSNum > edgeFeatureMinValidNum && laserCloudSurfLastDSNum > surfFeatureMinValidNum) {
-      kdtreeCornerFromMap->setInputCloud(laserCloudCornerFromMapDS);
-      kdtreeSurfFromMap->setInputCloud(laserCloudSurfFromMapDS);
+      if (!incrementalCornerMap && localMapKdtreeOutdated) {
+        kdtreeCornerFromMap->setInputCloud(laserCloudCornerFromMapDS);
+        kdtreeSurfFromMap->setInputCloud(laserCloudSurfFromMapDS);
+        localMapKdtreeOutdated = false;
+      }
 
+      float transformAssociated[6];
       for (int iterCount = 0; iterCount < 30; iterCount++) {
+        // the correspondences of the previous iteration are kept while the pose has not moved much since they were found
+        const bool reassociate = iterCount == 0 || associationMoved(transformAssociated);
+        if (reassociate) {
+          std::copy(transformTobeMapped, transformTobeMapped + 6, transformAssociated);
+          associationStats.searched++;
+        } else {
+          associationStats.reused++;
+        }
+
+        if (lmNormalEquations) {
+          if (scanToMapStep(iterCount, reassociate)) {
+            break;
+          }
+          continue;
+        }
+
         laserCloudOri->clear();
         coeffSel->clear();
 
-        cornerOptimization();
-        surfOptimization();
+        cornerOptimization(reassociate);
+        surfOptimization(reassociate);
 
         combineOptimizationCoeffs();
 
@@ -1527,19 +2576,33 @@ public:
 
       isFirstMapOptimizationSuccessful = true;
 
+      ROS_INFO_THROTTLE(10.0, "[MapOptimization]: LM iterations with new correspondences: %lu, with reused ones: %lu", associationStats.searched,
+                        associationStats.reused);
+
     } else {
       ROS_WARN("Not enough features! Only %d edge and %d planar features available.", laserCloudCornerLastDSNum, laserCloudSurfLastDSNum);
     }
   }
   /*//}*/
 
+  /*//{ associationMoved() */
+  // true if the pose has moved more than associationMaxTranslation / associationMaxRotation since the correspondences were found
+  bool associationMoved(const float transformAssociated[6]) const {
+    const float dt = sqrt(pow(transformTobeMapped[3] - transformAssociated[3], 2) + pow(transformTobeMapped[4] - transformAssociated[4], 2) +
+                          pow(transformTobeMapped[5] - transformAssociated[5], 2));
+    const float dr = sqrt(pow(transformTobeMapped[0] - transformAssociated[0], 2) + pow(transformTobeMapped[1] - transformAssociated[1], 2) +
+                          pow(transformTobeMapped[2] - transformAssociated[2], 2));
+    return dt > associationMaxTranslation || dr > associationMaxRotation;
+  }
+  /*//}*/
+
   /*//{ transformUpdate() */
   // called after scan2Map LMOptimization - transformTobeMapped already contains the optimized transform
   void transformUpdate() {
 
     // when IMU is available, the roll and pitch angles are interpolated between the transform and the IMU orientation
-    if (cloudInfo.imuAvailable) {
-      if (std::abs(cloudInfo.imuPitchInit) < 1.4) {
+    if (cloudInfo->imuAvailable) {
+      if (std::abs(cloudInfo->imuPitchInit) < 1.4) {
         const double   imuWeight = imuRPYWeight;
         tf2::Quaternion imuQuaternion;
         tf2::Quaternion transformQuaternion;
@@ -1547,13 +2610,13 @@ public:
 
         // slerp roll
         transformQuaternion.setRPY(transformTobeMapped[0], 0, 0);
-        imuQuaternion.setRPY(cloudInfo.imuRollInit, 0, 0);
+        imuQuaternion.setRPY(cloudInfo->imuRollInit, 0, 0);
         tf2::Matrix3x3(transformQuaternion.slerp(imuQuaternion, imuWeight)).getRPY(rollMid, pitchMid, yawMid);
         transformTobeMapped[0] = rollMid;
 
         // slerp pitch
         transformQuaternion.setRPY(0, transformTobeMapped[1], 0);
-        imuQuaternion.setRPY(0, cloudInfo.imuPitchInit, 0);
+        imuQuaternion.setRPY(0, cloudInfo->imuPitchInit, 0);
         tf2::Matrix3x3(transformQuaternion.slerp(imuQuaternion, imuWeight)).getRPY(rollMid, pitchMid, yawMid);
         transformTobeMapped[1] = pitchMid;
       }
@@ -1609,17 +2672,48 @@ public:
           noiseModel::Diagonal::Variances((Vector(6) << 1e-2, 1e-2, M_PI * M_PI, 1e8, 1e8, 1e8).finished());  // rad*rad, meter*meter
       gtSAMgraph.add(PriorFactor<Pose3>(0, trans2gtsamPose(transformTobeMapped), priorNoise));
       initialEstimate.insert(0, trans2gtsamPose(transformTobeMapped));
+      recordFactor(SessionFactor::PRIOR, 0, 0, trans2gtsamPose(transformTobeMapped), priorNoise->sigmas());
 
     } else {
-      const noiseModel::Diagonal::shared_ptr odometryNoise = noiseModel::Diagonal::Variances((Vector(6) << 1e-6, 1e-6, 1e-6, 1e-4, 1e-4, 1e-4).finished());
-      const gtsam::Pose3                     poseFrom      = pclPointTogtsamPose3(cloudKeyPoses6D->points.back());
-      const gtsam::Pose3                     poseTo        = trans2gtsamPose(transformTobeMapped);
+      noiseModel::Diagonal::shared_ptr odometryNoise = noiseModel::Diagonal::Variances((Vector(6) << 1e-6, 1e-6, 1e-6, 1e-4, 1e-4, 1e-4).finished());
+      // the first keyframe after a warm start is linked to the loaded session by the relocalization, as uncertain as a loop closure
+      if (relocalizationNoise >= 0) {
+        odometryNoise       = noiseModel::Diagonal::Variances(Vector::Constant(6, relocalizationNoise));
+        relocalizationNoise = -1;
+      }
+      const gtsam::Pose3 poseFrom = pclPointTogtsamPose3(cloudKeyPoses6D->points.back());
+      const gtsam::Pose3 poseTo   = trans2gtsamPose(transformTobeMapped);
       gtSAMgraph.add(BetweenFactor<Pose3>(cloudKeyPoses3D->size() - 1, cloudKeyPoses3D->size(), poseFrom.between(poseTo), odometryNoise));
       initialEstimate.insert(cloudKeyPoses3D->size(), poseTo);
+      recordFactor(SessionFactor::ODOMETRY, cloudKeyPoses3D->size() - 1, cloudKeyPoses3D->size(), poseFrom.between(poseTo), odometryNoise->sigmas());
     }
   }
   /*//}*/
 
+  /*//{ recordFactor() */
+  // keeps the factor for the session file
+  void recordFactor(const SessionFactor::Type type, const int from, const int to, const gtsam::Pose3& value, const gtsam::Vector& sigmas) {
+    if (sessionFile.empty()) {
+      return;
+    }
+
+    SessionFactor factor{};
+    factor.type     = type;
+    factor.from     = from;
+    factor.to       = to;
+    factor.value[0] = value.translation().x();
+    factor.value[1] = value.translation().y();
+    factor.value[2] = value.translation().z();
+    factor.value[3] = value.rotation().roll();
+    factor.value[4] = value.rotation().pitch();
+    factor.value[5] = value.rotation().yaw();
+    for (int i = 0; i < std::min(int(sigmas.size()), 6); i++) {
+      factor.sigmas[i] = sigmas(i);
+    }
+    sessionFactors.push_back(factor);
+  }
+  /*//}*/
+
   /*//{ addGPSFactor() */
   void addGPSFactor() {
     if (gpsQueue.empty()) {
@@ -1689,6 +2783,8 @@ public:
         const noiseModel::Diagonal::shared_ptr gps_noise = noiseModel::Diagonal::Variances(Vector3);
         gtsam::GPSFactor                       gps_factor(cloudKeyPoses3D->size(), gtsam::Point3(gps_x, gps_y, gps_z), gps_noise);
         gtSAMgraph.add(gps_factor);
+        recordFactor(SessionFactor::GPS, cloudKeyPoses3D->size(), cloudKeyPoses3D->size(), Pose3(Rot3(), gtsam::Point3(gps_x, gps_y, gps_z)),
+                     gps_noise->sigmas());
 
         aLoopIsClosed = true;
         break;
@@ -1709,6 +2805,7 @@ public:
       const gtsam::Pose3                            poseBetween  = loopPoseQueue[i];
       const gtsam::noiseModel::Diagonal::shared_ptr noiseBetween = loopNoiseQueue[i];
       gtSAMgraph.add(BetweenFactor<Pose3>(indexFrom, indexTo, poseBetween, noiseBetween));
+      recordFactor(SessionFactor::LOOP, indexFrom, indexTo, poseBetween, noiseBetween->sigmas());
     }
 
     loopIndexQueue.clear();
@@ -1776,6 +2873,9 @@ public:
     thisPose6D.yaw       = latestEstimate.rotation().yaw();
     thisPose6D.time      = timeLaserInfoCur;
     cloudKeyPoses6D->push_back(thisPose6D);
+    keyPoseGrid.add(thisPose3D.x, thisPose3D.y, thisPose3D.z);
+    keyPoseVersions.push_back(0);
+    keyPosesVersioned.push_back(thisPose6D);
 
     // cout << "****************************************************" << endl;
     // cout << "Pose covariance:" << endl;
@@ -1800,6 +2900,18 @@ public:
     cornerCloudKeyFrames.push_back(thisCornerKeyFrame);
     surfCloudKeyFrames.push_back(thisSurfKeyFrame);
 
+    if (mapExporter) {
+      mapExporter->addKeyFrame(cloudKeyPoses6D->size() - 1, thisPose6D, thisCornerKeyFrame, thisSurfKeyFrame);
+    }
+
+    if (incrementalCornerMap) {
+      addKeyFrameToLocalMap();
+    }
+
+    globalMapPoses.push_back(thisPose6D);
+    queueGlobalMapKeyFrame(cloudKeyPoses6D->size() - 1);
+    queueTrajectoryKeyFrame(cloudKeyPoses6D->size() - 1);
+
     // save path for visualization
     updatePath(thisPose6D);
   }
@@ -1812,16 +2924,17 @@ public:
     }
 
     if (aLoopIsClosed == true) {
-      // clear map cache
-      laserCloudMapContainer.clear();
+      localMapValid = false;
       // clear path
       globalPath->poses.clear();
       // update key poses
-      const int numPoses = isamCurrentEstimate.size();
+      const int                                  numPoses = isamCurrentEstimate.size();
+      std::vector<std::pair<int, PointTypePose>> movedPoses;
       for (int i = 0; i < numPoses; ++i) {
         cloudKeyPoses3D->points[i].x = isamCurrentEstimate.at<Pose3>(i).translation().x();
         cloudKeyPoses3D->points[i].y = isamCurrentEstimate.at<Pose3>(i).translation().y();
         cloudKeyPoses3D->points[i].z = isamCurrentEstimate.at<Pose3>(i).translation().z();
+        keyPoseGrid.update(i, cloudKeyPoses3D->points[i].x, cloudKeyPoses3D->points[i].y, cloudKeyPoses3D->points[i].z);
 
         cloudKeyPoses6D->points[i].x     = cloudKeyPoses3D->points[i].x;
         cloudKeyPoses6D->points[i].y     = cloudKeyPoses3D->points[i].y;
@@ -1830,16 +2943,48 @@ public:
         cloudKeyPoses6D->points[i].pitch = isamCurrentEstimate.at<Pose3>(i).rotation().pitch();
         cloudKeyPoses6D->points[i].yaw   = isamCurrentEstimate.at<Pose3>(i).rotation().yaw();
 
+        // the cached transformed clouds of the keyframe become outdated only if it has moved noticeably
+        if (poseMoved(keyPosesVersioned[i], cloudKeyPoses6D->points[i], keyFrameCachePoseTolerance)) {
+          keyPoseVersions[i]++;
+          keyPosesVersioned[i] = cloudKeyPoses6D->points[i];
+          movedPoses.emplace_back(i, cloudKeyPoses6D->points[i]);
+          queueTrajectoryKeyFrame(i);
+        }
+
+        // the global map is coarser, its keyframes are inserted again (and their voxels sent in the map deltas) only after larger corrections
+        if (poseMoved(globalMapPoses[i], cloudKeyPoses6D->points[i], globalMapPoseTolerance)) {
+          globalMapPoses[i] = cloudKeyPoses6D->points[i];
+          queueGlobalMapKeyFrame(i);
+        }
+
         updatePath(cloudKeyPoses6D->points[i]);
       }
 
+      if (mapExporter && !movedPoses.empty()) {
+        mapExporter->updatePoses(movedPoses);
+      }
+
       aLoopIsClosed = false;
     }
   }
   /*//}*/
 
+  /*//{ poseMoved() */
+  // translation [m] or rotation [rad] between the poses over the tolerance
+  bool poseMoved(const PointTypePose& from, const PointTypePose& to, const float tolerance) {
+    const Eigen::Affine3f delta = pclPointToAffine3f(from).inverse() * pclPointToAffine3f(to);
+    return delta.translation().norm() > tolerance || Eigen::AngleAxisf(delta.rotation()).angle() > tolerance;
+  }
+  /*//}*/
+
   /*//{ updatePath() */
   void updatePath(const PointTypePose& pose_in) {
+    globalPath->poses.push_back(toPoseStamped(pose_in));
+  }
+  /*//}*/
+
+  /*//{ toPoseStamped() */
+  geometry_msgs::PoseStamped toPoseStamped(const PointTypePose& pose_in) {
     geometry_msgs::PoseStamped pose_stamped;
     pose_stamped.header.stamp       = ros::Time().fromSec(pose_in.time);
     pose_stamped.header.frame_id    = odometryFrame;
@@ -1852,8 +2997,7 @@ public:
     pose_stamped.pose.orientation.y = q.y();
     pose_stamped.pose.orientation.z = q.z();
     pose_stamped.pose.orientation.w = q.w();
-
-    globalPath->poses.push_back(pose_stamped);
+    return pose_stamped;
   }
   /*//}*/
 
@@ -1913,8 +3057,8 @@ public:
       increOdomAffine             = increOdomAffine * affineIncre;
       float x, y, z, roll, pitch, yaw;
       pcl::getTranslationAndEulerAngles(increOdomAffine, x, y, z, roll, pitch, yaw);
-      if (cloudInfo.imuAvailable) {
-        if (std::abs(cloudInfo.imuPitchInit) < 1.4) {
+      if (cloudInfo->imuAvailable) {
+        if (std::abs(cloudInfo->imuPitchInit) < 1.4) {
           const double   imuWeight = 0.1;
           tf2::Quaternion imuQuaternion;
           tf2::Quaternion transformQuaternion;
@@ -1922,13 +3066,13 @@ public:
 
           // slerp roll
           transformQuaternion.setRPY(roll, 0, 0);
-          imuQuaternion.setRPY(cloudInfo.imuRollInit, 0, 0);
+          imuQuaternion.setRPY(cloudInfo->imuRollInit, 0, 0);
           tf2::Matrix3x3(transformQuaternion.slerp(imuQuaternion, imuWeight)).getRPY(rollMid, pitchMid, yawMid);
           roll = rollMid;
 
           // slerp pitch
           transformQuaternion.setRPY(0, pitch, 0);
-          imuQuaternion.setRPY(0, cloudInfo.imuPitchInit, 0);
+          imuQuaternion.setRPY(0, cloudInfo->imuPitchInit, 0);
           tf2::Matrix3x3(transformQuaternion.slerp(imuQuaternion, imuWeight)).getRPY(rollMid, pitchMid, yawMid);
           pitch = pitchMid;
         }
@@ -1960,13 +3104,19 @@ public:
 
   /*//{ publishFrames() */
   void publishFrames() {
-    if (cloudKeyPoses3D->points.empty()) {
+    if (cloudKeyPoses3D->points.empty() && !localizationStarted) {
       return;
     }
-    // publish key poses
-    publishCloud(&pubKeyPoses, cloudKeyPoses3D, timeLaserInfoStamp, odometryFrame);
-    // Publish surrounding key frames
-    publishCloud(&pubRecentKeyFrames, laserCloudSurfFromMapDS, timeLaserInfoStamp, odometryFrame);
+    // the static map of localizationOnly is published by publishGlobalMap(), it has no key poses and no path
+    if (!localizationOnly) {
+      // publish key poses
+      publishCloud(&pubKeyPoses, cloudKeyPoses3D, timeLaserInfoStamp, odometryFrame);
+      // Publish surrounding key frames
+      if (incrementalSurfMap && pubRecentKeyFrames.getNumSubscribers() > 0) {
+        incrementalSurfMap->flatten(*laserCloudSurfFromMapDS);
+      }
+      publishCloud(&pubRecentKeyFrames, laserCloudSurfFromMapDS, timeLaserInfoStamp, odometryFrame);
+    }
     // publish registered key frame
     if (pubRecentKeyFrame.getNumSubscribers() != 0) {
       pcl::PointCloud<PointType>::Ptr cloudOut(new pcl::PointCloud<PointType>());
@@ -1977,15 +3127,13 @@ public:
     }
     // publish registered high-res raw cloud
     if (pubCloudRegisteredRaw.getNumSubscribers() != 0) {
-      pcl::PointCloud<PointType>::Ptr cloudOut(new pcl::PointCloud<PointType>());
-      pcl::fromROSMsg(cloudInfo.cloud_deskewed, *cloudOut);
-      PointTypePose thisPose6D = trans2PointTypePose(transformTobeMapped);
-      *cloudOut                = *transformPointCloud(cloudOut, &thisPose6D);
+      PointTypePose                   thisPose6D = trans2PointTypePose(transformTobeMapped);
+      pcl::PointCloud<PointType>::Ptr cloudOut   = transformPointCloud(cloudInfo->cloudDeskewed, &thisPose6D);
       publishCloud(&pubCloudRegisteredRaw, cloudOut, timeLaserInfoStamp, odometryFrame);
     }
 
     // publish path
-    if (pubPath.getNumSubscribers() > 0) {
+    if (!localizationOnly && pubPath.getNumSubscribers() > 0) {
       globalPath->header.stamp    = timeLaserInfoStamp;
       globalPath->header.frame_id = odometryFrame;
 
@@ -1996,6 +3144,44 @@ public:
         ROS_ERROR("[LioSam|MO]: Exception caught during publishing topic %s.", pubPath.getTopic().c_str());
       }
     }
+
+    if (deltaPublishing && pubTrajectoryDelta.getNumSubscribers() > 0) {
+      publishTrajectoryDelta();
+    }
+  }
+  /*//}*/
+
+  /*//{ publishTrajectoryDelta() */
+  // call with mtx locked
+  void publishTrajectoryDelta() {
+    liosam::TrajectoryDelta::Ptr msg = boost::make_shared<liosam::TrajectoryDelta>();
+
+    msg->full                    = trajectoryDeltaStream.nextIsFull(pubTrajectoryDelta.getNumSubscribers(), ros::Time::now(), deltaFullPeriod);
+    const std::vector<int> moved = trajectoryQueue.take();
+    if (msg->full) {
+      msg->indices.resize(cloudKeyPoses6D->size());
+      std::iota(msg->indices.begin(), msg->indices.end(), 0);
+    } else if (moved.empty()) {
+      return;
+    } else {
+      msg->indices.assign(moved.begin(), moved.end());
+    }
+
+    msg->header.stamp    = timeLaserInfoStamp;
+    msg->header.frame_id = odometryFrame;
+    msg->seq             = trajectoryDeltaStream.seq++;
+    msg->size            = cloudKeyPoses6D->size();
+    msg->poses.reserve(msg->indices.size());
+    for (const uint32_t index : msg->indices) {
+      msg->poses.push_back(toPoseStamped(cloudKeyPoses6D->points[index]));
+    }
+
+    try {
+      pubTrajectoryDelta.publish(msg);
+    }
+    catch (...) {
+      ROS_ERROR("[LioSam|MO]: Exception caught during publishing topic %s.", pubTrajectoryDelta.getTopic().c_str());
+    }
   }
   /*//}*/
 };